@@ -0,0 +1,238 @@
+#include "autotune.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+
+namespace
+{
+double secondsSince(std::chrono::steady_clock::time_point t)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+}
+
+// tiles larger than the grid are the same candidate as the grid
+std::vector<std::pair<int, int>> clampedTiles(const std::vector<std::pair<int, int>>& tiles, int width, int height)
+{
+    std::vector<std::pair<int, int>> result;
+    for (auto tile : tiles)
+    {
+        tile = {std::min(tile.first, width), std::min(tile.second, height)};
+        if (std::find(result.begin(), result.end(), tile) == result.end()) result.push_back(tile);
+    }
+    return result;
+}
+}
+
+Autotune::Config Autotune::tune(Simulation& sim, const Options& options)
+{
+    if (sim.getGrid().isMapped()) throw "Autotune::tune needs an in-memory lattice";
+    auto start = std::chrono::steady_clock::now();
+    int replicas = sim.getReplicas();
+    int width = sim.getGrid().width() / replicas;
+    int height = sim.getGrid().height();
+
+    // put back afterwards
+    Lattice saved(sim.getGrid().width(), height);
+    saved.copyFrom(sim.getGrid());
+    uint64_t time = sim.getTime();
+    Config original;
+    original.numThreads = sim.getNumThreads();
+    original.tileWidth = sim.getTileWidth();
+    original.tileHeight = sim.getTileHeight();
+    original.mode = sim.getCollisionMode();
+    original.fieldTileWidth = sim.getFieldTileWidth();
+    original.fieldTileHeight = sim.getFieldTileHeight();
+
+    auto timeSteps = [&](const Config& config)
+    {
+        apply(sim, config);
+        sim.advance(1);
+        auto t = std::chrono::steady_clock::now();
+        sim.advance(options.steps);
+        return options.steps / secondsSince(t);
+    };
+    auto timeField = [&](const Config& config)
+    {
+        apply(sim, config);
+        double best = 1e30;
+        for (int repeat = 0; repeat < 3; repeat++)
+        {
+            auto t = std::chrono::steady_clock::now();
+            sim.getField(options.fieldCellSize, options.fieldCellSize, Field::Velocity | Field::Density);
+            best = std::min(best, secondsSince(t));
+        }
+        return best;
+    };
+
+    // the tiles as the grid cuts them, like the candidates
+    Config best = original;
+    best.tileWidth = std::min(best.tileWidth, width);
+    best.tileHeight = std::min(best.tileHeight, height);
+    best.stepsPerSecond = timeSteps(best);
+    auto tryStep = [&](Config candidate)
+    {
+        if (secondsSince(start) > options.maxSeconds) return;
+        candidate.stepsPerSecond = timeSteps(candidate);
+        if (candidate.stepsPerSecond > best.stepsPerSecond) best = candidate;
+    };
+
+    int maxThreads = options.maxThreads > 0 ? options.maxThreads : int(std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<int> threads;
+    for (int n = 1; n < maxThreads; n *= 2) threads.push_back(n);
+    threads.push_back(maxThreads);
+    for (int n : threads)
+    {
+        Config candidate = best;
+        candidate.numThreads = n;
+        if (n != original.numThreads) tryStep(candidate);
+    }
+
+    // wide tiles stream along the rows, tall ones give more bands to run ahead with fewer threads
+    for (auto tile : clampedTiles({{1024, 16}, {256, 16}, {4096, 16}, {1024, 4}, {1024, 64}, {4096, 4}, {256, 64}, {width, 8}}, width, height))
+    {
+        Config candidate = best;
+        candidate.tileWidth = tile.first;
+        candidate.tileHeight = tile.second;
+        if (tile.first != best.tileWidth || tile.second != best.tileHeight) tryStep(candidate);
+    }
+
+    for (Simulation::CollisionMode mode : options.modes)
+    {
+        Config candidate = best;
+        candidate.mode = mode;
+        if (mode != best.mode) tryStep(candidate);
+    }
+
+    // field tiles only change the reductions, so the steps don't have to be timed again
+    best.fieldSeconds = timeField(best);
+    for (auto tile : clampedTiles({{0, 0}, {256, 64}, {1024, 16}, {4096, 8}, {width, 4}}, width, height))
+    {
+        if (secondsSince(start) > options.maxSeconds) break;
+        Config candidate = best;
+        candidate.fieldTileWidth = tile.first;
+        candidate.fieldTileHeight = tile.second;
+        if (tile.first == best.fieldTileWidth && tile.second == best.fieldTileHeight) continue;
+        candidate.fieldSeconds = timeField(candidate);
+        if (candidate.fieldSeconds < best.fieldSeconds) best = candidate;
+    }
+
+    apply(sim, original);
+    sim.getGrid().copyFrom(saved);
+    sim.setTime(time);
+    sim.clearObstacleForces();
+    return best;
+}
+
+void Autotune::apply(Simulation& sim, const Config& config)
+{
+    sim.setNumThreads(config.numThreads);
+    if (config.tileWidth != sim.getTileWidth() || config.tileHeight != sim.getTileHeight()) sim.setTileSize(config.tileWidth, config.tileHeight);
+    sim.setCollisionMode(config.mode);
+    sim.setFieldTileSize(config.fieldTileWidth, config.fieldTileHeight);
+}
+
+Autotune::Config Autotune::tuned(Simulation& sim, const std::string& profilePath, const Options& options)
+{
+    std::string path = profilePath.empty() ? defaultProfilePath() : profilePath;
+    std::string host = hostKey();
+    int replicas = sim.getReplicas();
+    int width = sim.getGrid().width() / replicas;
+    int height = sim.getGrid().height();
+
+    Config config;
+    if (!load(path, host, width, height, replicas, config))
+    {
+        config = tune(sim, options);
+        save(path, host, width, height, replicas, config);
+    }
+    // the profile may come from a run that tuned the kernel
+    if (options.modes.empty()) config.mode = sim.getCollisionMode();
+    apply(sim, config);
+    return config;
+}
+
+Autotune::Config Autotune::tuned(Simulation& sim, const std::string& profilePath)
+{
+    return tuned(sim, profilePath, Options());
+}
+
+std::string Autotune::hostKey()
+{
+    char name[256] = {};
+    if (gethostname(name, sizeof(name) - 1) != 0 || !name[0]) std::snprintf(name, sizeof(name), "unknown");
+    // the profile is split on whitespace
+    std::string host = name;
+    std::replace_if(host.begin(), host.end(), [](char c) { return c == ' ' || c == '\t'; }, '_');
+    return host + "/" + std::to_string(std::thread::hardware_concurrency());
+}
+
+std::string Autotune::defaultProfilePath()
+{
+    const char* home = std::getenv("HOME");
+    return home && home[0] ? std::string(home) + "/.fhph_autotune" : "fhph_autotune";
+}
+
+/* one line per key:
+host width height replicas numThreads tileWidth tileHeight mode fieldTileWidth fieldTileHeight stepsPerSecond fieldSeconds
+mode is the number of the CollisionMode, lines starting with # are comments */
+bool Autotune::load(const std::string& profilePath, const std::string& host, int width, int height, int replicas, Config& config)
+{
+    std::ifstream f(profilePath, std::ios::in);
+    std::string line;
+    while (std::getline(f, line))
+    {
+        if (line.empty() || line[0] == '#') continue;
+        std::istringstream in(line);
+        std::string lineHost;
+        int w, h, r, mode;
+        Config c;
+        if (!(in >> lineHost >> w >> h >> r >> c.numThreads >> c.tileWidth >> c.tileHeight >> mode >> c.fieldTileWidth >> c.fieldTileHeight >> c.stepsPerSecond >> c.fieldSeconds)) continue;
+        if (lineHost != host || w != width || h != height || r != replicas) continue;
+        if (c.numThreads < 1 || c.tileWidth < 1 || c.tileHeight < 1 || mode < 0 || mode > int(Simulation::CollisionMode::RandomPlane)) continue;
+        c.mode = Simulation::CollisionMode(mode);
+        config = c;
+        return true;
+    }
+    return false;
+}
+
+void Autotune::save(const std::string& profilePath, const std::string& host, int width, int height, int replicas, const Config& config)
+{
+    std::vector<std::string> lines;
+    {
+        std::ifstream f(profilePath, std::ios::in);
+        std::string line;
+        while (std::getline(f, line))
+        {
+            std::istringstream in(line);
+            std::string lineHost;
+            int w, h, r;
+            if (!line.empty() && line[0] != '#' && in >> lineHost >> w >> h >> r && lineHost == host && w == width && h == height && r == replicas) continue;
+            lines.push_back(line);
+        }
+    }
+    if (lines.empty()) lines.push_back("# host width height replicas threads tileWidth tileHeight mode fieldTileWidth fieldTileHeight stepsPerSecond fieldSeconds");
+    std::ostringstream entry;
+    entry << host << " " << width << " " << height << " " << replicas << " " << config.numThreads << " " << config.tileWidth << " " << config.tileHeight
+          << " " << int(config.mode) << " " << config.fieldTileWidth << " " << config.fieldTileHeight << " " << config.stepsPerSecond << " " << config.fieldSeconds;
+    lines.push_back(entry.str());
+
+    // runs on other machines may share a home directory, a reader never sees half a profile
+    std::string temporary = profilePath + "." + std::to_string(getpid());
+    {
+        std::ofstream f(temporary, std::ios::out | std::ios::trunc);
+        if (!f) throw "Autotune::save can't write profile";
+        for (const std::string& line : lines) f << line << "\n";
+        if (!f) throw "Autotune::save can't write profile";
+    }
+    if (std::rename(temporary.c_str(), profilePath.c_str()) != 0)
+    {
+        std::remove(temporary.c_str());
+        throw "Autotune::save can't replace profile";
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+#include <string>
+#include <vector>
+#include "simulation.h"
+
+/* picks thread count, step tile size, collision kernel and field tile size for one machine and grid by timing them
+on the real lattice, one setting after the other (threads, then tiles, then kernel, then field tiles), each at the best so far
+the lattice, its time and tile settings are put back afterwards, the obstacle forces of the timed steps are cleared
+winners are kept in a text profile, one line per (host, width, height, replicas), so later runs only read them */
+class Autotune
+{
+public:
+    struct Config
+    {
+        int numThreads = 1;
+        int tileWidth = 1024;
+        int tileHeight = 16;
+        Simulation::CollisionMode mode = Simulation::CollisionMode::Random;
+        int fieldTileWidth = 0;
+        int fieldTileHeight = 0;
+        // of the winner, when it was tuned
+        double stepsPerSecond = 0;
+        double fieldSeconds = 0;
+    };
+
+    struct Options
+    {
+        // up to this many threads, 0 is all hardware threads
+        int maxThreads = 0;
+        /* kernels to choose from, they differ in how chirality is drawn, see Simulation::CollisionMode
+        empty keeps the simulation's mode, a choice on speed alone may change results from machine to machine */
+        std::vector<Simulation::CollisionMode> modes;
+        // steps per timing of a candidate, after one untimed step
+        int steps = 10;
+        // cell size of the timed getField calls
+        int fieldCellSize = 4;
+        // no further candidates once tuning took this long, the best so far wins
+        double maxSeconds = 30;
+    };
+
+    // times the candidates on sim, in-memory lattices only
+    static Config tune(Simulation& sim, const Options& options);
+
+    static void apply(Simulation& sim, const Config& config);
+
+    /* the config of profilePath for this host and sim's grid, tuned and added to the profile if it has none, applied to sim
+    an empty profilePath is defaultProfilePath(), without options.modes the profile's kernel is ignored */
+    static Config tuned(Simulation& sim, const std::string& profilePath, const Options& options);
+    static Config tuned(Simulation& sim, const std::string& profilePath = "");
+
+    // host name and hardware threads, a machine with more cores enabled is another host
+    static std::string hostKey();
+    // $HOME/.fhph_autotune, or fhph_autotune in the working directory without HOME
+    static std::string defaultProfilePath();
+
+    // returns false if the profile has no line for the key
+    static bool load(const std::string& profilePath, const std::string& host, int width, int height, int replicas, Config& config);
+    // adds or replaces the line of the key, the profile is rewritten through a temporary file
+    static void save(const std::string& profilePath, const std::string& host, int width, int height, int replicas, const Config& config);
+};
+
+#endif // AUTOTUNE_H
@@ -0,0 +1,154 @@
+#ifndef BOUNDARIES_H
+#define BOUNDARIES_H
+#include <algorithm>
+#include <cstdint>
+
+/*
+boundary policies for the streaming kernel
+
+a site pulls bit k from the neighbour the particle is coming from, when that neighbour
+is outside of the domain the policy decides what arrives:
+OpenBoundary - nothing, particles leaving the domain are lost (original behaviour)
+PeriodicBoundary - the neighbour on the other side of the domain
+BounceBackBoundary - the particle that left this site towards the outside, reversed
+
+bit layout (see Simulation::getRegionVelocity):
+0: up-left, 1: up-right, 2: right, 3: down-right, 4: down-left, 5: left, 6: rest, 7: wall
+*/
+
+struct OpenBoundary
+{
+    static inline uint8_t outside(const uint8_t* /*row*/, int /*x*/, int /*width*/, int /*lanes*/, uint8_t /*own*/, int /*dir*/)
+    {
+        return 0;
+    }
+
+    // row used as the neighbour above row 0 / below the last row
+    static inline const uint8_t* ghostRow(const uint8_t* /*oppositeRow*/, const uint8_t* zeroRow)
+    {
+        return zeroRow;
+    }
+
+    static inline void fixTopRow(uint8_t* /*out*/, const uint8_t* /*row*/, int /*width*/) {}
+    static inline void fixBottomRow(uint8_t* /*out*/, const uint8_t* /*row*/, int /*width*/) {}
+};
+
+struct PeriodicBoundary
+{
+    static inline uint8_t outside(const uint8_t* row, int x, int width, int lanes, uint8_t /*own*/, int dir)
+    {
+        return row[((x + width) % width) * lanes] & (1 << dir);
+    }
+
+    // needs even grid height so the row parity stays consistent across the seam
+    static inline const uint8_t* ghostRow(const uint8_t* oppositeRow, const uint8_t* /*zeroRow*/)
+    {
+        return oppositeRow;
+    }
+
+    static inline void fixTopRow(uint8_t* /*out*/, const uint8_t* /*row*/, int /*width*/) {}
+    static inline void fixBottomRow(uint8_t* /*out*/, const uint8_t* /*row*/, int /*width*/) {}
+};
+
+struct BounceBackBoundary
+{
+    static inline uint8_t outside(const uint8_t* /*row*/, int /*x*/, int /*width*/, int /*lanes*/, uint8_t own, int dir)
+    {
+        return ((own >> ((dir + 3) % 6)) & 1) << dir;
+    }
+
+    static inline const uint8_t* ghostRow(const uint8_t* /*oppositeRow*/, const uint8_t* zeroRow)
+    {
+        return zeroRow;
+    }
+
+    // up-left/up-right come back as down-right/down-left
+    static inline void fixTopRow(uint8_t* out, const uint8_t* row, int width)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            out[x] |= (row[x] & 0b00000011) << 3;
+        }
+    }
+
+    static inline void fixBottomRow(uint8_t* out, const uint8_t* row, int width)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            out[x] |= (row[x] >> 3) & 0b00000011;
+        }
+    }
+};
+
+// returns bit dir of site x, or what the policy lets in if x is outside of the row
+template<class XBoundary>
+inline uint8_t pullBit(const uint8_t* r, int x, int width, int lane, int lanes, uint8_t own, int dir)
+{
+    if (x < 0 || x >= width) return XBoundary::outside(r + lane, x, width, lanes, own, dir);
+    return r[x * lanes + lane] & (1 << dir);
+}
+
+// streams a single site near the left/right edge, slower but handles every neighbour
+template<class XBoundary>
+inline uint8_t streamEdgeSite(const uint8_t* up, const uint8_t* row, const uint8_t* down, int width, int lanes, bool evenRow, int x, int lane)
+{
+    uint8_t own = row[x * lanes + lane];
+    uint8_t value = own & 0b11000000;
+    value |= pullBit<XBoundary>(row, x - 1, width, lane, lanes, own, 2);
+    value |= pullBit<XBoundary>(row, x + 1, width, lane, lanes, own, 5);
+    if (evenRow)
+    {
+        value |= pullBit<XBoundary>(down, x + 1, width, lane, lanes, own, 0);
+        value |= pullBit<XBoundary>(down, x, width, lane, lanes, own, 1);
+        value |= pullBit<XBoundary>(up, x, width, lane, lanes, own, 3);
+        value |= pullBit<XBoundary>(up, x + 1, width, lane, lanes, own, 4);
+    }
+    else
+    {
+        value |= pullBit<XBoundary>(down, x, width, lane, lanes, own, 0);
+        value |= pullBit<XBoundary>(down, x - 1, width, lane, lanes, own, 1);
+        value |= pullBit<XBoundary>(up, x - 1, width, lane, lanes, own, 3);
+        value |= pullBit<XBoundary>(up, x, width, lane, lanes, own, 4);
+    }
+    return value;
+}
+
+/* streams sites [from...to) of one row into out, up/down are the rows above and below (ghost rows on the edges)
+rows hold lanes interleaved independent lattices, site x of lane l is at x * lanes + l,
+so a neighbour is always lanes bytes away and the inner loops don't care about lanes at all
+the inner loops have no bounds checks, only the first and last site of the row go through the policy */
+template<class XBoundary>
+inline void streamRow(const uint8_t* up, const uint8_t* row, const uint8_t* down, uint8_t* out, int width, bool evenRow, int lanes = 1, int from = 0, int to = -1)
+{
+    if (to < 0) to = width;
+    const int l = lanes;
+    const int begin = std::max(from, 1) * lanes;
+    const int end = std::min(to, width - 1) * lanes;
+    if (evenRow)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            out[i] = (row[i] & 0b11000000)
+                    | (row[i - l] & 0b00000100) | (row[i + l] & 0b00100000)
+                    | (down[i + l] & 0b00000001) | (down[i] & 0b00000010)
+                    | (up[i] & 0b00001000) | (up[i + l] & 0b00010000);
+        }
+    }
+    else
+    {
+        for (int i = begin; i < end; i++)
+        {
+            out[i] = (row[i] & 0b11000000)
+                    | (row[i - l] & 0b00000100) | (row[i + l] & 0b00100000)
+                    | (down[i] & 0b00000001) | (down[i - l] & 0b00000010)
+                    | (up[i - l] & 0b00001000) | (up[i] & 0b00010000);
+        }
+    }
+    for (int lane = 0; lane < lanes; lane++)
+    {
+        if (from == 0) out[lane] = streamEdgeSite<XBoundary>(up, row, down, width, lanes, evenRow, 0, lane);
+        if (to == width && width > 1) out[(width - 1) * lanes + lane] = streamEdgeSite<XBoundary>(up, row, down, width, lanes, evenRow, width - 1, lane);
+    }
+}
+
+#endif // BOUNDARIES_H
@@ -14,13 +14,32 @@ DEFINES += QT_DEPRECATED_WARNINGS
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 SOURCES += \
+        autotune.cpp \
+        field.cpp \
+        fieldpyramid.cpp \
+        framering.cpp \
+        geometry.cpp \
+        lattice.cpp \
         main.cpp \
+        probes.cpp \
         provider.cpp \
+        recorder.cpp \
         simrunner.cpp \
-        simulation.cpp
+        simulation.cpp \
+        sweep.cpp \
+        taskgraph.cpp \
+        tilescheduler.cpp \
+        verifier.cpp \
+        warmstart.cpp
 
 RESOURCES += qml.qrc
 
+# shm_open/shm_unlink for the frame ring
+unix:!macx: LIBS += -lrt
+
+# deflate for lattice recordings
+LIBS += -lz
+
 # Additional import path used to resolve QML modules in Qt Creator's code model
 QML_IMPORT_PATH =
 
@@ -33,6 +52,20 @@ else: unix:!android: target.path = /opt/$${TARGET}/bin
 !isEmpty(target.path): INSTALLS += target
 
 HEADERS += \
+    autotune.h \
+    boundaries.h \
+    field.h \
+    fieldpyramid.h \
+    framering.h \
+    geometry.h \
+    lattice.h \
+    probes.h \
     provider.h \
+    recorder.h \
     simrunner.h \
-    simulation.h
+    simulation.h \
+    sweep.h \
+    taskgraph.h \
+    tilescheduler.h \
+    verifier.h \
+    warmstart.h
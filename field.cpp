@@ -0,0 +1,124 @@
+#include "field.h"
+#include <algorithm>
+#include <cmath>
+
+Field::Field(int width, int height, int channels) :
+    m_width(width),
+    m_height(height),
+    m_channels(channels)
+{
+    if (width < 0 || height < 0) throw "Field::Field negative size";
+    size_t n = size();
+    if (channels & Velocity)
+    {
+        m_vx.assign(n, 0.f);
+        m_vy.assign(n, 0.f);
+    }
+    if (channels & Density) m_density.assign(n, 0.f);
+    if (channels & Magnitude) m_magnitude.assign(n, 0.f);
+    if (channels & Vorticity) m_vorticity.assign(n, 0.f);
+    if (channels & Sums)
+    {
+        m_sumVx.assign(n, 0);
+        m_sumVy.assign(n, 0);
+        m_count.assign(n, 0);
+    }
+}
+
+Field Field::select(int channels) const
+{
+    if ((channels & m_channels) != channels) throw "Field::select channel not in field";
+    Field result;
+    result.m_width = m_width;
+    result.m_height = m_height;
+    result.m_channels = channels;
+    if (channels & Velocity)
+    {
+        result.m_vx = m_vx;
+        result.m_vy = m_vy;
+    }
+    if (channels & Density) result.m_density = m_density;
+    if (channels & Magnitude) result.m_magnitude = m_magnitude;
+    if (channels & Vorticity) result.m_vorticity = m_vorticity;
+    if (channels & Sums)
+    {
+        result.m_sumVx = m_sumVx;
+        result.m_sumVy = m_sumVy;
+        result.m_count = m_count;
+    }
+    return result;
+}
+
+void Field::computeMagnitude()
+{
+    if (!has(Velocity)) throw "Field::computeMagnitude no velocity";
+    size_t n = size();
+    if (!has(Magnitude))
+    {
+        m_magnitude.assign(n, 0.f);
+        m_channels |= Magnitude;
+    }
+    const float* vx = m_vx.data();
+    const float* vy = m_vy.data();
+    float* magnitude = m_magnitude.data();
+    for (size_t i = 0; i < n; i++)
+    {
+        magnitude[i] = std::sqrt(vx[i] * vx[i] + vy[i] * vy[i]);
+    }
+}
+
+void Field::computeVorticity(const float* mx, const float* my, int cellWidth, int cellHeight)
+{
+    if (!has(Vorticity))
+    {
+        m_vorticity.assign(size(), 0.f);
+        m_channels |= Vorticity;
+    }
+    if (m_width < 2 || m_height < 2) return;
+
+    float dx = float(cellWidth);
+    // y grows against the row index
+    float dy = -float(cellHeight) * 0.8660254f;
+    for (int y = 0; y < m_height; y++)
+    {
+        int up = std::max(y - 1, 0);
+        int down = std::min(y + 1, m_height - 1);
+        const float* mxUp = mx + at(0, up);
+        const float* mxDown = mx + at(0, down);
+        const float* myRow = my + at(0, y);
+        float* w = m_vorticity.data() + at(0, y);
+        float rowDistance = dy * (up - down);
+        w[0] = (myRow[1] - myRow[0]) / dx - (mxUp[0] - mxDown[0]) / rowDistance;
+        // no clamping inside the row, so it vectorises
+        for (int x = 1; x < m_width - 1; x++)
+        {
+            w[x] = (myRow[x + 1] - myRow[x - 1]) / (2 * dx) - (mxUp[x] - mxDown[x]) / rowDistance;
+        }
+        int last = m_width - 1;
+        w[last] = (myRow[last] - myRow[last - 1]) / dx - (mxUp[last] - mxDown[last]) / rowDistance;
+    }
+}
+
+void Field::accumulate(const Field& sample, int sampleCount)
+{
+    if (sample.m_width != m_width || sample.m_height != m_height) throw "Field::accumulate fields differ in size";
+    float keep = float(sampleCount) / float(sampleCount + 1);
+    float add = 1.f / float(sampleCount + 1);
+    size_t n = size();
+
+    auto mean = [&](Plane<float>& plane, const Plane<float>& other)
+    {
+        if (plane.empty() || other.empty()) return;
+        float* p = plane.data();
+        const float* s = other.data();
+        for (size_t i = 0; i < n; i++)
+        {
+            p[i] = p[i] * keep + s[i] * add;
+        }
+    };
+    mean(m_vx, sample.m_vx);
+    mean(m_vy, sample.m_vy);
+    mean(m_density, sample.m_density);
+    mean(m_magnitude, sample.m_magnitude);
+    mean(m_vorticity, sample.m_vorticity);
+}
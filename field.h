@@ -0,0 +1,97 @@
+#ifndef FIELD_H
+#define FIELD_H
+#include <cstddef>
+#include <new>
+#include <vector>
+
+/* coarse width x height field, every quantity is a separate row-major float32 plane (structure of arrays)
+planes are 64 byte aligned and only allocated for the channels the field was made with,
+so loops over a plane vectorise and a density-only field costs 4 bytes a cell
+the optional raw sums are the int32 momentum/particle counts the floats were made from,
+vx in multiples of 1/2, vy in multiples of sqrt(3)/2 */
+class Field
+{
+public:
+    enum Channel
+    {
+        Velocity = 1, // vx and vy
+        Density = 2,
+        Magnitude = 4,
+        Sums = 8, // sumVx, sumVy and count
+        Vorticity = 16
+    };
+
+    template <typename T>
+    struct AlignedAllocator
+    {
+        using value_type = T;
+        AlignedAllocator() = default;
+        template <typename U> AlignedAllocator(const AlignedAllocator<U>&) {}
+        T* allocate(size_t n) { return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(64))); }
+        void deallocate(T* p, size_t) { ::operator delete(p, std::align_val_t(64)); }
+        template <typename U> bool operator==(const AlignedAllocator<U>&) const { return true; }
+        template <typename U> bool operator!=(const AlignedAllocator<U>&) const { return false; }
+    };
+    template <typename T>
+    using Plane = std::vector<T, AlignedAllocator<T>>;
+
+    Field() = default;
+
+    // zero filled, channels is a combination of Channel
+    Field(int width, int height, int channels);
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    int channels() const { return m_channels; }
+    bool has(Channel channel) const { return (m_channels & channel) != 0; }
+    bool empty() const { return m_width == 0 || m_height == 0; }
+    size_t size() const { return size_t(m_width) * m_height; }
+    // index of cell x, y in every plane
+    size_t at(int x, int y) const { return size_t(y) * m_width + x; }
+
+    float* vx() { return m_vx.data(); }
+    float* vy() { return m_vy.data(); }
+    float* density() { return m_density.data(); }
+    float* magnitude() { return m_magnitude.data(); }
+    float* vorticity() { return m_vorticity.data(); }
+    int* sumVx() { return m_sumVx.data(); }
+    int* sumVy() { return m_sumVy.data(); }
+    int* count() { return m_count.data(); }
+    const float* vx() const { return m_vx.data(); }
+    const float* vy() const { return m_vy.data(); }
+    const float* density() const { return m_density.data(); }
+    const float* magnitude() const { return m_magnitude.data(); }
+    const float* vorticity() const { return m_vorticity.data(); }
+    const int* sumVx() const { return m_sumVx.data(); }
+    const int* sumVy() const { return m_sumVy.data(); }
+    const int* count() const { return m_count.data(); }
+
+    // copy of only the given channels, they have to be in this field
+    Field select(int channels) const;
+
+    // magnitude plane from vx/vy, adds the channel if missing
+    void computeMagnitude();
+
+    /* vorticity plane (counter-clockwise positive, y pointing up like vy) from the momentum per site mx/my (planes of this field's size),
+    so every site weighs the same and not every particle, by central differences, one-sided on the edges,
+    cellWidth/cellHeight are the cell size in sites and rows, rows are sqrt(3)/2 apart, adds the channel if missing */
+    void computeVorticity(const float* mx, const float* my, int cellWidth, int cellHeight);
+
+    // running mean, this = (this * sampleCount + sample) / (sampleCount + 1) for the float channels of both fields
+    void accumulate(const Field& sample, int sampleCount);
+
+private:
+    int m_width = 0;
+    int m_height = 0;
+    int m_channels = 0;
+    Plane<float> m_vx;
+    Plane<float> m_vy;
+    Plane<float> m_density;
+    Plane<float> m_magnitude;
+    Plane<float> m_vorticity;
+    Plane<int> m_sumVx;
+    Plane<int> m_sumVy;
+    Plane<int> m_count;
+};
+
+#endif // FIELD_H
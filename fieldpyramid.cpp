@@ -0,0 +1,93 @@
+#include "fieldpyramid.h"
+#include <algorithm>
+#include <cmath>
+
+FieldPyramid::FieldPyramid(Level&& base, int numLevels)
+{
+    m_levels.push_back(std::move(base));
+
+    for (int k = 1; k < numLevels; k++)
+    {
+        const Level& fine = m_levels.back();
+        if (fine.width == 1 && fine.height == 1) break;
+
+        Level coarse;
+        coarse.cellSize = fine.cellSize * 2;
+        coarse.width = (fine.width + 1) / 2;
+        coarse.height = (fine.height + 1) / 2;
+        coarse.vx.assign(coarse.width * coarse.height, 0);
+        coarse.vy.assign(coarse.width * coarse.height, 0);
+        coarse.count.assign(coarse.width * coarse.height, 0);
+        coarse.sites.assign(coarse.width * coarse.height, 0);
+
+        // every fine cell adds to exactly one coarse cell, edges just get fewer contributions
+        for (int y = 0; y < fine.height; y++)
+        {
+            for (int x = 0; x < fine.width; x++)
+            {
+                int from = y * fine.width + x;
+                int to = (y / 2) * coarse.width + x / 2;
+                coarse.vx[to] += fine.vx[from];
+                coarse.vy[to] += fine.vy[from];
+                coarse.count[to] += fine.count[from];
+                coarse.sites[to] += fine.sites[from];
+            }
+        }
+        m_levels.push_back(std::move(coarse));
+    }
+}
+
+int FieldPyramid::getNumLevels() const
+{
+    return int(m_levels.size());
+}
+
+const FieldPyramid::Level& FieldPyramid::getLevel(int index) const
+{
+    return m_levels[index];
+}
+
+int FieldPyramid::levelOf(int cellSize) const
+{
+    for (int i = 0; i < int(m_levels.size()); i++)
+    {
+        if (m_levels[i].cellSize == cellSize) return i;
+    }
+    throw "FieldPyramid::levelOf no level with this cellSize";
+}
+
+Field FieldPyramid::getField(int cellSize, int channels) const
+{
+    const Level& level = m_levels[levelOf(cellSize)];
+    Field field(level.width, level.height, channels);
+    // momentum per site, vorticity is differentiated from it
+    std::vector<float> momentumX(channels & Field::Vorticity ? field.size() : 0);
+    std::vector<float> momentumY(momentumX.size());
+
+    for (size_t i = 0; i < field.size(); i++)
+    {
+        int count = level.count[i];
+        double vx = count != 0 ? (double(level.vx[i]) / 2.) / count : 0;
+        double vy = count != 0 ? (double(level.vy[i]) * 0.8660254) / count : 0;
+        if (field.has(Field::Velocity))
+        {
+            field.vx()[i] = float(vx);
+            field.vy()[i] = float(vy);
+        }
+        if (channels & Field::Density) field.density()[i] = float(double(count) / double(level.sites[i] * 7));
+        if (channels & Field::Magnitude) field.magnitude()[i] = float(std::sqrt(vx * vx + vy * vy));
+        if (channels & Field::Vorticity)
+        {
+            momentumX[i] = float((double(level.vx[i]) / 2.) / level.sites[i]);
+            momentumY[i] = float((double(level.vy[i]) * 0.8660254) / level.sites[i]);
+        }
+    }
+    if (channels & Field::Sums)
+    {
+        std::copy(level.vx.begin(), level.vx.end(), field.sumVx());
+        std::copy(level.vy.begin(), level.vy.end(), field.sumVy());
+        std::copy(level.count.begin(), level.count.end(), field.count());
+    }
+    if (channels & Field::Vorticity) field.computeVorticity(momentumX.data(), momentumY.data(), cellSize, cellSize);
+    return field;
+}
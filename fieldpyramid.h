@@ -0,0 +1,47 @@
+#ifndef FIELDPYRAMID_H
+#define FIELDPYRAMID_H
+#include <utility>
+#include <vector>
+#include "field.h"
+
+/* mip-style pyramid of momentum and particle sums, level k has cells of 2^(k+1) x 2^(k+1) sites
+cells on the right/bottom edge may be cut off by the grid, they remember how many sites they cover
+so density and velocity stay correct for any grid size */
+class FieldPyramid
+{
+public:
+    struct Level
+    {
+        int cellSize = 0;
+        int width = 0;
+        int height = 0;
+        // row-major sums, vx in multiples of 1/2, vy in multiples of sqrt(3)/2
+        std::vector<int> vx;
+        std::vector<int> vy;
+        std::vector<int> count;
+        // sites covered by the cell (times replicas)
+        std::vector<int> sites;
+    };
+
+    FieldPyramid() = default;
+
+    // builds levels 1...numLevels-1 from the already filled level 0
+    explicit FieldPyramid(Level&& base, int numLevels);
+
+    int getNumLevels() const;
+
+    // level with cellSize 2^(index+1)
+    const Level& getLevel(int index) const;
+
+    // level index of cellSize, throws if cellSize is not a power of two in the pyramid
+    int levelOf(int cellSize) const;
+
+    /* level of cellSize as a field, same units as Simulation::getField, density is particles per possible slot [0...1]
+    Field::Sums are the level sums themselves */
+    Field getField(int cellSize, int channels) const;
+
+private:
+    std::vector<Level> m_levels;
+};
+
+#endif // FIELDPYRAMID_H
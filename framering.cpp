@@ -0,0 +1,264 @@
+#include "framering.h"
+#include <atomic>
+#include <cstring>
+#include <new>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+const uint32_t frameRingMagic = 0x46485046; // "FHPF"
+const int frameRingVersion = 1;
+
+std::string shmName(const std::string& name)
+{
+    return name.empty() || name[0] != '/' ? "/" + name : name;
+}
+}
+
+// a cache line each, so the writer's sequence updates don't share a line with the data
+struct alignas(64) FrameRing::Header
+{
+    uint32_t magic;
+    int32_t version;
+    int32_t width;
+    int32_t height;
+    int32_t slots;
+    std::atomic<uint32_t> closed;
+    std::atomic<uint64_t> published;
+};
+
+struct alignas(64) FrameRing::SlotHeader
+{
+    // 2n while frame n is complete, 2n - 1 while it is being written
+    std::atomic<uint64_t> sequence;
+    uint64_t step;
+};
+
+FrameRing FrameRing::create(const std::string& name, int width, int height, int slots)
+{
+    FrameRing ring;
+    ring.m_name = shmName(name);
+    ring.m_writer = true;
+    ring.m_size = sizeof(Header) + size_t(slots) * slotBytes(width, height);
+
+    // a leftover ring of a writer that died is closed and replaced, never resized under its readers
+    int old = shm_open(ring.m_name.c_str(), O_RDWR, 0);
+    if (old >= 0)
+    {
+        struct stat info;
+        void* mapped = fstat(old, &info) == 0 && size_t(info.st_size) >= sizeof(Header) ? mmap(nullptr, sizeof(Header), PROT_READ | PROT_WRITE, MAP_SHARED, old, 0) : MAP_FAILED;
+        if (mapped != MAP_FAILED)
+        {
+            static_cast<Header*>(mapped)->closed.store(1, std::memory_order_release);
+            munmap(mapped, sizeof(Header));
+        }
+        close(old);
+        shm_unlink(ring.m_name.c_str());
+    }
+
+    ring.m_fd = shm_open(ring.m_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (ring.m_fd < 0) throw "FrameRing::create can't open shared memory";
+    if (ftruncate(ring.m_fd, ring.m_size) != 0)
+    {
+        ring.release();
+        throw "FrameRing::create can't resize shared memory";
+    }
+    void* mapped = mmap(nullptr, ring.m_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring.m_fd, 0);
+    if (mapped == MAP_FAILED)
+    {
+        ring.release();
+        throw "FrameRing::create mmap failed";
+    }
+    ring.m_memory = static_cast<uint8_t*>(mapped);
+
+    Header* header = new (ring.m_memory) Header();
+    header->version = frameRingVersion;
+    header->width = width;
+    header->height = height;
+    header->slots = slots;
+    header->closed = 0;
+    header->published = 0;
+    for (int i = 0; i < slots; i++)
+    {
+        new (ring.m_memory + sizeof(Header) + i * slotBytes(width, height)) SlotHeader();
+        ring.slot(i)->sequence = 0;
+    }
+    // readers check the magic last
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = frameRingMagic;
+    return ring;
+}
+
+FrameRing FrameRing::attach(const std::string& name)
+{
+    FrameRing ring;
+    ring.m_name = shmName(name);
+
+    ring.m_fd = shm_open(ring.m_name.c_str(), O_RDONLY, 0);
+    if (ring.m_fd < 0) throw "FrameRing::attach no such ring";
+    struct stat info;
+    if (fstat(ring.m_fd, &info) != 0 || size_t(info.st_size) < sizeof(Header))
+    {
+        ring.release();
+        throw "FrameRing::attach ring not ready";
+    }
+    ring.m_size = size_t(info.st_size);
+    void* mapped = mmap(nullptr, ring.m_size, PROT_READ, MAP_SHARED, ring.m_fd, 0);
+    if (mapped == MAP_FAILED)
+    {
+        ring.release();
+        throw "FrameRing::attach mmap failed";
+    }
+    ring.m_memory = static_cast<uint8_t*>(mapped);
+
+    const Header* header = ring.header();
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (header->magic != frameRingMagic || header->version != frameRingVersion
+        || ring.m_size != sizeof(Header) + size_t(header->slots) * slotBytes(header->width, header->height))
+    {
+        ring.release();
+        throw "FrameRing::attach ring not ready";
+    }
+    return ring;
+}
+
+FrameRing::FrameRing(FrameRing&& other)
+{
+    *this = std::move(other);
+}
+
+FrameRing& FrameRing::operator=(FrameRing&& other)
+{
+    if (this != &other)
+    {
+        release();
+        std::swap(m_memory, other.m_memory);
+        std::swap(m_size, other.m_size);
+        std::swap(m_fd, other.m_fd);
+        std::swap(m_writer, other.m_writer);
+        std::swap(m_name, other.m_name);
+    }
+    return *this;
+}
+
+FrameRing::~FrameRing()
+{
+    release();
+}
+
+bool FrameRing::isValid() const
+{
+    return m_memory != nullptr;
+}
+
+int FrameRing::width() const
+{
+    return header()->width;
+}
+
+int FrameRing::height() const
+{
+    return header()->height;
+}
+
+void FrameRing::publish(uint64_t step, const Field& density, const Field& velMagnitude)
+{
+    Header* h = header();
+    if (density.width() != h->width || density.height() != h->height || velMagnitude.width() != h->width || velMagnitude.height() != h->height) throw "FrameRing::publish field size differs from ring";
+    if (!density.has(Field::Density) || !velMagnitude.has(Field::Magnitude)) throw "FrameRing::publish missing channel";
+
+    uint64_t n = h->published.load(std::memory_order_relaxed) + 1;
+    SlotHeader* s = slot(n);
+    s->sequence.store(2 * n - 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    s->step = step;
+    float* d = reinterpret_cast<float*>(s + 1);
+    size_t fieldSize = density.size();
+    std::memcpy(d, density.density(), fieldSize * sizeof(float));
+    std::memcpy(d + fieldSize, velMagnitude.magnitude(), fieldSize * sizeof(float));
+
+    s->sequence.store(2 * n, std::memory_order_release);
+    h->published.store(n, std::memory_order_release);
+}
+
+uint64_t FrameRing::getPublished() const
+{
+    return header()->published.load(std::memory_order_acquire);
+}
+
+bool FrameRing::isClosed() const
+{
+    return header()->closed.load(std::memory_order_acquire) != 0;
+}
+
+bool FrameRing::readLatest(Frame& frame) const
+{
+    const Header* h = header();
+    size_t fieldSize = size_t(h->width) * h->height;
+    if (frame.field.width() != h->width || frame.field.height() != h->height || !frame.field.has(Field::Density) || !frame.field.has(Field::Magnitude))
+    {
+        frame.field = Field(h->width, h->height, Field::Density | Field::Magnitude);
+    }
+
+    // only fails if the writer laps the whole ring while we copy, a few tries are plenty
+    for (int attempt = 0; attempt < 8; attempt++)
+    {
+        uint64_t n = h->published.load(std::memory_order_acquire);
+        if (n == 0) return false;
+        const SlotHeader* s = slot(n);
+        uint64_t before = s->sequence.load(std::memory_order_acquire);
+        if (before != 2 * n) continue;
+
+        frame.step = s->step;
+        const float* d = reinterpret_cast<const float*>(s + 1);
+        std::memcpy(frame.field.density(), d, fieldSize * sizeof(float));
+        std::memcpy(frame.field.magnitude(), d + fieldSize, fieldSize * sizeof(float));
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (s->sequence.load(std::memory_order_relaxed) != before) continue;
+
+        frame.sequence = n;
+        return true;
+    }
+    return false;
+}
+
+FrameRing::Header* FrameRing::header() const
+{
+    return reinterpret_cast<Header*>(m_memory);
+}
+
+FrameRing::SlotHeader* FrameRing::slot(uint64_t sequence) const
+{
+    const Header* h = header();
+    return reinterpret_cast<SlotHeader*>(m_memory + sizeof(Header) + (sequence % h->slots) * slotBytes(h->width, h->height));
+}
+
+size_t FrameRing::slotBytes(int width, int height)
+{
+    // density and velocity magnitude, rounded up to whole cache lines
+    size_t fields = 2 * sizeof(float) * size_t(width) * height;
+    return sizeof(SlotHeader) + (fields + 63) / 64 * 64;
+}
+
+void FrameRing::release()
+{
+    if (m_memory)
+    {
+        if (m_writer)
+        {
+            header()->closed.store(1, std::memory_order_release);
+            shm_unlink(m_name.c_str());
+        }
+        munmap(m_memory, m_size);
+    }
+    if (m_fd >= 0) close(m_fd);
+    m_memory = nullptr;
+    m_size = 0;
+    m_fd = -1;
+    m_writer = false;
+}
@@ -0,0 +1,70 @@
+#ifndef FRAMERING_H
+#define FRAMERING_H
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "field.h"
+
+/* ring of coarse field frames in POSIX shared memory, one writer (the solver) and any number of readers
+the writer never waits for anybody, every slot has a sequence number that is odd while the slot is being
+written (seqlock), readers copy the newest frame and retry if the writer got into the slot meanwhile,
+so viewers can attach and detach at any time, even before the writer exists or after it is gone */
+class FrameRing
+{
+public:
+    struct Frame
+    {
+        uint64_t sequence = 0;
+        uint64_t step = 0;
+        // Density and Magnitude channels
+        Field field;
+    };
+
+    FrameRing() = default;
+
+    // creates (or takes over) the ring name for frames of width x height, for the writer
+    static FrameRing create(const std::string& name, int width, int height, int slots = 4);
+
+    // maps an existing ring read-only, throws if there is none
+    static FrameRing attach(const std::string& name);
+
+    FrameRing(FrameRing&& other);
+    FrameRing& operator=(FrameRing&& other);
+    FrameRing(const FrameRing&) = delete;
+    FrameRing& operator=(const FrameRing&) = delete;
+    // the writer marks the ring closed and removes the name, readers keep their mapping
+    ~FrameRing();
+
+    bool isValid() const;
+    int width() const;
+    int height() const;
+
+    // copies the density plane of density and the magnitude plane of velMagnitude into the next slot, both have to be width x height
+    void publish(uint64_t step, const Field& density, const Field& velMagnitude);
+
+    // number of frames published so far
+    uint64_t getPublished() const;
+
+    // the writer of this ring went away, a new one may have created the name again
+    bool isClosed() const;
+
+    // copies the newest complete frame, false if there is none yet
+    bool readLatest(Frame& frame) const;
+
+private:
+    struct Header;
+    struct SlotHeader;
+
+    uint8_t* m_memory = nullptr;
+    size_t m_size = 0;
+    int m_fd = -1;
+    bool m_writer = false;
+    std::string m_name;
+
+    Header* header() const;
+    SlotHeader* slot(uint64_t sequence) const;
+    static size_t slotBytes(int width, int height);
+    void release();
+};
+
+#endif // FRAMERING_H
@@ -0,0 +1,282 @@
+#include "geometry.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <fstream>
+#include <random>
+#include "simulation.h"
+#include "tilescheduler.h"
+
+Geometry::Geometry(int width, int height) :
+    m_width(width),
+    m_height(height),
+    m_wordsPerRow((width + 63) / 64)
+{
+    if (width <= 0 || height <= 0) throw "Geometry::Geometry empty grid";
+}
+
+void Geometry::add(Shape shape)
+{
+    if (m_rasterised) throw "Geometry::add shape after rasterise";
+    shape.x0 = std::max(shape.x0, 0);
+    shape.y0 = std::max(shape.y0, 0);
+    shape.x1 = std::min(shape.x1, m_width);
+    shape.y1 = std::min(shape.y1, m_height);
+    // completely outside, a measured shape still takes its label so the labels stay predictable
+    if (shape.x0 >= shape.x1 || shape.y0 >= shape.y1)
+    {
+        shape.x0 = shape.x1 = shape.y0 = shape.y1 = 0;
+    }
+    m_shapes.push_back(shape);
+}
+
+void Geometry::addRect(int x0, int y0, int x1, int y1, bool measured)
+{
+    Shape shape{ShapeType::Rect, x0, y0, x1, y1};
+    shape.measured = measured;
+    add(shape);
+}
+
+void Geometry::addCircle(double cx, double cy, double r, bool measured)
+{
+    Shape shape{ShapeType::Circle, int(std::floor(cx - r)), int(std::floor(cy - r)), int(std::ceil(cx + r)) + 1, int(std::ceil(cy + r)) + 1};
+    shape.cx = cx;
+    shape.cy = cy;
+    shape.r = r;
+    shape.measured = measured;
+    add(shape);
+}
+
+void Geometry::addMask(const std::string& path, int x, int y, int scale, bool measured)
+{
+    if (scale < 1) throw "Geometry::addMask scale < 1";
+    m_bitmaps.push_back(loadPbm(path));
+    const Bitmap& bitmap = m_bitmaps.back();
+    Shape shape{ShapeType::Mask, x, y, x + bitmap.width * scale, y + bitmap.height * scale};
+    // origin of the mask, the bounding box may be clipped
+    shape.cx = x;
+    shape.cy = y;
+    shape.mask = int(m_bitmaps.size()) - 1;
+    shape.scale = scale;
+    shape.measured = measured;
+    add(shape);
+}
+
+void Geometry::addPorous(int count, int size, uint32_t seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<> xDist(0, std::max(0, m_width - size));
+    std::uniform_int_distribution<> yDist(0, std::max(0, m_height - size));
+    for (int i = 0; i < count; i++)
+    {
+        int x = xDist(rng);
+        int y = yDist(rng);
+        addRect(x, y, x + size, y + size);
+    }
+}
+
+void Geometry::addChannelWalls()
+{
+    addRect(0, 0, m_width, 1);
+    addRect(0, m_height - 1, m_width, m_height);
+}
+
+bool Geometry::inside(const Shape& shape, int x, int y) const
+{
+    if (x < shape.x0 || x >= shape.x1 || y < shape.y0 || y >= shape.y1) return false;
+    switch (shape.type)
+    {
+    case ShapeType::Rect:
+        return true;
+    case ShapeType::Circle:
+        return (x - shape.cx) * (x - shape.cx) + (y - shape.cy) * (y - shape.cy) < shape.r * shape.r;
+    case ShapeType::Mask:
+    {
+        const Bitmap& bitmap = m_bitmaps[shape.mask];
+        int px = (x - int(shape.cx)) / shape.scale;
+        int py = (y - int(shape.cy)) / shape.scale;
+        return bitmap.pixels[size_t(py) * bitmap.width + px] != 0;
+    }
+    }
+    return false;
+}
+
+void Geometry::rasterise(int numThreads)
+{
+    if (m_width == 0) throw "Geometry::rasterise empty geometry";
+    m_mask.assign(size_t(m_wordsPerRow) * m_height, 0);
+    m_rowFluid.assign(m_height, 0);
+
+    // shapes by the buckets of rows their bounding box crosses
+    std::vector<std::vector<int>> buckets((m_height + bucketRows - 1) / bucketRows);
+    for (int i = 0; i < int(m_shapes.size()); i++)
+    {
+        const Shape& shape = m_shapes[i];
+        if (shape.y0 >= shape.y1) continue;
+        for (int b = shape.y0 / bucketRows; b <= (shape.y1 - 1) / bucketRows; b++)
+        {
+            buckets[b].push_back(i);
+        }
+    }
+
+    TileScheduler rows(1, m_height, 1, 8);
+    rows.run(numThreads, [&](const TileScheduler::Tile& tile)
+    {
+        for (int y = tile.y0; y < tile.y1; y++)
+        {
+            uint64_t* words = m_mask.data() + size_t(y) * m_wordsPerRow;
+            auto setSpan = [words](int from, int to)
+            {
+                for (int x = from; x < to && x % 64 != 0; x++) words[x / 64] |= 1ULL << (x % 64);
+                int from64 = (from + 63) / 64;
+                int to64 = to / 64;
+                for (int w = from64; w < to64; w++) words[w] = ~0ULL;
+                for (int x = std::max(from, to64 * 64); x < to; x++) words[x / 64] |= 1ULL << (x % 64);
+            };
+
+            for (int i : buckets[y / bucketRows])
+            {
+                const Shape& shape = m_shapes[i];
+                if (y < shape.y0 || y >= shape.y1) continue;
+                if (shape.type == ShapeType::Rect)
+                {
+                    setSpan(shape.x0, shape.x1);
+                    continue;
+                }
+                for (int x = shape.x0; x < shape.x1; x++)
+                {
+                    if (inside(shape, x, y)) words[x / 64] |= 1ULL << (x % 64);
+                }
+            }
+
+            int walls = 0;
+            for (int w = 0; w < m_wordsPerRow; w++)
+            {
+                walls += __builtin_popcountll(words[w]);
+            }
+            m_rowFluid[y] = m_width - walls;
+        }
+    });
+
+    m_rasterised = true;
+}
+
+long long Geometry::fluidSites() const
+{
+    long long sites = 0;
+    for (int fluid : m_rowFluid)
+    {
+        sites += fluid;
+    }
+    return sites;
+}
+
+void Geometry::paint(Lattice& grid, int lanes, int numThreads) const
+{
+    if (!m_rasterised) throw "Geometry::paint not rasterised";
+    if (grid.width() != m_width * lanes || grid.height() != m_height) throw "Geometry::paint grid size differs";
+
+    TileScheduler(1, m_height, 1, 8).run(numThreads, [&](const TileScheduler::Tile& tile)
+    {
+        for (int y = tile.y0; y < tile.y1; y++)
+        {
+            uint8_t* sites = grid[y].data();
+            const uint64_t* words = row(y);
+            for (int w = 0; w < m_wordsPerRow; w++)
+            {
+                uint64_t bits = words[w];
+                while (bits)
+                {
+                    int x = w * 64 + __builtin_ctzll(bits);
+                    std::fill(sites + size_t(x) * lanes, sites + size_t(x + 1) * lanes, uint8_t(0b10000000));
+                    bits &= bits - 1;
+                }
+            }
+        }
+    });
+}
+
+std::vector<int> Geometry::addObstacles(Simulation& sim) const
+{
+    std::vector<int> labels;
+    for (const Shape& shape : m_shapes)
+    {
+        if (!shape.measured) continue;
+        labels.push_back(sim.addObstacle([this, &shape](int x, int y) { return inside(shape, x, y); }));
+    }
+    return labels;
+}
+
+Geometry::Bitmap Geometry::loadPbm(const std::string& path)
+{
+    std::ifstream f(path, std::ios::in | std::ios::binary);
+    if (!f) throw "Geometry::loadPbm can't open file";
+
+    // header tokens, # starts a comment up to the end of the line
+    auto token = [&f]()
+    {
+        std::string t;
+        char c;
+        while (f.get(c))
+        {
+            if (c == '#')
+            {
+                while (f.get(c) && c != '\n') {}
+                if (!t.empty()) break;
+            }
+            else if (std::isspace(static_cast<unsigned char>(c)))
+            {
+                if (!t.empty()) break;
+            }
+            else t += c;
+        }
+        return t;
+    };
+
+    std::string magic = token();
+    if (magic != "P1" && magic != "P4") throw "Geometry::loadPbm not a PBM file";
+    Bitmap bitmap;
+    try
+    {
+        bitmap.width = std::stoi(token());
+        bitmap.height = std::stoi(token());
+    }
+    catch (...)
+    {
+        throw "Geometry::loadPbm bad header";
+    }
+    if (bitmap.width <= 0 || bitmap.height <= 0) throw "Geometry::loadPbm bad header";
+    bitmap.pixels.assign(size_t(bitmap.width) * bitmap.height, 0);
+
+    if (magic == "P4")
+    {
+        // rows of packed bits, most significant first, padded to whole bytes
+        size_t rowBytes = (bitmap.width + 7) / 8;
+        std::vector<uint8_t> packed(rowBytes);
+        for (int y = 0; y < bitmap.height; y++)
+        {
+            if (!f.read(reinterpret_cast<char*>(packed.data()), rowBytes)) throw "Geometry::loadPbm file too short";
+            for (int x = 0; x < bitmap.width; x++)
+            {
+                bitmap.pixels[size_t(y) * bitmap.width + x] = (packed[x / 8] >> (7 - x % 8)) & 1;
+            }
+        }
+    }
+    else
+    {
+        // digits may or may not be separated by whitespace
+        size_t i = 0;
+        char c;
+        while (i < bitmap.pixels.size() && f.get(c))
+        {
+            if (c == '#')
+            {
+                while (f.get(c) && c != '\n') {}
+            }
+            else if (c == '0' || c == '1') bitmap.pixels[i++] = c == '1';
+            else if (!std::isspace(static_cast<unsigned char>(c))) throw "Geometry::loadPbm bad pixel";
+        }
+        if (i < bitmap.pixels.size()) throw "Geometry::loadPbm file too short";
+    }
+    return bitmap;
+}
@@ -0,0 +1,103 @@
+#ifndef GEOMETRY_H
+#define GEOMETRY_H
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "lattice.h"
+
+class Simulation;
+
+/* walls of a scenario, analytic shapes and PBM masks rasterised once into a bit mask (bit x of row y set for walls)
+rows are rasterised in parallel, a row only looks at the shapes whose bounding box it crosses,
+the mask then goes into the lattice as pure wall states, again row-parallel
+fluid sites per row are counted while rasterising */
+class Geometry
+{
+public:
+    Geometry() = default;
+    Geometry(int width, int height);
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+
+    // measured shapes become obstacles with their own drag/lift, in the order they were added
+
+    // [x0...x1) x [y0...y1)
+    void addRect(int x0, int y0, int x1, int y1, bool measured = false);
+
+    // sites with (x - cx)^2 + (y - cy)^2 < r^2
+    void addCircle(double cx, double cy, double r, bool measured = false);
+
+    // black pixels of a PBM (P1 or P4) are walls, pixel (px, py) covers scale x scale sites from (x + px * scale, y + py * scale)
+    void addMask(const std::string& path, int x, int y, int scale = 1, bool measured = false);
+
+    // count size x size squares at random positions, the same seed gives the same medium
+    void addPorous(int count, int size, uint32_t seed);
+
+    // walls along the first and the last row, the channel of plate
+    void addChannelWalls();
+
+    // fills the mask and the fluid counts, has to be called after the last shape
+    void rasterise(int numThreads);
+    bool isRasterised() const { return m_rasterised; }
+
+    bool isWall(int x, int y) const { return (m_mask[size_t(y) * m_wordsPerRow + x / 64] >> (x % 64)) & 1; }
+    // wall bits of row y, 64 sites a word
+    const uint64_t* row(int y) const { return m_mask.data() + size_t(y) * m_wordsPerRow; }
+    long long fluidSites() const;
+
+    /* walls into every lane of grid (site x of lane r at [y][x * lanes + r]), the particles on them are dropped,
+    meant for the initial conditions generator, before the tiles are weighted */
+    void paint(Lattice& grid, int lanes, int numThreads) const;
+
+    // obstacles of the measured shapes, returns their labels
+    std::vector<int> addObstacles(Simulation& sim) const;
+
+private:
+    enum class ShapeType
+    {
+        Rect,
+        Circle,
+        Mask
+    };
+    struct Shape
+    {
+        ShapeType type;
+        // bounding box, clipped to the grid, x1/y1 exclusive
+        int x0;
+        int y0;
+        int x1;
+        int y1;
+        double cx = 0;
+        double cy = 0;
+        double r = 0;
+        int mask = -1;
+        int scale = 1;
+        bool measured = false;
+    };
+    struct Bitmap
+    {
+        int width = 0;
+        int height = 0;
+        // row-major, one byte a pixel, 1 is black
+        std::vector<uint8_t> pixels;
+    };
+
+    int m_width = 0;
+    int m_height = 0;
+    int m_wordsPerRow = 0;
+    std::vector<Shape> m_shapes;
+    std::vector<Bitmap> m_bitmaps;
+    bool m_rasterised = false;
+    std::vector<uint64_t> m_mask;
+    std::vector<int> m_rowFluid;
+
+    // rows a bucket of shapes covers
+    static constexpr int bucketRows = 64;
+
+    void add(Shape shape);
+    bool inside(const Shape& shape, int x, int y) const;
+    static Bitmap loadPbm(const std::string& path);
+};
+
+#endif // GEOMETRY_H
@@ -0,0 +1,143 @@
+#include "lattice.h"
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+void Lattice::Row::assign(int size, uint8_t value)
+{
+    if (size != m_size) throw "Lattice::Row::assign size differs from row width";
+    std::memset(m_data, value, m_size);
+}
+
+Lattice::Lattice(int width, int height) :
+    m_width(width),
+    m_height(height)
+{
+    // 64 byte aligned so rows start on cache lines when width allows it
+    m_memory = static_cast<uint8_t*>(::operator new[](size(), std::align_val_t(64)));
+    std::memset(m_memory, 0, size());
+    m_data = m_memory;
+}
+
+Lattice Lattice::mapFile(const std::string& path, int width, int height, bool unlinkFile)
+{
+    Lattice lattice;
+    lattice.m_width = width;
+    lattice.m_height = height;
+
+    lattice.m_fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (lattice.m_fd < 0) throw "Lattice::mapFile can't open file";
+
+    struct stat info;
+    if (fstat(lattice.m_fd, &info) != 0 || (size_t(info.st_size) != lattice.size() && ftruncate(lattice.m_fd, lattice.size()) != 0))
+    {
+        lattice.release();
+        throw "Lattice::mapFile can't resize file";
+    }
+
+    void* mapped = mmap(nullptr, lattice.size(), PROT_READ | PROT_WRITE, MAP_SHARED, lattice.m_fd, 0);
+    if (mapped == MAP_FAILED)
+    {
+        lattice.release();
+        throw "Lattice::mapFile mmap failed";
+    }
+    lattice.m_data = static_cast<uint8_t*>(mapped);
+    // steps read the rows in order
+    madvise(mapped, lattice.size(), MADV_SEQUENTIAL);
+
+    if (unlinkFile) unlink(path.c_str());
+    return lattice;
+}
+
+Lattice::Lattice(Lattice&& other)
+{
+    swap(other);
+}
+
+Lattice& Lattice::operator=(Lattice&& other)
+{
+    if (this != &other)
+    {
+        release();
+        swap(other);
+    }
+    return *this;
+}
+
+Lattice::~Lattice()
+{
+    release();
+}
+
+void Lattice::swap(Lattice& other)
+{
+    std::swap(m_data, other.m_data);
+    std::swap(m_width, other.m_width);
+    std::swap(m_height, other.m_height);
+    std::swap(m_fd, other.m_fd);
+    std::swap(m_memory, other.m_memory);
+}
+
+void Lattice::copyFrom(const Lattice& other)
+{
+    if (other.size() != size()) throw "Lattice::copyFrom size mismatch";
+    std::memcpy(m_data, other.m_data, size());
+}
+
+void Lattice::willNeed(int fromRow, int toRow) const
+{
+    if (!isMapped() || fromRow >= toRow) return;
+    uint8_t* begin;
+    size_t length;
+    pageRange(fromRow, toRow, begin, length);
+    madvise(begin, length, MADV_WILLNEED);
+}
+
+void Lattice::dontNeed(int fromRow, int toRow) const
+{
+    if (!isMapped() || fromRow >= toRow) return;
+    uint8_t* begin;
+    size_t length;
+    pageRange(fromRow, toRow, begin, length);
+    // shared file mapping, dirty pages go to the page cache, not lost
+    madvise(begin, length, MADV_DONTNEED);
+    posix_fadvise(m_fd, begin - m_data, length, POSIX_FADV_DONTNEED);
+}
+
+void Lattice::flush(int fromRow, int toRow, bool wait) const
+{
+    if (!isMapped() || fromRow >= toRow) return;
+    uint8_t* begin;
+    size_t length;
+    pageRange(fromRow, toRow, begin, length);
+    msync(begin, length, wait ? MS_SYNC : MS_ASYNC);
+}
+
+void Lattice::release()
+{
+    if (m_fd >= 0)
+    {
+        if (m_data) munmap(m_data, size());
+        close(m_fd);
+    }
+    if (m_memory) ::operator delete[](m_memory, std::align_val_t(64));
+    m_data = nullptr;
+    m_memory = nullptr;
+    m_fd = -1;
+    m_width = 0;
+    m_height = 0;
+}
+
+void Lattice::pageRange(int fromRow, int toRow, uint8_t*& begin, size_t& length) const
+{
+    static const size_t pageSize = size_t(sysconf(_SC_PAGESIZE));
+    size_t from = size_t(std::max(fromRow, 0)) * m_width;
+    size_t to = std::min(size_t(std::min(toRow, m_height)) * m_width, size());
+    from -= from % pageSize;
+    begin = m_data + from;
+    length = to > from ? to - from : 0;
+}
@@ -0,0 +1,81 @@
+#ifndef LATTICE_H
+#define LATTICE_H
+#include <cstdint>
+#include <string>
+
+/* contiguous width x height bytes, one byte per site, rows are stored one after another
+backed either by memory or by a memory-mapped file, so lattices larger than RAM can be used,
+the OS pages rows in and out, willNeed/dontNeed let the caller stream over it in bands */
+class Lattice
+{
+public:
+    // view of one row, behaves like the std::vector rows the grid used to be made of
+    class Row
+    {
+    public:
+        Row(uint8_t* data, int size) : m_data(data), m_size(size) {}
+
+        uint8_t& operator[](int x) const { return m_data[x]; }
+        uint8_t* data() const { return m_data; }
+        int size() const { return m_size; }
+        uint8_t* begin() const { return m_data; }
+        uint8_t* end() const { return m_data + m_size; }
+
+        // fills the row, size has to be the row width
+        void assign(int size, uint8_t value);
+
+    private:
+        uint8_t* m_data;
+        int m_size;
+    };
+
+    Lattice() = default;
+
+    // zero filled, in memory
+    Lattice(int width, int height);
+
+    /* maps path as the lattice, the file is created or resized to width * height bytes,
+    an existing file of the right size keeps its contents
+    unlinkFile removes the name right away, for scratch lattices that shouldn't outlive the process */
+    static Lattice mapFile(const std::string& path, int width, int height, bool unlinkFile = false);
+
+    Lattice(Lattice&& other);
+    Lattice& operator=(Lattice&& other);
+    Lattice(const Lattice&) = delete;
+    Lattice& operator=(const Lattice&) = delete;
+    ~Lattice();
+
+    Row operator[](int y) const { return Row(m_data + size_t(y) * m_width, m_width); }
+
+    uint8_t* data() const { return m_data; }
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    size_t size() const { return size_t(m_width) * m_height; }
+    bool isMapped() const { return m_fd >= 0; }
+
+    void swap(Lattice& other);
+
+    // copies contents of other, sizes have to match
+    void copyFrom(const Lattice& other);
+
+    // prefetch/evict hints for rows [fromRow...toRow), no-ops for in-memory lattices
+    void willNeed(int fromRow, int toRow) const;
+    void dontNeed(int fromRow, int toRow) const;
+
+    // starts (wait = false) or finishes writing rows [fromRow...toRow) back to the file
+    void flush(int fromRow, int toRow, bool wait) const;
+
+private:
+    uint8_t* m_data = nullptr;
+    int m_width = 0;
+    int m_height = 0;
+    int m_fd = -1;
+    // owned memory for the in-memory case
+    uint8_t* m_memory = nullptr;
+
+    void release();
+    // page aligned byte range of rows [fromRow...toRow)
+    void pageRange(int fromRow, int toRow, uint8_t*& begin, size_t& length) const;
+};
+
+#endif // LATTICE_H
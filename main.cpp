@@ -1,11 +1,101 @@
 #include <QGuiApplication>
 #include <QQmlApplicationEngine>
 #include <QQmlContext>
+#include <QDebug>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
 #include "simrunner.h"
 #include "provider.h"
+#include "sweep.h"
+#include "verifier.h"
 
+/* fhph                    - solver and GUI in one process
+fhph --publish name      - same, the fields also go to the shared-memory ring name
+fhph --headless name     - solver only, publishing to name, quits when the run is over
+fhph --attach name       - GUI only, shows what a solver publishes to name
+fhph --self-test         - checks the kernels against the reference implementation, exit code 1 on failure
+fhph --sweep prefix h... - plate with blocks of height h... side by side on all threads, results go to prefix<h>_*,
+                           an argument that isn't a number is a scenario file (see Sweep::loadScenario), results go to prefix<file>_* */
 int main(int argc, char *argv[])
 {
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--self-test") != 0) continue;
+        Verifier::Result result = Verifier::runAll();
+        for (const auto& failure : result.failures)
+        {
+            qDebug() << failure.c_str();
+        }
+        qDebug() << result.checks << "checks," << result.failures.size() << "failed";
+        return result.passed ? 0 : 1;
+    }
+
+    for (int i = 1; i + 1 < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--sweep") != 0) continue;
+        Sweep sweep;
+        std::string prefix = argv[i + 1];
+        for (int k = i + 2; k < argc; k++)
+        {
+            Sweep::Scenario scenario;
+            std::string name = argv[k];
+            if (name.find_first_not_of("0123456789") == std::string::npos)
+            {
+                scenario.barrierHeight = std::atoi(argv[k]);
+                scenario.name = "block " + name;
+                scenario.sampleEvery = 5000;
+            }
+            else
+            {
+                try
+                {
+                    scenario = Sweep::loadScenario(name, sweep.getNumThreads());
+                }
+                catch (const char* message)
+                {
+                    qDebug() << name.c_str() << message;
+                    return 1;
+                }
+                name = name.substr(name.rfind('/') + 1);
+                name = name.substr(0, name.find('.'));
+            }
+            scenario.sink = std::make_shared<Sweep::FileSink>(prefix + name + "_");
+            if (scenario.recordTo > 0) scenario.recordPath = prefix + name + "_lattice.rec";
+            sweep.add(scenario);
+        }
+        qDebug() << "sweep on" << sweep.getNumThreads() << "threads";
+        bool failed = false;
+        for (const auto& summary : sweep.run())
+        {
+            qDebug() << summary.steps << "steps" << summary.seconds << "s drag" << summary.meanDrag << "lift" << summary.meanLift << summary.error.c_str();
+            failed = failed || !summary.error.empty();
+        }
+        return failed ? 1 : 0;
+    }
+
+    std::string publishName;
+    std::string attachName;
+    bool headless = false;
+    for (int i = 1; i + 1 < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--publish") == 0) publishName = argv[++i];
+        else if (std::strcmp(argv[i], "--headless") == 0) { publishName = argv[++i]; headless = true; }
+        else if (std::strcmp(argv[i], "--attach") == 0) attachName = argv[++i];
+    }
+
+    QSharedPointer<SimRunner> simRunner(new SimRunner());
+    if (!publishName.empty()) simRunner->publishTo(publishName);
+    if (!attachName.empty()) simRunner->attachTo(attachName);
+
+    if (headless)
+    {
+        QCoreApplication app(argc, argv);
+        QObject::connect(simRunner.get(), &SimRunner::finished, &app, &QCoreApplication::quit, Qt::QueuedConnection);
+        simRunner->start();
+        return app.exec();
+    }
+
     QCoreApplication::setAttribute(Qt::AA_EnableHighDpiScaling);
 
     QGuiApplication app(argc, argv);
@@ -18,7 +108,6 @@ int main(int argc, char *argv[])
             QCoreApplication::exit(-1);
     }, Qt::QueuedConnection);
 
-    QSharedPointer<SimRunner> simRunner(new SimRunner());
     engine.addImageProvider(QLatin1String("images"), new Provider(simRunner));
     engine.rootContext()->setContextProperty("sim", simRunner.get());
 
@@ -15,45 +15,122 @@ Window {
         anchors.left: parent.left
         anchors.right: parent.right
         anchors.top: parent.top
-        anchors.bottom: startButton.top
+        anchors.bottom: controls.top
         source: "image://images/d"
+        // single sites stay sharp when zoomed in
+        smooth: false
         property var counter: 0
-    }
-    Button {
-        id: startButton
-        anchors.bottom: parent.bottom
-        anchors.left: parent.left
-        text: "START"
-        onClicked: {
-            sim.start()
-            refreshTimer.start()
+
+        // visible part of the domain, in fractions of its width and height
+        property real viewX: 0
+        property real viewY: 0
+        property real viewWidth: 1
+        property real viewHeight: 1
+
+        function updateViewport() {
+            viewWidth = Math.min(Math.max(viewWidth, 0.0001), 1)
+            viewHeight = Math.min(Math.max(viewHeight, 0.0001), 1)
+            viewX = Math.min(Math.max(viewX, 0), 1 - viewWidth)
+            viewY = Math.min(Math.max(viewY, 0), 1 - viewHeight)
+            sim.setViewport(viewX, viewY, viewWidth, viewHeight, width * Screen.devicePixelRatio, height * Screen.devicePixelRatio)
         }
-    }
-    CheckBox {
-        id: typeCheckbox
-        anchors.bottom: parent.bottom
-        anchors.horizontalCenter: parent.horizontalCenter
-        onCheckedChanged: {
-            if(checked)
-            {
-                preview.source = "image://images/v" + preview.counter
-                preview.counter += 1
+        onWidthChanged: updateViewport()
+        onHeightChanged: updateViewport()
+        Component.onCompleted: updateViewport()
+
+        // wheel zooms around the cursor, dragging pans, double click shows the whole domain
+        MouseArea {
+            anchors.fill: parent
+            property point last
+            onPressed: last = Qt.point(mouse.x, mouse.y)
+            onPositionChanged: {
+                preview.viewX -= (mouse.x - last.x) / width * preview.viewWidth
+                preview.viewY -= (mouse.y - last.y) / height * preview.viewHeight
+                last = Qt.point(mouse.x, mouse.y)
+                preview.updateViewport()
             }
-            else
-            {
-                preview.source = "image://images/d" + preview.counter
-                preview.counter += 1
+            onWheel: {
+                var factor = wheel.angleDelta.y > 0 ? 0.8 : 1.25
+                var fx = preview.viewX + wheel.x / width * preview.viewWidth
+                var fy = preview.viewY + wheel.y / height * preview.viewHeight
+                preview.viewWidth = Math.min(preview.viewWidth * factor, 1)
+                preview.viewHeight = Math.min(preview.viewHeight * factor, 1)
+                preview.viewX = fx - wheel.x / width * preview.viewWidth
+                preview.viewY = fy - wheel.y / height * preview.viewHeight
+                preview.updateViewport()
+            }
+            onDoubleClicked: {
+                preview.viewX = 0
+                preview.viewY = 0
+                preview.viewWidth = 1
+                preview.viewHeight = 1
+                preview.updateViewport()
             }
         }
     }
-
-    Button {
+    // the session keeps its lattice, pausing and stepping don't start over, only RESET does
+    Row {
+        id: controls
         anchors.bottom: parent.bottom
+        anchors.left: parent.left
         anchors.right: parent.right
-        text: "STOP"
-        onClicked: {
-            sim.stop()
-            refreshTimer.stop()
+        spacing: 4
+
+        Button {
+            text: sim.paused ? "RESUME" : "START"
+            onClicked: {
+                sim.start()
+                refreshTimer.start()
+            }
+        }
+        Button {
+            text: "PAUSE"
+            onClicked: sim.pause()
+        }
+        Button {
+            text: "STEP"
+            onClicked: {
+                sim.step(100)
+                refreshTimer.start()
+            }
+        }
+        Button {
+            text: "RESET"
+            onClicked: {
+                sim.reset()
+                refreshTimer.start()
+            }
+        }
+        Label {
+            anchors.verticalCenter: parent.verticalCenter
+            text: "inflow " + inflowSlider.value.toFixed(2)
+        }
+        // concentration of the left reservoir, the right one stays at 0.2
+        Slider {
+            id: inflowSlider
+            anchors.verticalCenter: parent.verticalCenter
+            width: 120
+            from: 0.2
+            to: 0.9
+            value: 0.4
+            onMoved: sim.setInflow(value, 0.2)
+        }
+        CheckBox {
+            id: typeCheckbox
+            anchors.verticalCenter: parent.verticalCenter
+            text: "velocity"
+            onCheckedChanged: {
+                if(checked)
+                {
+                    preview.source = "image://images/v" + preview.counter
+                    preview.counter += 1
+                }
+                else
+                {
+                    preview.source = "image://images/d" + preview.counter
+                    preview.counter += 1
+                }
+            }
         }
     }
     Timer {
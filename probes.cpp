@@ -0,0 +1,127 @@
+#include "probes.h"
+#include <algorithm>
+#include <cmath>
+#include "simulation.h"
+
+Probes::Probes(double minFrequency, double maxFrequency, int bins, int window) :
+    m_minFrequency(minFrequency),
+    m_maxFrequency(maxFrequency),
+    m_bins(bins),
+    m_window(window)
+{
+    if (bins < 1 || window < 2 || minFrequency < 0 || maxFrequency > 0.5 || maxFrequency < minFrequency) throw "Probes::Probes bad spectrum";
+    const double pi = 3.14159265358979323846;
+    for (int bin = 0; bin < bins; bin++)
+    {
+        m_coefficients.push_back(2 * std::cos(2 * pi * binFrequency(bin)));
+    }
+}
+
+double Probes::binFrequency(int bin) const
+{
+    if (m_bins == 1) return m_minFrequency;
+    return m_minFrequency + (m_maxFrequency - m_minFrequency) * bin / (m_bins - 1);
+}
+
+int Probes::add(int x, int y, int radius)
+{
+    m_probes.push_back({x, y, radius});
+    State state;
+    state.s1.assign(m_coefficients.size(), 0.);
+    state.s2.assign(m_coefficients.size(), 0.);
+    state.spectrum.assign(m_coefficients.size(), 0.);
+    m_states.push_back(state);
+    return int(m_probes.size()) - 1;
+}
+
+int Probes::getNumProbes() const
+{
+    return int(m_probes.size());
+}
+
+const Probes::Probe& Probes::getProbe(int probe) const
+{
+    return m_probes[probe];
+}
+
+void Probes::sample(const Lattice& grid, int lanes, int fromRow, int toRow)
+{
+    int width = grid.width() / lanes;
+    for (int i = 0; i < int(m_probes.size()); i++)
+    {
+        const Probe& probe = m_probes[i];
+        if (probe.y < fromRow || probe.y >= toRow) continue;
+
+        int vy = 0;
+        int count = 0;
+        const uint8_t* row = grid[probe.y].data();
+        for (int x = std::max(0, probe.x - probe.radius); x <= std::min(width - 1, probe.x + probe.radius); x++)
+        {
+            for (int r = 0; r < lanes; r++)
+            {
+                uint8_t value = row[x * lanes + r];
+                vy += Simulation::siteMoments.vy[value];
+                count += Simulation::siteMoments.count[value];
+            }
+        }
+        feed(m_states[i], count != 0 ? (double(vy) * 0.8660254) / count : 0.);
+    }
+}
+
+void Probes::feed(State& state, double value) const
+{
+    double x = value - state.offset;
+    for (size_t bin = 0; bin < m_coefficients.size(); bin++)
+    {
+        double s0 = x + m_coefficients[bin] * state.s1[bin] - state.s2[bin];
+        state.s2[bin] = state.s1[bin];
+        state.s1[bin] = s0;
+    }
+    state.sum += value;
+
+    if (++state.samples < m_window) return;
+    for (size_t bin = 0; bin < m_coefficients.size(); bin++)
+    {
+        double s1 = state.s1[bin];
+        double s2 = state.s2[bin];
+        state.spectrum[bin] += s1 * s1 + s2 * s2 - m_coefficients[bin] * s1 * s2;
+    }
+    std::fill(state.s1.begin(), state.s1.end(), 0.);
+    std::fill(state.s2.begin(), state.s2.end(), 0.);
+    state.offset = state.sum / state.samples;
+    state.sum = 0;
+    state.samples = 0;
+    state.windows++;
+}
+
+Probes::Estimate Probes::getEstimate(int probe) const
+{
+    const State& state = m_states[probe];
+    Estimate estimate;
+    estimate.windows = state.windows;
+    estimate.mean = state.samples > 0 ? state.sum / state.samples : state.offset;
+    if (state.windows == 0) return estimate;
+    auto strongest = std::max_element(state.spectrum.begin(), state.spectrum.end());
+    estimate.frequency = binFrequency(int(strongest - state.spectrum.begin()));
+    estimate.power = *strongest / state.windows;
+    return estimate;
+}
+
+const std::vector<double>& Probes::getSpectrum(int probe) const
+{
+    return m_states[probe].spectrum;
+}
+
+void Probes::reset()
+{
+    for (State& state : m_states)
+    {
+        std::fill(state.spectrum.begin(), state.spectrum.end(), 0.);
+        state.windows = 0;
+        // the window in progress starts over, only the offset of the last full window is kept
+        std::fill(state.s1.begin(), state.s1.end(), 0.);
+        std::fill(state.s2.begin(), state.s2.end(), 0.);
+        state.sum = 0;
+        state.samples = 0;
+    }
+}
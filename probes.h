@@ -0,0 +1,77 @@
+#ifndef PROBES_H
+#define PROBES_H
+#include <cstdint>
+#include <vector>
+#include "lattice.h"
+
+/* vortex shedding frequency at points of the flow, measured while the solver runs
+after every step a probe averages the transverse velocity over sites x-radius...x+radius of its row, in every lane,
+and feeds it to a bank of Goertzel filters, one per candidate frequency,
+each window of samples adds its power spectrum to the probe's, the strongest bin is the dominant frequency
+a probe reads one row only, so it can be sampled from Simulation::advance's bandDone while other bands still step */
+class Probes
+{
+public:
+    struct Probe
+    {
+        int x;
+        int y;
+        int radius;
+    };
+
+    struct Estimate
+    {
+        // cycles per step, 0 before the first full window
+        double frequency = 0;
+        double power = 0;
+        // mean transverse velocity, vy in units of the lattice velocity
+        double mean = 0;
+        uint64_t windows = 0;
+    };
+
+    // bins frequencies spread evenly over [minFrequency...maxFrequency] cycles per step, spectra over window steps
+    Probes(double minFrequency, double maxFrequency, int bins, int window);
+
+    // returns the probe index
+    int add(int x, int y, int radius = 2);
+    int getNumProbes() const;
+    const Probe& getProbe(int probe) const;
+
+    /* samples the probes in rows [fromRow...toRow) of grid, site x of lane r is at [y][x * lanes + r],
+    bands of the same step may call this at the same time, a probe has to see its steps in order */
+    void sample(const Lattice& grid, int lanes, int fromRow, int toRow);
+
+    Estimate getEstimate(int probe) const;
+    // power per bin summed over all windows so far
+    const std::vector<double>& getSpectrum(int probe) const;
+    double binFrequency(int bin) const;
+
+    // forgets the spectra and the window in progress, e.g. once the flow has developed
+    void reset();
+
+private:
+    struct State
+    {
+        // Goertzel state per bin
+        std::vector<double> s1;
+        std::vector<double> s2;
+        std::vector<double> spectrum;
+        // mean of the previous window, taken off the samples so the lowest bins don't pick up the offset
+        double offset = 0;
+        double sum = 0;
+        int samples = 0;
+        uint64_t windows = 0;
+    };
+
+    std::vector<Probe> m_probes;
+    std::vector<State> m_states;
+    std::vector<double> m_coefficients;
+    double m_minFrequency;
+    double m_maxFrequency;
+    int m_bins;
+    int m_window;
+
+    void feed(State& state, double value) const;
+};
+
+#endif // PROBES_H
@@ -1,4 +1,5 @@
 #include "provider.h"
+#include <cmath>
 
 Provider::Provider(QSharedPointer<SimRunner> simRunner) : QQuickImageProvider(QQmlImageProviderBase::Image),
     m_simRunner(simRunner)
@@ -7,14 +8,15 @@ Provider::Provider(QSharedPointer<SimRunner> simRunner) : QQuickImageProvider(QQ
 
 void deleter(void* toDelete)
 {
-    delete toDelete;
+    delete[] static_cast<uchar*>(toDelete);
 }
 
 QImage Provider::requestImage(const QString &id, QSize *size, const QSize &requestedSize)
 {
-    auto simdata = id[0]=="d" ? m_simRunner->density() : m_simRunner->velMagnitude();
+    bool density = id[0]=="d";
+    Field simdata = density ? m_simRunner->density() : m_simRunner->velMagnitude();
 
-    if(simdata.size() == 0)
+    if(simdata.empty())
     {
         if(requestedSize.width() > 0 && requestedSize.height() > 0)
         {
@@ -32,20 +34,22 @@ QImage Provider::requestImage(const QString &id, QSize *size, const QSize &reque
         }
     }
 
-    uchar* data = new uchar[simdata.size()*simdata[0].size()];
-    for(int i = 0; i < simdata.size(); i++)
+    // one flat plane, the loop vectorises
+    const float* values = density ? simdata.density() : simdata.magnitude();
+    float scale = density ? 511.f : 255.f;
+    float clamp = density ? 0.5f : 1.f;
+    uchar* data = new uchar[simdata.size()];
+    for(size_t i = 0; i < simdata.size(); i++)
     {
-        for(int j = 0; j < simdata[i].size(); j++)
-        {
-            data[i*simdata[i].size() + j] = id[0]=="d" ? 511*fmin(simdata[i][j], 0.5) : 255*fmin(simdata[i][j], 1.);
-        }
+        data[i] = uchar(scale * std::fmin(values[i], clamp));
     }
 
-    QImage img(data, simdata[0].size(), simdata.size(), QImage::Format_Grayscale8, deleter, data);
+    // rows are packed, the viewport makes fields of any width, not just multiples of 4
+    QImage img(data, simdata.width(), simdata.height(), simdata.width(), QImage::Format_Grayscale8, deleter, data);
 
-    *size = QSize(simdata[0].size(), simdata.size());
+    *size = QSize(simdata.width(), simdata.height());
 
-    if((requestedSize.width() != simdata[0].size() || requestedSize.height() != simdata.size()) && requestedSize.width() > 0 && requestedSize.height() > 0)
+    if((requestedSize.width() != simdata.width() || requestedSize.height() != simdata.height()) && requestedSize.width() > 0 && requestedSize.height() > 0)
     {
         img = img.scaled(requestedSize.width(), requestedSize.height());
     }
@@ -0,0 +1,618 @@
+/* python module fhph, build with: python3 setup.py build_ext --inplace
+
+import fhph, numpy as np
+sim = fhph.Simulation(4000, 1000, threads=8)
+grid = np.asarray(sim.grid)          # (height, width, replicas) uint8, no copy, writable
+grid[0] = grid[-1] = 0b10000000      # walls
+sim.refresh_tiles()
+sim.spawn(0.2, 0, 4000)
+sim.step(1000)                       # GIL released while stepping
+level = sim.field_pyramid(3).level(1)  # 4x4 cells, raw int32 sums, no copy
+velocity_x = np.asarray(level["vx"]) / 2 / np.maximum(np.asarray(level["count"]), 1)
+
+views share memory with the simulation and keep it alive, the lattice is double buffered but
+steps copy it back into the buffer of the grid views while there are any, so they stay current
+(one copy of the lattice per call after an odd number of steps), obstacle force views have to be released
+before the next step, the series grows while stepping (like resizing a bytearray that has exports) */
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <cstring>
+#include <string>
+#include "simulation.h"
+
+namespace
+{
+struct SimulationObject
+{
+    PyObject_HEAD
+    Simulation* sim;
+    // a step is running with the GIL released
+    bool busy;
+    // buffers over the obstacle force series, which may reallocate while stepping
+    int forceExports;
+    // buffers over the lattice, steps copy it back into the exported buffer while there are any
+    int gridExports;
+};
+
+struct PyramidObject
+{
+    PyObject_HEAD
+    FieldPyramid* pyramid;
+};
+
+// exporter of one array, the memoryviews handed to python are made from it
+struct ViewObject
+{
+    PyObject_HEAD
+    PyObject* owner;
+    void* data;
+    const char* format;
+    Py_ssize_t itemSize;
+    int ndim;
+    Py_ssize_t shape[3];
+    Py_ssize_t strides[3];
+    bool readonly;
+    // the owner's forceExports or gridExports, counted while exported
+    int* exports;
+};
+
+PyTypeObject* simulationType = nullptr;
+PyTypeObject* pyramidType = nullptr;
+PyTypeObject* viewType = nullptr;
+
+// c++ code throws plain strings
+template<class Fn>
+bool guarded(Fn fn)
+{
+    try
+    {
+        fn();
+        return true;
+    }
+    catch (const char* message)
+    {
+        PyErr_SetString(PyExc_RuntimeError, message);
+    }
+    catch (const std::exception& e)
+    {
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+    }
+    return false;
+}
+
+bool checkIdle(SimulationObject* self)
+{
+    if (!self->busy) return true;
+    PyErr_SetString(PyExc_RuntimeError, "simulation is stepping in another thread");
+    return false;
+}
+
+// like guarded, but fn runs without the GIL and with the simulation busy
+template<class Fn>
+bool released(SimulationObject* self, Fn fn)
+{
+    self->busy = true;
+    // the exception can only be raised once the GIL is back
+    bool failed = false;
+    std::string error;
+    Py_BEGIN_ALLOW_THREADS
+    try
+    {
+        fn();
+    }
+    catch (const char* message)
+    {
+        failed = true;
+        error = message;
+    }
+    catch (const std::exception& e)
+    {
+        failed = true;
+        error = e.what();
+    }
+    Py_END_ALLOW_THREADS
+    self->busy = false;
+    if (failed) PyErr_SetString(PyExc_RuntimeError, error.c_str());
+    return !failed;
+}
+
+PyObject* makeView(PyObject* owner, void* data, const char* format, Py_ssize_t itemSize, int ndim, const Py_ssize_t* shape, bool readonly, int* exports = nullptr)
+{
+    ViewObject* view = PyObject_New(ViewObject, viewType);
+    if (!view) return nullptr;
+    Py_INCREF(owner);
+    view->owner = owner;
+    view->data = data;
+    view->format = format;
+    view->itemSize = itemSize;
+    view->ndim = ndim;
+    view->readonly = readonly;
+    view->exports = exports;
+    // C-contiguous strides
+    Py_ssize_t stride = itemSize;
+    for (int i = ndim - 1; i >= 0; i--)
+    {
+        view->shape[i] = shape[i];
+        view->strides[i] = stride;
+        stride *= shape[i];
+    }
+    PyObject* memory = PyMemoryView_FromObject(reinterpret_cast<PyObject*>(view));
+    Py_DECREF(view);
+    return memory;
+}
+
+int viewGetBuffer(PyObject* object, Py_buffer* buffer, int flags)
+{
+    ViewObject* view = reinterpret_cast<ViewObject*>(object);
+    if ((flags & PyBUF_WRITABLE) && view->readonly)
+    {
+        PyErr_SetString(PyExc_BufferError, "view is read-only");
+        return -1;
+    }
+    Py_ssize_t length = view->itemSize;
+    for (int i = 0; i < view->ndim; i++) length *= view->shape[i];
+
+    buffer->buf = view->data;
+    buffer->obj = object;
+    Py_INCREF(object);
+    buffer->len = length;
+    buffer->readonly = view->readonly;
+    buffer->itemsize = view->itemSize;
+    buffer->format = (flags & PyBUF_FORMAT) ? const_cast<char*>(view->format) : nullptr;
+    buffer->ndim = view->ndim;
+    buffer->shape = (flags & PyBUF_ND) ? view->shape : nullptr;
+    buffer->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? view->strides : nullptr;
+    buffer->suboffsets = nullptr;
+    buffer->internal = nullptr;
+
+    if (view->exports) (*view->exports)++;
+    return 0;
+}
+
+void viewReleaseBuffer(PyObject* object, Py_buffer* /*buffer*/)
+{
+    ViewObject* view = reinterpret_cast<ViewObject*>(object);
+    if (view->exports) (*view->exports)--;
+}
+
+void viewDealloc(PyObject* object)
+{
+    ViewObject* view = reinterpret_cast<ViewObject*>(object);
+    PyTypeObject* type = Py_TYPE(object);
+    Py_XDECREF(view->owner);
+    PyObject_Free(object);
+    Py_DECREF(type);
+}
+
+// names used for the enums from python
+template<class Enum>
+bool parseEnum(const char* name, const std::vector<const char*>& names, Enum& value)
+{
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        if (std::strcmp(name, names[i]) != 0) continue;
+        value = Enum(i);
+        return true;
+    }
+    std::string message = std::string("unknown value '") + name + "'";
+    PyErr_SetString(PyExc_ValueError, message.c_str());
+    return false;
+}
+
+const std::vector<const char*> boundaryNames = { "open", "periodic", "bounce-back" };
+const std::vector<const char*> variantNames = { "fhp1", "fhp2", "fhp3" };
+const std::vector<const char*> modeNames = { "random", "alternating", "random-plane" };
+
+// Simulation
+
+int simulationInit(PyObject* object, PyObject* args, PyObject* kwargs)
+{
+    SimulationObject* self = reinterpret_cast<SimulationObject*>(object);
+    static const char* keywords[] = { "width", "height", "threads", "replicas", "backing_file", "seed", nullptr };
+    int width, height, threads = 1, replicas = 1;
+    const char* backingFile = "";
+    PyObject* seedObject = Py_None;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "ii|iisO", const_cast<char**>(keywords), &width, &height, &threads, &replicas, &backingFile, &seedObject)) return -1;
+    if (width <= 0 || height <= 0 || threads <= 0 || replicas <= 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "width, height, threads and replicas have to be positive");
+        return -1;
+    }
+    // None draws one, like the c++ default
+    uint32_t seed = std::random_device()();
+    if (seedObject != Py_None)
+    {
+        unsigned long value = PyLong_AsUnsignedLong(seedObject);
+        if (PyErr_Occurred()) return -1;
+        if (value > 0xFFFFFFFFul)
+        {
+            PyErr_SetString(PyExc_ValueError, "seed has to fit in 32 bits");
+            return -1;
+        }
+        seed = uint32_t(value);
+    }
+
+    // views may point into the current simulation
+    if (self->sim)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "simulation is already initialised");
+        return -1;
+    }
+    // the grid starts empty, python fills it through the grid view, an existing backing file is continued
+    return guarded([&]() { self->sim = new Simulation(width, height, threads, nullptr, replicas, backingFile, seed); }) ? 0 : -1;
+}
+
+void simulationDealloc(PyObject* object)
+{
+    SimulationObject* self = reinterpret_cast<SimulationObject*>(object);
+    PyTypeObject* type = Py_TYPE(object);
+    delete self->sim;
+    type->tp_free(object);
+    Py_DECREF(type);
+}
+
+SimulationObject* checkedSelf(PyObject* object)
+{
+    SimulationObject* self = reinterpret_cast<SimulationObject*>(object);
+    if (!self->sim)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "simulation is not initialised");
+        return nullptr;
+    }
+    return checkIdle(self) ? self : nullptr;
+}
+
+PyObject* simulationStep(PyObject* object, PyObject* args)
+{
+    SimulationObject* self = checkedSelf(object);
+    int steps = 1;
+    if (!self || !PyArg_ParseTuple(args, "|i", &steps)) return nullptr;
+    if (self->forceExports > 0 && self->sim->getNumObstacles() > 0)
+    {
+        PyErr_SetString(PyExc_BufferError, "release the obstacle force views before stepping");
+        return nullptr;
+    }
+
+    bool keep = self->gridExports > 0;
+    if (!released(self, [&]() { self->sim->advance(steps); if (keep) self->sim->restorePrimaryGrid(); })) return nullptr;
+    Py_RETURN_NONE;
+}
+
+PyObject* simulationMoveStep(PyObject* object, PyObject* /*args*/)
+{
+    SimulationObject* self = checkedSelf(object);
+    if (!self) return nullptr;
+    bool keep = self->gridExports > 0;
+    if (!released(self, [&]() { self->sim->moveStep(); if (keep) self->sim->restorePrimaryGrid(); })) return nullptr;
+    Py_RETURN_NONE;
+}
+
+PyObject* simulationCollisionStep(PyObject* object, PyObject* /*args*/)
+{
+    SimulationObject* self = checkedSelf(object);
+    if (!self) return nullptr;
+    if (self->forceExports > 0 && self->sim->getNumObstacles() > 0)
+    {
+        PyErr_SetString(PyExc_BufferError, "release the obstacle force views before stepping");
+        return nullptr;
+    }
+    bool keep = self->gridExports > 0;
+    if (!released(self, [&]() { self->sim->colissionStep(); if (keep) self->sim->restorePrimaryGrid(); })) return nullptr;
+    Py_RETURN_NONE;
+}
+
+PyObject* simulationSpawn(PyObject* object, PyObject* args)
+{
+    SimulationObject* self = checkedSelf(object);
+    float concentration;
+    int at, width;
+    if (!self || !PyArg_ParseTuple(args, "fii", &concentration, &at, &width)) return nullptr;
+    self->sim->spawnAtX(concentration, at, width);
+    Py_RETURN_NONE;
+}
+
+PyObject* simulationRefreshTiles(PyObject* object, PyObject* /*args*/)
+{
+    SimulationObject* self = checkedSelf(object);
+    if (!self) return nullptr;
+    self->sim->refreshTiles();
+    Py_RETURN_NONE;
+}
+
+PyObject* simulationSetBoundaries(PyObject* object, PyObject* args)
+{
+    SimulationObject* self = checkedSelf(object);
+    const char* x;
+    const char* y;
+    Simulation::Boundary bx, by;
+    if (!self || !PyArg_ParseTuple(args, "ss", &x, &y) || !parseEnum(x, boundaryNames, bx) || !parseEnum(y, boundaryNames, by)) return nullptr;
+    if (!guarded([&]() { self->sim->setBoundaries(bx, by); })) return nullptr;
+    Py_RETURN_NONE;
+}
+
+PyObject* simulationSetVariant(PyObject* object, PyObject* args)
+{
+    SimulationObject* self = checkedSelf(object);
+    const char* name;
+    Simulation::Variant variant;
+    if (!self || !PyArg_ParseTuple(args, "s", &name) || !parseEnum(name, variantNames, variant)) return nullptr;
+    self->sim->setVariant(variant);
+    Py_RETURN_NONE;
+}
+
+PyObject* simulationSetCollisionMode(PyObject* object, PyObject* args)
+{
+    SimulationObject* self = checkedSelf(object);
+    const char* name;
+    Simulation::CollisionMode mode;
+    if (!self || !PyArg_ParseTuple(args, "s", &name) || !parseEnum(name, modeNames, mode)) return nullptr;
+    self->sim->setCollisionMode(mode);
+    Py_RETURN_NONE;
+}
+
+PyObject* simulationSetSeed(PyObject* object, PyObject* args)
+{
+    SimulationObject* self = checkedSelf(object);
+    unsigned int seed;
+    if (!self || !PyArg_ParseTuple(args, "I", &seed)) return nullptr;
+    self->sim->setSeed(seed);
+    Py_RETURN_NONE;
+}
+
+PyObject* simulationSetInflow(PyObject* object, PyObject* args)
+{
+    SimulationObject* self = checkedSelf(object);
+    PyObject* list;
+    if (!self || !PyArg_ParseTuple(args, "O", &list)) return nullptr;
+    PyObject* fast = PySequence_Fast(list, "set_inflow expects a list of (concentration, at, width)");
+    if (!fast) return nullptr;
+    std::vector<Simulation::Inflow> inflow;
+    for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(fast); i++)
+    {
+        Simulation::Inflow in;
+        if (!PyArg_ParseTuple(PySequence_Fast_GET_ITEM(fast, i), "fii", &in.concentration, &in.at, &in.width))
+        {
+            Py_DECREF(fast);
+            return nullptr;
+        }
+        inflow.push_back(in);
+    }
+    Py_DECREF(fast);
+    self->sim->setInflow(inflow);
+    Py_RETURN_NONE;
+}
+
+PyObject* simulationSetThreads(PyObject* object, PyObject* args)
+{
+    SimulationObject* self = checkedSelf(object);
+    int threads;
+    if (!self || !PyArg_ParseTuple(args, "i", &threads)) return nullptr;
+    self->sim->setNumThreads(std::max(1, threads));
+    Py_RETURN_NONE;
+}
+
+PyObject* simulationAddObstacle(PyObject* object, PyObject* args)
+{
+    SimulationObject* self = checkedSelf(object);
+    int fromX, toX, fromY, toY;
+    if (!self || !PyArg_ParseTuple(args, "iiii", &fromX, &toX, &fromY, &toY)) return nullptr;
+    int label = 0;
+    if (!guarded([&]() { label = self->sim->addObstacle([=](int x, int y) { return x >= fromX && x < toX && y >= fromY && y < toY; }); })) return nullptr;
+    return PyLong_FromLong(label);
+}
+
+// (steps, 2) float64 view of pair(drag, lift) per step
+PyObject* simulationObstacleForces(PyObject* object, PyObject* args)
+{
+    SimulationObject* self = checkedSelf(object);
+    int label;
+    if (!self || !PyArg_ParseTuple(args, "i", &label)) return nullptr;
+    if (label < 0 || label >= self->sim->getNumObstacles())
+    {
+        PyErr_SetString(PyExc_IndexError, "no obstacle with this label");
+        return nullptr;
+    }
+    const auto& forces = self->sim->getObstacleForces(label);
+    static_assert(sizeof(std::pair<double, double>) == 2 * sizeof(double), "pair of doubles has to be packed");
+    Py_ssize_t shape[2] = { Py_ssize_t(forces.size()), 2 };
+    return makeView(object, const_cast<std::pair<double, double>*>(forces.data()), "d", sizeof(double), 2, shape, true, &self->forceExports);
+}
+
+PyObject* simulationClearObstacleForces(PyObject* object, PyObject* /*args*/)
+{
+    SimulationObject* self = checkedSelf(object);
+    if (!self) return nullptr;
+    if (self->forceExports > 0)
+    {
+        PyErr_SetString(PyExc_BufferError, "release the obstacle force views before clearing");
+        return nullptr;
+    }
+    self->sim->clearObstacleForces();
+    Py_RETURN_NONE;
+}
+
+PyObject* simulationFieldPyramid(PyObject* object, PyObject* args)
+{
+    SimulationObject* self = checkedSelf(object);
+    int levels;
+    if (!self || !PyArg_ParseTuple(args, "i", &levels)) return nullptr;
+    PyramidObject* pyramid = PyObject_New(PyramidObject, pyramidType);
+    if (!pyramid) return nullptr;
+    pyramid->pyramid = nullptr;
+    if (!released(self, [&]() { pyramid->pyramid = new FieldPyramid(self->sim->getFieldPyramid(levels)); }))
+    {
+        Py_DECREF(pyramid);
+        return nullptr;
+    }
+    return reinterpret_cast<PyObject*>(pyramid);
+}
+
+PyObject* simulationGetGrid(PyObject* object, void* /*closure*/)
+{
+    SimulationObject* self = checkedSelf(object);
+    if (!self) return nullptr;
+    // always export the same buffer, steps copy the lattice back into it
+    self->sim->restorePrimaryGrid();
+    Lattice& grid = self->sim->getGrid();
+    int replicas = self->sim->getReplicas();
+    Py_ssize_t shape[3] = { grid.height(), grid.width() / replicas, replicas };
+    return makeView(object, grid.data(), "B", 1, 3, shape, false, &self->gridExports);
+}
+
+PyObject* simulationGetTime(PyObject* object, void* /*closure*/)
+{
+    SimulationObject* self = checkedSelf(object);
+    if (!self) return nullptr;
+    return PyLong_FromUnsignedLongLong(self->sim->getTime());
+}
+
+PyObject* simulationGetReplicas(PyObject* object, void* /*closure*/)
+{
+    SimulationObject* self = checkedSelf(object);
+    if (!self) return nullptr;
+    return PyLong_FromLong(self->sim->getReplicas());
+}
+
+PyMethodDef simulationMethods[] = {
+    { "step", simulationStep, METH_VARARGS, "step(n=1), n fused stream + collision + inflow steps without a barrier in between, the GIL is released meanwhile" },
+    { "move_step", simulationMoveStep, METH_NOARGS, "streaming only" },
+    { "collision_step", simulationCollisionStep, METH_NOARGS, "collisions only" },
+    { "spawn", simulationSpawn, METH_VARARGS, "spawn(concentration, at, width), fills columns [at, at + width) up to concentration" },
+    { "refresh_tiles", simulationRefreshTiles, METH_NOARGS, "recomputes the load balancing and the fluid sites of the inflow columns after walls were changed" },
+    { "set_boundaries", simulationSetBoundaries, METH_VARARGS, "set_boundaries(x, y), each 'open', 'periodic' or 'bounce-back'" },
+    { "set_variant", simulationSetVariant, METH_VARARGS, "set_variant('fhp1' | 'fhp2' | 'fhp3')" },
+    { "set_collision_mode", simulationSetCollisionMode, METH_VARARGS, "set_collision_mode('random' | 'alternating' | 'random-plane')" },
+    { "set_seed", simulationSetSeed, METH_VARARGS, "set_seed(seed)" },
+    { "set_inflow", simulationSetInflow, METH_VARARGS, "set_inflow([(concentration, at, width), ...]), columns refilled after every step" },
+    { "set_threads", simulationSetThreads, METH_VARARGS, "set_threads(n)" },
+    { "add_obstacle", simulationAddObstacle, METH_VARARGS, "add_obstacle(from_x, to_x, from_y, to_y), labels the wall sites in the rectangle, returns the label" },
+    { "obstacle_forces", simulationObstacleForces, METH_VARARGS, "obstacle_forces(label), (steps, 2) view of drag and lift per step" },
+    { "clear_obstacle_forces", simulationClearObstacleForces, METH_NOARGS, "empties the force series" },
+    { "field_pyramid", simulationFieldPyramid, METH_VARARGS, "field_pyramid(levels), momentum and particle sums of cells 2, 4, 8..." },
+    { nullptr, nullptr, 0, nullptr }
+};
+
+PyGetSetDef simulationGetSet[] = {
+    { "grid", simulationGetGrid, nullptr, "(height, width, replicas) uint8 view of the current lattice", nullptr },
+    { "time", simulationGetTime, nullptr, "collision steps done", nullptr },
+    { "replicas", simulationGetReplicas, nullptr, "number of ensemble replicas", nullptr },
+    { nullptr, nullptr, nullptr, nullptr, nullptr }
+};
+
+PyType_Slot simulationSlots[] = {
+    { Py_tp_new, reinterpret_cast<void*>(PyType_GenericNew) },
+    { Py_tp_init, reinterpret_cast<void*>(simulationInit) },
+    { Py_tp_dealloc, reinterpret_cast<void*>(simulationDealloc) },
+    { Py_tp_methods, simulationMethods },
+    { Py_tp_getset, simulationGetSet },
+    { Py_tp_doc, const_cast<char*>("Simulation(width, height, threads=1, replicas=1, backing_file='', seed=None)") },
+    { 0, nullptr }
+};
+
+PyType_Spec simulationSpec = { "fhph.Simulation", sizeof(SimulationObject), 0, Py_TPFLAGS_DEFAULT, simulationSlots };
+
+// pyramids and views only come from a simulation
+#ifdef Py_TPFLAGS_DISALLOW_INSTANTIATION
+const unsigned int internalTypeFlags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION;
+#else
+const unsigned int internalTypeFlags = Py_TPFLAGS_DEFAULT;
+#endif
+
+// FieldPyramid
+
+void pyramidDealloc(PyObject* object)
+{
+    PyTypeObject* type = Py_TYPE(object);
+    delete reinterpret_cast<PyramidObject*>(object)->pyramid;
+    PyObject_Free(object);
+    Py_DECREF(type);
+}
+
+PyObject* pyramidLevel(PyObject* object, PyObject* args)
+{
+    const FieldPyramid* pyramid = reinterpret_cast<PyramidObject*>(object)->pyramid;
+    int index;
+    if (!PyArg_ParseTuple(args, "i", &index)) return nullptr;
+    if (index < 0 || index >= pyramid->getNumLevels())
+    {
+        PyErr_SetString(PyExc_IndexError, "no such level");
+        return nullptr;
+    }
+    const FieldPyramid::Level& level = pyramid->getLevel(index);
+    Py_ssize_t shape[2] = { level.height, level.width };
+    static_assert(sizeof(int) == 4, "sums are exported as int32");
+
+    PyObject* dict = PyDict_New();
+    if (!dict) return nullptr;
+    const std::pair<const char*, const std::vector<int>*> arrays[] = { { "vx", &level.vx }, { "vy", &level.vy }, { "count", &level.count }, { "sites", &level.sites } };
+    for (const auto& array : arrays)
+    {
+        PyObject* view = makeView(object, const_cast<int*>(array.second->data()), "i", sizeof(int), 2, shape, true);
+        if (!view || PyDict_SetItemString(dict, array.first, view) != 0)
+        {
+            Py_XDECREF(view);
+            Py_DECREF(dict);
+            return nullptr;
+        }
+        Py_DECREF(view);
+    }
+    PyObject* cellSize = PyLong_FromLong(level.cellSize);
+    PyDict_SetItemString(dict, "cell_size", cellSize);
+    Py_DECREF(cellSize);
+    return dict;
+}
+
+PyObject* pyramidNumLevels(PyObject* object, void* /*closure*/)
+{
+    return PyLong_FromLong(reinterpret_cast<PyramidObject*>(object)->pyramid->getNumLevels());
+}
+
+PyMethodDef pyramidMethods[] = {
+    { "level", pyramidLevel, METH_VARARGS, "level(i), dict of cell_size and int32 (height, width) views vx, vy (units 1/2, sqrt(3)/2), count, sites" },
+    { nullptr, nullptr, 0, nullptr }
+};
+
+PyGetSetDef pyramidGetSet[] = {
+    { "num_levels", pyramidNumLevels, nullptr, "number of levels", nullptr },
+    { nullptr, nullptr, nullptr, nullptr, nullptr }
+};
+
+PyType_Slot pyramidSlots[] = {
+    { Py_tp_dealloc, reinterpret_cast<void*>(pyramidDealloc) },
+    { Py_tp_methods, pyramidMethods },
+    { Py_tp_getset, pyramidGetSet },
+    { 0, nullptr }
+};
+
+PyType_Spec pyramidSpec = { "fhph.FieldPyramid", sizeof(PyramidObject), 0, internalTypeFlags, pyramidSlots };
+
+PyType_Slot viewSlots[] = {
+    { Py_tp_dealloc, reinterpret_cast<void*>(viewDealloc) },
+    { Py_bf_getbuffer, reinterpret_cast<void*>(viewGetBuffer) },
+    { Py_bf_releasebuffer, reinterpret_cast<void*>(viewReleaseBuffer) },
+    { 0, nullptr }
+};
+
+PyType_Spec viewSpec = { "fhph.View", sizeof(ViewObject), 0, internalTypeFlags, viewSlots };
+
+PyModuleDef moduleDef = { PyModuleDef_HEAD_INIT, "fhph", "FHP lattice gas solver", -1, nullptr, nullptr, nullptr, nullptr, nullptr };
+}
+
+PyMODINIT_FUNC PyInit_fhph()
+{
+    PyObject* module = PyModule_Create(&moduleDef);
+    if (!module) return nullptr;
+
+    simulationType = reinterpret_cast<PyTypeObject*>(PyType_FromSpec(&simulationSpec));
+    pyramidType = reinterpret_cast<PyTypeObject*>(PyType_FromSpec(&pyramidSpec));
+    viewType = reinterpret_cast<PyTypeObject*>(PyType_FromSpec(&viewSpec));
+    if (!simulationType || !pyramidType || !viewType || PyModule_AddObject(module, "Simulation", reinterpret_cast<PyObject*>(simulationType)) != 0)
+    {
+        Py_DECREF(module);
+        return nullptr;
+    }
+    Py_INCREF(simulationType);
+    Py_INCREF(pyramidType);
+    PyModule_AddObject(module, "FieldPyramid", reinterpret_cast<PyObject*>(pyramidType));
+    return module;
+}
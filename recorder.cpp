@@ -0,0 +1,494 @@
+#include "recorder.h"
+#include <algorithm>
+#include <cstring>
+#include <zlib.h>
+#include "tilescheduler.h"
+
+namespace
+{
+const uint32_t recordingMagic = 0x52504846; // "FHPR"
+const int recordingVersion = 1;
+
+enum Kind
+{
+    Keyframe = 0,
+    Predicted = 1, // coded against the previous frame streamed once, see StepPredictor
+    Delta = 2      // XOR with the previous frame
+};
+
+struct FileHeader
+{
+    uint32_t magic;
+    int32_t version;
+    int32_t width;
+    int32_t height;
+    int32_t replicas;
+    int32_t variant;
+    int32_t xBoundary;
+    int32_t yBoundary;
+};
+
+struct FrameHeader
+{
+    uint64_t time;
+    int32_t kind;
+    int32_t reserved;
+    uint64_t bytes;
+};
+}
+
+/* the previous frame streamed one step, the collision of that step is coded per site against it:
+where both chiral tables agree the outcome is known, elsewhere one bit says whether the chirality differs from Alternating mode's,
+what is left over (inflow, particles added between steps) goes into a residual XOR
+payload: a bit for every site (the ambiguous ones use theirs in order, the rest stay 0), then the residual
+streaming and coding run on numThreads threads, coding in bands of rows whose flip bits are put one after the other */
+class StepPredictor
+{
+public:
+    StepPredictor(const FileHeader& header, int numThreads) :
+        m_sim(header.width, header.height, numThreads, [](Simulation*) {}, header.replicas),
+        m_tables(Simulation::variantLUTs[header.variant]),
+        m_width(header.width),
+        m_replicas(header.replicas),
+        m_size(size_t(header.width) * header.replicas * header.height),
+        m_numThreads(numThreads),
+        // a few bands per thread, for the stealing
+        m_bandRows(std::max(1, header.height / (4 * numThreads))),
+        m_bands(1, header.height, 1, m_bandRows)
+    {
+        m_sim.setBoundaries(Simulation::Boundary(header.xBoundary), Simulation::Boundary(header.yBoundary));
+        m_bandFlips.resize(m_bands.getTiles().size());
+        m_bandBits.resize(m_bands.getTiles().size());
+    }
+
+    // payload for sites, one step after previous at time
+    void encode(const uint8_t* previous, const uint8_t* sites, uint64_t time, std::vector<uint8_t>& payload)
+    {
+        const Lattice& streamed = stream(previous);
+        // the residual is written whole, only the flip bits are ORed in
+        payload.resize(payloadSize());
+        std::memset(payload.data(), 0, m_size / 8 + 1);
+        uint8_t* flips = payload.data();
+        uint8_t* residual = flips + m_size / 8 + 1;
+        m_bands.run(m_numThreads, [&](const TileScheduler::Tile& band)
+        {
+            int b = band.y0 / m_bandRows;
+            std::vector<uint8_t>& bandFlips = m_bandFlips[b];
+            // whole words of bits
+            bandFlips.assign((size_t(band.y1 - band.y0) * streamed.width() / 64 + 1) * 8, 0);
+            // locals, the byte stores below could alias any member
+            const uint8_t* table0 = m_tables[0].data();
+            const uint8_t* table1 = m_tables[1].data();
+            uint8_t* words = bandFlips.data();
+            const int width = m_width;
+            const int replicas = m_replicas;
+            uint64_t bit = 0;
+            uint64_t word = 0;
+            // like forSites, without branches on the chirality, which is a coin toss in the random modes
+            for (int y = band.y0; y < band.y1; y++)
+            {
+                const uint8_t* row = streamed[y].data();
+                size_t offset = size_t(y) * streamed.width();
+                const uint8_t* target = sites + offset;
+                uint8_t* rest = residual + offset;
+                int phase = (y + time) & 1;
+                for (int x = 0; x < width; x++)
+                {
+                    for (int r = 0; r < replicas; r++)
+                    {
+                        int i = x * replicas + r;
+                        int chirality = (x + r + phase) & 1;
+                        // the two outcomes differ by d
+                        uint8_t s0 = table0[row[i]];
+                        uint8_t d = s0 ^ table1[row[i]];
+                        uint8_t predicted = s0 ^ (d & uint8_t(-chirality));
+                        uint64_t ambiguous = d != 0;
+                        uint64_t flip = ambiguous & (target[i] == (predicted ^ d));
+                        word |= flip << (bit % 64);
+                        rest[i] = target[i] ^ predicted ^ (d & uint8_t(-int(flip)));
+                        bit += ambiguous;
+                        if (ambiguous & ((bit & 63) == 0))
+                        {
+                            storeWord(words + (bit / 64 - 1) * 8, word);
+                            word = 0;
+                        }
+                    }
+                }
+            }
+            if (bit % 64 != 0) storeWord(words + bit / 64 * 8, word);
+            m_bandBits[b] = bit;
+        });
+
+        uint64_t at = 0;
+        for (size_t b = 0; b < m_bandFlips.size(); b++)
+        {
+            appendBits(flips, at, m_bandFlips[b], m_bandBits[b]);
+            at += m_bandBits[b];
+        }
+    }
+
+    // inverse of encode, sites is overwritten with the decoded frame
+    void decode(const uint8_t* payload, uint8_t* sites, uint64_t time)
+    {
+        const Lattice& streamed = stream(sites);
+        const uint8_t* flips = payload;
+        const uint8_t* residual = flips + m_size / 8 + 1;
+        // where the flip bits of each band start
+        m_bands.run(m_numThreads, [&](const TileScheduler::Tile& band)
+        {
+            uint64_t bits = 0;
+            forSites(streamed, time, band.y0, band.y1, [&](size_t, uint8_t predicted, uint8_t other) { bits += predicted != other; });
+            m_bandBits[band.y0 / m_bandRows] = bits;
+        });
+        std::vector<uint64_t> firstBit(m_bandBits.size(), 0);
+        for (size_t b = 1; b < m_bandBits.size(); b++)
+        {
+            firstBit[b] = firstBit[b - 1] + m_bandBits[b - 1];
+        }
+
+        m_bands.run(m_numThreads, [&](const TileScheduler::Tile& band)
+        {
+            uint64_t bit = firstBit[band.y0 / m_bandRows];
+            forSites(streamed, time, band.y0, band.y1, [&](size_t i, uint8_t predicted, uint8_t other)
+            {
+                if (predicted != other)
+                {
+                    if (flips[bit / 8] & (1 << (bit % 8))) predicted = other;
+                    bit++;
+                }
+                sites[i] = predicted ^ residual[i];
+            });
+        });
+    }
+
+    size_t payloadSize() const
+    {
+        return m_size / 8 + 1 + m_size;
+    }
+
+private:
+    Simulation m_sim;
+    const std::array<std::array<uint8_t, 256>, 2>& m_tables;
+    int m_width;
+    int m_replicas;
+    size_t m_size;
+    int m_numThreads;
+    int m_bandRows;
+    TileScheduler m_bands;
+    // flip bits and their count of every band, of the last frame
+    std::vector<std::vector<uint8_t>> m_bandFlips;
+    std::vector<uint64_t> m_bandBits;
+
+    // bit k of word into bit k % 8 of byte k / 8
+    static void storeWord(uint8_t* bytes, uint64_t word)
+    {
+        for (int k = 0; k < 8; k++) bytes[k] = uint8_t(word >> (8 * k));
+    }
+
+    // ORs count bits of from into to, starting at bit at of to
+    static void appendBits(uint8_t* to, uint64_t at, const std::vector<uint8_t>& from, uint64_t count)
+    {
+        size_t bytes = (count + 7) / 8;
+        int shift = int(at % 8);
+        uint8_t* out = to + at / 8;
+        if (shift == 0)
+        {
+            std::memcpy(out, from.data(), bytes);
+            return;
+        }
+        for (size_t j = 0; j < bytes; j++)
+        {
+            out[j] |= uint8_t(from[j] << shift);
+            // the bits past count are 0, so nothing is written past the last bit
+            uint8_t high = uint8_t(from[j] >> (8 - shift));
+            if (high) out[j + 1] |= high;
+        }
+    }
+
+    const Lattice& stream(const uint8_t* sites)
+    {
+        Lattice& grid = m_sim.getGrid();
+        std::memcpy(grid.data(), sites, grid.size());
+        m_sim.moveStep();
+        return m_sim.getGrid();
+    }
+
+    // fn(index, outcome with Alternating chirality, outcome with the other one) for every site of rows [fromRow...toRow) in order
+    template <class Fn>
+    void forSites(const Lattice& streamed, uint64_t time, int fromRow, int toRow, const Fn& fn) const
+    {
+        const uint8_t* tables[2] = { m_tables[0].data(), m_tables[1].data() };
+        for (int y = fromRow; y < toRow; y++)
+        {
+            const uint8_t* row = streamed[y].data();
+            size_t offset = size_t(y) * streamed.width();
+            int phase = (y + time) & 1;
+            for (int x = 0; x < m_width; x++)
+            {
+                for (int r = 0; r < m_replicas; r++)
+                {
+                    int i = x * m_replicas + r;
+                    int chirality = (x + r + phase) & 1;
+                    fn(offset + i, tables[chirality][row[i]], tables[chirality ^ 1][row[i]]);
+                }
+            }
+        }
+    }
+};
+
+Recorder::Recorder(const std::string& path, Simulation& sim, int keyframeInterval, int queueFrames) :
+    m_file(path, std::ios::binary | std::ios::trunc),
+    m_size(sim.getGrid().size()),
+    m_keyframeInterval(keyframeInterval)
+{
+    if (!m_file) throw "Recorder::Recorder can't open file";
+    if (keyframeInterval < 1 || queueFrames < 1) throw "Recorder::Recorder bad interval";
+
+    FileHeader header = { recordingMagic, recordingVersion, sim.getGrid().width() / sim.getReplicas(), sim.getGrid().height(), sim.getReplicas(),
+                          int32_t(sim.getVariant()), int32_t(sim.getXBoundary()), int32_t(sim.getYBoundary()) };
+    m_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    m_predictor.reset(new StepPredictor(header, sim.getNumThreads()));
+
+    m_free.resize(queueFrames, std::vector<uint8_t>(m_size));
+    m_previous.resize(m_size);
+    m_compressed.resize(compressBound(uLong(m_predictor->payloadSize())));
+    m_worker = std::thread(&Recorder::work, this);
+}
+
+Recorder::~Recorder()
+{
+    finish();
+}
+
+void Recorder::record(Simulation& sim)
+{
+    const Lattice& grid = sim.getGrid();
+    if (grid.size() != m_size) throw "Recorder::record lattice size changed";
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_finishing) throw "Recorder::record after finish";
+    m_changed.wait(lock, [this] { return !m_free.empty(); });
+    Pending frame = { sim.getTime(), std::move(m_free.back()) };
+    m_free.pop_back();
+    // copied outside the lock, the worker only touches the queue
+    lock.unlock();
+    std::memcpy(frame.sites.data(), grid.data(), m_size);
+    lock.lock();
+    m_queue.push_back(std::move(frame));
+    m_changed.notify_all();
+}
+
+void Recorder::finish()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_finishing = true;
+        m_changed.notify_all();
+    }
+    if (m_worker.joinable()) m_worker.join();
+    m_file.close();
+}
+
+uint64_t Recorder::getFrames() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_frames;
+}
+
+uint64_t Recorder::getRawBytes() const
+{
+    return getFrames() * m_size;
+}
+
+uint64_t Recorder::getBytes() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_bytes;
+}
+
+void Recorder::work()
+{
+    while (true)
+    {
+        Pending frame;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_changed.wait(lock, [this] { return !m_queue.empty() || m_finishing; });
+            if (m_queue.empty()) return;
+            frame = std::move(m_queue.front());
+            m_queue.pop_front();
+        }
+        write(frame);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            // write() swapped the frame into m_previous, the old previous lattice is free now
+            m_free.push_back(std::move(frame.sites));
+            m_changed.notify_all();
+        }
+    }
+}
+
+void Recorder::write(Pending& frame)
+{
+    int kind = Keyframe;
+    const uint8_t* source = frame.sites.data();
+    size_t size = m_size;
+    if (m_frames % m_keyframeInterval != 0 && frame.time == m_previousTime + 1)
+    {
+        kind = Predicted;
+        m_predictor->encode(m_previous.data(), frame.sites.data(), m_previousTime, m_payload);
+        source = m_payload.data();
+        size = m_payload.size();
+    }
+    else if (m_frames % m_keyframeInterval != 0)
+    {
+        kind = Delta;
+        m_payload.resize(m_size);
+        for (size_t i = 0; i < m_size; i++)
+        {
+            m_payload[i] = frame.sites[i] ^ m_previous[i];
+        }
+        source = m_payload.data();
+    }
+
+    // predicted payloads are mostly zero runs, run length matching does as well as full LZ77 on them at a fraction of the time
+    z_stream stream = z_stream();
+    deflateInit2(&stream, 1, Z_DEFLATED, 15, 8, kind == Predicted ? Z_RLE : Z_DEFAULT_STRATEGY);
+    stream.next_in = const_cast<Bytef*>(source);
+    stream.avail_in = uInt(size);
+    stream.next_out = m_compressed.data();
+    stream.avail_out = uInt(m_compressed.size());
+    // the output buffer is compressBound large, so one call always finishes
+    deflate(&stream, Z_FINISH);
+    uint64_t bytes = stream.total_out;
+    deflateEnd(&stream);
+
+    FrameHeader header = { frame.time, kind, 0, bytes };
+    m_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    m_file.write(reinterpret_cast<const char*>(m_compressed.data()), std::streamsize(bytes));
+
+    m_previous.swap(frame.sites);
+    m_previousTime = frame.time;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_frames++;
+    m_bytes += sizeof(header) + bytes;
+}
+
+Recording::Recording(const std::string& path) :
+    m_file(path, std::ios::binary)
+{
+    FileHeader header;
+    if (!m_file.read(reinterpret_cast<char*>(&header), sizeof(header))) throw "Recording::Recording can't read file";
+    if (header.magic != recordingMagic || header.version != recordingVersion) throw "Recording::Recording not a recording";
+    m_width = header.width;
+    m_height = header.height;
+    m_replicas = header.replicas;
+    m_predictor.reset(new StepPredictor(header, int(std::max(1u, std::thread::hardware_concurrency()))));
+    m_sites.resize(size_t(m_width) * m_replicas * m_height);
+
+    // frame headers are read up front, the lattices only when asked for
+    m_file.seekg(0, std::ios::end);
+    uint64_t end = uint64_t(m_file.tellg());
+    uint64_t offset = sizeof(header);
+    FrameHeader frame;
+    while (offset + sizeof(frame) <= end)
+    {
+        m_file.seekg(std::streamoff(offset));
+        if (!m_file.read(reinterpret_cast<char*>(&frame), sizeof(frame))) break;
+        offset += sizeof(frame);
+        if (offset + frame.bytes > end) break;
+        // a recording that starts with a delta can't be decoded
+        if (m_entries.empty() && frame.kind != Keyframe) throw "Recording::Recording no keyframe";
+        m_entries.push_back({ frame.time, frame.kind, offset, frame.bytes });
+        offset += frame.bytes;
+    }
+    m_file.clear();
+}
+
+Recording::~Recording()
+{
+}
+
+int Recording::width() const
+{
+    return m_width;
+}
+
+int Recording::height() const
+{
+    return m_height;
+}
+
+int Recording::replicas() const
+{
+    return m_replicas;
+}
+
+int Recording::getNumFrames() const
+{
+    return int(m_entries.size());
+}
+
+uint64_t Recording::getTime(int frame) const
+{
+    return m_entries[frame].time;
+}
+
+int Recording::findFrame(uint64_t time) const
+{
+    int frame = -1;
+    for (int i = 0; i < int(m_entries.size()) && m_entries[i].time <= time; i++)
+    {
+        frame = i;
+    }
+    return frame;
+}
+
+const std::vector<uint8_t>& Recording::read(int frame)
+{
+    if (frame < 0 || frame >= int(m_entries.size())) throw "Recording::read no such frame";
+    int from = frame;
+    while (m_entries[from].kind != Keyframe)
+    {
+        from--;
+    }
+    // going on from the current frame is cheaper than from the keyframe
+    if (m_current >= from && m_current <= frame) from = m_current + 1;
+    for (int i = from; i <= frame; i++)
+    {
+        decode(i);
+    }
+    return m_sites;
+}
+
+void Recording::load(int frame, Simulation& sim)
+{
+    Lattice& grid = sim.getGrid();
+    if (grid.width() != m_width * m_replicas || grid.height() != m_height || sim.getReplicas() != m_replicas) throw "Recording::load simulation doesn't match";
+    std::memcpy(grid.data(), read(frame).data(), m_sites.size());
+    sim.setTime(m_entries[frame].time);
+}
+
+void Recording::decode(int frame)
+{
+    const Entry& entry = m_entries[frame];
+    m_compressed.resize(entry.bytes);
+    m_file.seekg(std::streamoff(entry.offset));
+    if (!m_file.read(reinterpret_cast<char*>(m_compressed.data()), std::streamsize(entry.bytes))) throw "Recording::decode can't read frame";
+
+    size_t expected = entry.kind == Predicted ? m_predictor->payloadSize() : m_sites.size();
+    m_payload.resize(expected);
+    uint8_t* target = entry.kind == Keyframe ? m_sites.data() : m_payload.data();
+    uLongf size = uLongf(expected);
+    if (uncompress(target, &size, m_compressed.data(), uLong(entry.bytes)) != Z_OK || size != expected) throw "Recording::decode corrupt frame";
+
+    if (entry.kind == Predicted) m_predictor->decode(m_payload.data(), m_sites.data(), m_entries[frame - 1].time);
+    else if (entry.kind == Delta)
+    {
+        for (size_t i = 0; i < m_sites.size(); i++)
+        {
+            m_sites[i] ^= m_payload[i];
+        }
+    }
+    m_current = frame;
+}
@@ -0,0 +1,137 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "simulation.h"
+
+class StepPredictor;
+
+/* full resolution lattice history in a file, for replay and debugging
+every keyframeInterval-th frame is stored whole, the others relative to the frame before:
+a frame one step after the previous one is coded against the previous frame streamed once, which leaves only
+a bit per site where the collision had a choice of chirality (all zero in Alternating mode) and the inflow,
+a few hundredths of a byte per site after deflate, frames further apart are stored as the XOR with the previous one
+and hardly compress, so record every step where the history matters
+coding and compression run on a background thread, the solver thread only copies the lattice, see Recording for playback
+recording is not free: a predicted frame is streamed and looked up once more, about the work of a step in Alternating mode,
+on the simulation's thread count, then deflated on the one background thread (about a third of a step, 2000 x 1000 sites ~7 ms),
+it overlaps with the next steps, but once queueFrames copies are taken record() waits, so recording every step
+runs at roughly half the speed of the solver alone */
+class Recorder
+{
+public:
+    /* records lattices of sim's size, replicas, variant and boundaries into path
+    up to queueFrames copies wait for the background thread, record() blocks while they are all taken */
+    Recorder(const std::string& path, Simulation& sim, int keyframeInterval = 100, int queueFrames = 2);
+
+    // finish()
+    ~Recorder();
+
+    Recorder(const Recorder&) = delete;
+    Recorder& operator=(const Recorder&) = delete;
+
+    // queues a copy of sim's current lattice, tagged with its time
+    void record(Simulation& sim);
+
+    // writes the queued frames and closes the file
+    void finish();
+
+    // frames written so far
+    uint64_t getFrames() const;
+    // bytes of lattice written so far, uncompressed and compressed
+    uint64_t getRawBytes() const;
+    uint64_t getBytes() const;
+
+private:
+    struct Pending
+    {
+        uint64_t time;
+        std::vector<uint8_t> sites;
+    };
+
+    std::ofstream m_file;
+    size_t m_size;
+    int m_keyframeInterval;
+    std::unique_ptr<StepPredictor> m_predictor;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_changed;
+    std::deque<Pending> m_queue;
+    // lattice copies not in the queue
+    std::vector<std::vector<uint8_t>> m_free;
+    bool m_finishing = false;
+    std::thread m_worker;
+
+    // worker state
+    std::vector<uint8_t> m_previous;
+    uint64_t m_previousTime = 0;
+    std::vector<uint8_t> m_payload;
+    std::vector<uint8_t> m_compressed;
+    uint64_t m_frames = 0;
+    uint64_t m_bytes = 0;
+
+    void work();
+    void write(Pending& frame);
+};
+
+// reads what a Recorder wrote, any frame can be read in any order
+class Recording
+{
+public:
+    // throws if path isn't a recording, a frame cut short at the end of the file is left out
+    explicit Recording(const std::string& path);
+    ~Recording();
+
+    Recording(const Recording&) = delete;
+    Recording& operator=(const Recording&) = delete;
+
+    // sites per row of one replica
+    int width() const;
+    int height() const;
+    int replicas() const;
+
+    int getNumFrames() const;
+    // simulation time of frame
+    uint64_t getTime(int frame) const;
+    // last frame recorded at or before time, -1 if there is none
+    int findFrame(uint64_t time) const;
+
+    /* lattice of frame, rows of width * replicas sites like Simulation::getGrid
+    decodes from the nearest keyframe, or on from the frame read last if that is closer */
+    const std::vector<uint8_t>& read(int frame);
+
+    // copies frame into sim's lattice and sets its time, sim has to have the recorded size and replicas
+    void load(int frame, Simulation& sim);
+
+private:
+    struct Entry
+    {
+        uint64_t time;
+        int kind;
+        uint64_t offset;
+        uint64_t bytes;
+    };
+
+    std::ifstream m_file;
+    int m_width = 0;
+    int m_height = 0;
+    int m_replicas = 1;
+    std::vector<Entry> m_entries;
+    std::unique_ptr<StepPredictor> m_predictor;
+    std::vector<uint8_t> m_sites;
+    std::vector<uint8_t> m_payload;
+    std::vector<uint8_t> m_compressed;
+    // frame in m_sites, -1 before the first read
+    int m_current = -1;
+
+    void decode(int frame);
+};
+
+#endif // RECORDER_H
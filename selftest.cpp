@@ -0,0 +1,15 @@
+#include <iostream>
+#include "verifier.h"
+
+/* fhph-selftest - the checks of fhph --self-test without Qt, exit code 1 on failure
+build with: qmake selftest.pro && make */
+int main()
+{
+    Verifier::Result result = Verifier::runAll();
+    for (const auto& failure : result.failures)
+    {
+        std::cout << failure << "\n";
+    }
+    std::cout << result.checks << " checks, " << result.failures.size() << " failed" << std::endl;
+    return result.passed ? 0 : 1;
+}
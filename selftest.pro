@@ -0,0 +1,44 @@
+# the verifier as its own console program, only the solver sources, no Qt needed to build or run it
+QT -= core gui
+
+CONFIG += c++17 console
+CONFIG -= app_bundle qt
+
+TARGET = fhph-selftest
+
+SOURCES += \
+        autotune.cpp \
+        field.cpp \
+        fieldpyramid.cpp \
+        geometry.cpp \
+        lattice.cpp \
+        probes.cpp \
+        recorder.cpp \
+        selftest.cpp \
+        simulation.cpp \
+        taskgraph.cpp \
+        tilescheduler.cpp \
+        verifier.cpp \
+        warmstart.cpp
+
+LIBS += -lz -lpthread
+
+# `make check` runs it
+QMAKE_EXTRA_TARGETS += check
+check.depends = $(TARGET)
+check.commands = ./$(TARGET)
+
+HEADERS += \
+    autotune.h \
+    boundaries.h \
+    field.h \
+    fieldpyramid.h \
+    geometry.h \
+    lattice.h \
+    probes.h \
+    recorder.h \
+    simulation.h \
+    taskgraph.h \
+    tilescheduler.h \
+    verifier.h \
+    warmstart.h
@@ -0,0 +1,15 @@
+# python module of the solver, no Qt needed: python3 setup.py build_ext --inplace
+from setuptools import setup, Extension
+
+setup(
+    name="fhph",
+    version="0.1",
+    ext_modules=[
+        Extension(
+            "fhph",
+            sources=["pyfhph.cpp", "simulation.cpp", "lattice.cpp", "taskgraph.cpp", "tilescheduler.cpp", "field.cpp", "fieldpyramid.cpp"],
+            extra_compile_args=["-std=c++17", "-O3"],
+            libraries=["pthread"],
+        )
+    ],
+)
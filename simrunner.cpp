@@ -1,103 +1,212 @@
 #include "simrunner.h"
+#include <algorithm>
+#include <array>
 #include <fstream>
+#include <limits>
+#include <thread>
 #include <QDebug>
+#include "autotune.h"
+#include "geometry.h"
+#include "probes.h"
 #include "simulation.h"
+#include "warmstart.h"
 
 SimRunner::SimRunner(QObject *parent) : QObject(parent)
 {
 
 }
 
-std::vector<std::vector<double> > SimRunner::density()
+Field SimRunner::density()
 {
+    if (!m_attachName.empty()) return attachedField(true);
     std::scoped_lock l(m_densityMutex);
     return m_density;
 }
 
-std::vector<std::vector<double> > SimRunner::velMagnitude()
+Field SimRunner::velMagnitude()
 {
+    if (!m_attachName.empty()) return attachedField(false);
     std::scoped_lock l(m_velMagnitudeMutex);
     return m_velMagnitude;
 }
 
-SimRunner::~SimRunner()
+void SimRunner::publishTo(const std::string &name)
+{
+    m_publishName = name;
+}
+
+void SimRunner::attachTo(const std::string &name)
 {
-    if(m_simThread.joinable())
+    m_attachName = name;
+}
+
+Field SimRunner::attachedField(bool density)
+{
+    std::scoped_lock l(m_attachMutex);
+    // (re)attach lazily, the solver may start after the viewer or be restarted
+    if (!m_attachedRing.isValid() || m_attachedRing.isClosed())
     {
-        m_stopThread = true;
-        m_simThread.join();
+        try
+        {
+            m_attachedRing = FrameRing::attach(m_attachName);
+        }
+        catch (const char*)
+        {
+            m_attachedRing = FrameRing();
+            return {};
+        }
     }
+
+    FrameRing::Frame frame;
+    if (!m_attachedRing.readLatest(frame)) return {};
+
+    return frame.field.select(density ? Field::Density : Field::Magnitude);
+}
+
+bool SimRunner::isPaused() const
+{
+    return m_paused;
+}
+
+SimRunner::~SimRunner()
+{
+    quit();
 }
 
 void SimRunner::start()
 {
-    if(m_simThread.joinable())
+    // a viewer only shows what the solver process publishes
+    if (!m_attachName.empty()) return;
+    if (m_simThread.joinable())
     {
-        m_stopThread = true;
-        m_simThread.join();
+        post({Command::Resume});
+        return;
     }
-    m_stopThread = false;
-    m_simThread = std::thread([this](){plate(4000, 1000, 50, 100000, 400, 700);});
+    m_commands.clear();
+    m_simThread = std::thread([this]()
+    {
+        plate(4000, 1000, 50, 100000, 400, 700);
+    });
 }
 
-void SimRunner::stop()
+void SimRunner::pause()
 {
-    m_stopThread = true;
+    post({Command::Pause});
 }
 
-std::pair<double, double> SimRunner::average(const std::pair<double, double> &prev, int sampleCount, const std::pair<double, double> &sample)
+void SimRunner::step(int steps)
 {
-    return { (prev.first * sampleCount + sample.first) / (sampleCount + 1), (prev.second * sampleCount + sample.second) / (sampleCount + 1) };
+    if (steps > 0) post({Command::Step, steps});
 }
 
-std::vector<std::vector<std::pair<double, double> > > SimRunner::average(const std::vector<std::vector<std::pair<double, double> > > &prev, int sampleCount, const std::vector<std::vector<std::pair<double, double> > > &sample)
+void SimRunner::reset()
 {
-    std::vector<std::vector<std::pair<double, double>>> avg;
-    avg.reserve(prev.size());
+    quit();
+    start();
+}
 
-    for (int i = 0; i < prev.size(); i++)
-    {
-        avg.push_back(std::vector<std::pair<double, double>>());
-        avg[i].reserve(prev[i].size());
+void SimRunner::setInflow(double left, double right)
+{
+    post({Command::Inflow, 0, float(std::clamp(left, 0., 1.)), float(std::clamp(right, 0., 1.))});
+}
 
-        for (int j = 0; j < prev[i].size(); j++)
-        {
-            avg[i].push_back(average(prev[i][j], sampleCount, sample[i][j]));
-        }
+void SimRunner::setSampleEvery(int steps)
+{
+    post({Command::SampleEvery, steps > 0 ? std::max(steps, 20) : 0});
+}
+
+void SimRunner::setThreads(int threads)
+{
+    post({Command::Threads, std::max(threads, 1)});
+}
+
+void SimRunner::post(const Command& command)
+{
+    {
+        std::scoped_lock l(m_commandMutex);
+        m_commands.push_back(command);
     }
-    return avg;
+    m_commandAdded.notify_one();
 }
 
-std::vector<std::vector<double> > SimRunner::average(const std::vector<std::vector<double> > &prev, int sampleCount, const std::vector<std::vector<double> > &sample)
+void SimRunner::quit()
 {
-    std::vector<std::vector<double>> avg;
-    avg.reserve(prev.size());
+    if (!m_simThread.joinable()) return;
+    post({Command::Quit});
+    m_simThread.join();
+    m_commands.clear();
+    if (m_paused.exchange(false)) emit pausedChanged();
+}
 
-    for (int i = 0; i < prev.size(); i++)
+void SimRunner::setViewport(double x, double y, double width, double height, int pixelWidth, int pixelHeight)
+{
     {
-        avg.push_back(std::vector<double>());
-        avg[i].reserve(prev[i].size());
+        std::scoped_lock l(m_viewportMutex);
+        m_viewport.width = std::clamp(width, 0., 1.);
+        m_viewport.height = std::clamp(height, 0., 1.);
+        m_viewport.x = std::clamp(x, 0., 1. - m_viewport.width);
+        m_viewport.y = std::clamp(y, 0., 1. - m_viewport.height);
+        m_viewport.pixelWidth = std::max(pixelWidth, 0);
+        m_viewport.pixelHeight = std::max(pixelHeight, 0);
+    }
+    // a running session picks the viewport up with its next sample anyway
+    if (m_simThread.joinable() && m_paused) post({Command::View});
+}
+
+std::pair<double, double> SimRunner::average(const std::pair<double, double> &prev, int sampleCount, const std::pair<double, double> &sample)
+{
+    return { (prev.first * sampleCount + sample.first) / (sampleCount + 1), (prev.second * sampleCount + sample.second) / (sampleCount + 1) };
+}
 
-        for (int j = 0; j < prev[i].size(); j++)
+void SimRunner::saveVelToFile(std::string name, const Field& velField)
+{
+    std::ofstream f(name, std::ios::out);
+    for (int y = 0; y < velField.height(); y++)
+    {
+        for (int x = 0; x < velField.width(); x++)
         {
-            avg[i].push_back((prev[i][j] * sampleCount + sample[i][j]) / (sampleCount + 1));
+            size_t c = velField.at(x, y);
+            double vx = velField.vx()[c];
+            double vy = velField.vy()[c];
+            double magnitude = sqrt(vx * vx + vy * vy);
+            f << x << "\t" << y << "\t" << vx / magnitude << "\t" << vy / magnitude << "\t" << magnitude << "\n";
         }
     }
-    return avg;
+    f.close();
 }
 
-void SimRunner::saveVelToFile(std::string name, const std::vector<std::vector<std::pair<double, double> > > &velField)
+Field SimRunner::flowLines(const Field& velField)
 {
-    std::ofstream f(name, std::ios::out);
-    for (int y = 0; y < velField.size(); y++)
+    Field lines(velField.width(), velField.height(), Field::Magnitude);
+    std::vector<std::pair<double, double>> parts;
+    for(int k = 0; k < 30; k++)
     {
-        for (int x = 0; x < velField[y].size(); x++)
+        for(int j = 0; j < 100; j++)
         {
-            double magnitude = sqrt(velField[y][x].first * velField[y][x].first + velField[y][x].second * velField[y][x].second);
-            f << x << "\t" << y << "\t" << velField[y][x].first / magnitude << "\t" << velField[y][x].second / magnitude << "\t" << magnitude << "\n";
+            parts.push_back({velField.width() / 100. * j + 0.25, velField.height() / 30. * k + 0.25});
         }
     }
-    f.close();
+
+    // a quarter cell a step
+    for(int i = 0; i < 500; i++)
+    {
+        for(auto& p : parts)
+        {
+            if(p.first >= velField.width() || p.first < 0 || p.second >= velField.height() || p.second < 0)continue;
+            size_t c = velField.at(int(p.first), int(p.second));
+            double vx = velField.vx()[c];
+            double vy = velField.vy()[c];
+            auto m = sqrt(vx * vx + vy * vy);
+            if(m<0.000001)
+            {
+                continue;
+            }
+            lines.magnitude()[c] = fmin(m, 1);
+            p.first = p.first + 0.25 * (vx / m);
+            p.second = p.second + 0.25 * (vy / m);
+        }
+    }
+    return lines;
 }
 
 /* to run just the solver for Poisseule flow:
@@ -108,85 +217,187 @@ Simulation sim = Simulation(w, h, 10, [&](Simulation* sim)
     sim->spawnAtX(0.2, 0, w); // fill with particles
     sim->spawnAtX(0.4, 0, reserveWidth); // left side constant density
 }
-for (int i = 0; i < steps; i++)
-{
-    sim.moveStep(); // move step
-    sim.colissionStep(); // collision step
-    sim.spawnAtX(0.4, 0, reserveWidth); // left side constant density
-    sim.spawnAtX(0.2, w - reserveWidth, reserveWidth); // right side constant density
-}
+sim.setInflow({{0.4f, 0, reserveWidth}, {0.2f, w - reserveWidth, reserveWidth}}); // constant density on both sides
+sim.advance(steps); // move + collision + inflow steps
 
 everything else is just thread management or data generation/saving/averaging etc.
  */
 
-void SimRunner::plate(int w, int h, int reserveWidth, int steps, int barrierHeight, int barrierPos)
+void SimRunner::plate(int w, int h, int reserveWidth, int steps, int barrierHeight, int barrierPos, int replicas)
 {
     int imageSampleWH = 4;
+    // until the autotuner has picked the step threads
+    int threads = std::max(1, int(std::thread::hardware_concurrency()));
 
-    Simulation sim = Simulation(w, h, 10, [&](Simulation* sim)
+    // channel walls and the block, rasterised on all threads before the grid exists
+    Geometry geometry(w, h);
+    geometry.addChannelWalls();
+    // "porous" media
+    //geometry.addPorous(1000, 10, 1);
+    // circle
+    //geometry.addCircle(barrierPos, h / 2, barrierHeight / 2., true);
+    // block, measured: momentum exchange on it is recorded during the collisions
+    geometry.addRect(barrierPos - barrierHeight / 4, h / 2 - barrierHeight / 2, barrierPos + barrierHeight / 4, h / 2 + barrierHeight / 2, true);
+    geometry.rasterise(threads);
+    std::vector<Simulation::Inflow> inflow = {{0.4f, 0, reserveWidth}, {0.2f, w - reserveWidth, reserveWidth}};
+
+    // the flow developed on a 4 times coarser lattice, instead of thousands of steps from rest
+    WarmStart::Coarse coarse = WarmStart::develop(geometry, inflow, 0.2f, Simulation::Variant::FHP3, 4, 0, threads);
+    qDebug() << "warm start" << coarse.seconds << "s";
+
+    Simulation sim = Simulation(w, h, threads, [&](Simulation* sim)
+    {
+        geometry.paint(sim->getGrid(), 1, threads);
+        sim->seedEquilibrium(coarse.field, coarse.cellSize, coarse.cellSize);
+    }, replicas);
+    int block = geometry.addObstacles(sim)[0];
+
+    // shedding frequency in the wake, shedding periods of a block this size are thousands of steps
+    Probes probes(2e-5, 1e-3, 50, 50000);
+    probes.add(barrierPos + barrierHeight, h / 2, 4);
+    probes.add(barrierPos + 2 * barrierHeight, h / 2 + barrierHeight / 4, 4);
+    int lanes = sim.getReplicas();
+
+    // the whole domain averaged over the temporal samples, only kept for the frame ring
+    Field velField;
+    auto t = std::chrono::system_clock::now();
+
+    FrameRing ring;
+    if (!m_publishName.empty()) ring = FrameRing::create(m_publishName, w / imageSampleWH, h / imageSampleWH);
+
+    // the viewport of the GUI averaged over the temporal samples since it last changed, read with at most viewSamples sites a cell
+    const int viewSamples = 64;
+    Field viewField;
+    std::array<int, 6> viewRegion = {};
+    int viewCount = 0;
+
+    sim.setInflow(inflow);
+
+    /* threads and tiles of the profile for this machine and grid, timed on the lattice the first time
+    the collision kernel stays the run's, RandomPlane correlates the chirality of nearby rows, so picking it on speed would change the results per machine */
+    Autotune::Config tuned = Autotune::tuned(sim);
+    qDebug() << "threads" << tuned.numThreads << "tiles" << tuned.tileWidth << "x" << tuned.tileHeight << "mode" << int(tuned.mode)
+             << "field tiles" << tuned.fieldTileWidth << "x" << tuned.fieldTileHeight;
+
+    // session state, only the commands change it
+    bool paused = false;
+    // steps still to run while paused
+    int stepsLeft = 0;
+    int sampleEvery = 0;
+    auto every = [&](int i) { return sampleEvery > 0 ? sampleEvery : (i < 30000 ? 200 : 100); };
+    auto sampled = [&](int i) { return i % every(i) <= 10; };
+
+    // sites x0, y0, x1, y1 of the view and the cell size that gives about one cell per pixel
+    auto viewportRegion = [&]()
+    {
+        Viewport view;
+        {
+            std::scoped_lock l(m_viewportMutex);
+            view = m_viewport;
+        }
+        std::array<int, 6> region = { int(view.x * w), int(view.y * h), int(std::ceil((view.x + view.width) * w)), int(std::ceil((view.y + view.height) * h)), imageSampleWH, imageSampleWH };
+        if (view.pixelWidth > 0 && view.pixelHeight > 0)
+        {
+            region[4] = std::max(1, (region[2] - region[0]) / view.pixelWidth);
+            region[5] = std::max(1, (region[3] - region[1]) / view.pixelHeight);
+        }
+        return region;
+    };
+
+    // the view of a paused session is the lattice as it is, after the viewport changed or single steps
+    bool refreshView = false;
+
+    for (int i = 0; ; i++)
     {
-        sim->getGrid()[0].assign(w, 0b10000000);
-        sim->getGrid()[h - 1].assign(w, 0b10000000);
-        sim->spawnAtX(0.2, 0, w);
-        sim->spawnAtX(0.4, 0, reserveWidth);
-        // "porous" media
-        /*for(int i = 0; i < 1000; i++)
+        if (i == steps)
+        {
+            // the run is done, the session waits for more
+            paused = true;
+            stepsLeft = 0;
+            emit finished();
+        }
+
+        // commands of the GUI, between batches the lattice isn't being stepped, a paused session sleeps until one comes
+        while (true)
         {
-            int posx = rand() % (w-10);
-            int posy = rand() % (h-10);
-            for(int y = posy; y < posy+10; y++)
+            if (m_paused != (paused && stepsLeft == 0))
             {
-                for(int x = posx; x < posx+10; x++)
-                {
-                    sim->getGrid()[y][x] = 0b10000000;
-                }
+                m_paused = paused && stepsLeft == 0;
+                emit pausedChanged();
             }
-        }*/
-        // circle
-        /*for (int i = h / 2 - barrierHeight / 2; i < h / 2 + barrierHeight / 2; i++)
-        {
-            for(int j = barrierPos - barrierHeight / 2; j < barrierPos + barrierHeight / 2; j++)
+            if (refreshView && paused && stepsLeft == 0)
             {
-                if((i-h/2)*(i-h/2) + (j - barrierPos)*(j - barrierPos) < barrierHeight * barrierHeight/4)
-                    sim->getGrid()[i][j] = 0b10000000;
+                // nothing to average while paused, one sample of the lattice as it is
+                std::array<int, 6> region = viewportRegion();
+                Field sample = sim.getRegionField(region[0], region[1], region[2], region[3], region[4], region[5], Field::Velocity | Field::Density, viewSamples);
+                std::unique_lock<std::mutex> l1(m_velMagnitudeMutex);
+                m_velMagnitude = flowLines(sample);
+                l1.unlock();
+                std::unique_lock<std::mutex> l2(m_densityMutex);
+                m_density = sample.select(Field::Density);
+                l2.unlock();
+                viewCount = 0;
+                refreshView = false;
             }
-        }*/
-        // block
-        for (int i = h / 2 - barrierHeight / 2; i < h / 2 + barrierHeight / 2; i++)
-        {
-            for(int j = barrierPos - barrierHeight / 4; j < barrierPos + barrierHeight / 4; j++)
+            std::deque<Command> commands;
             {
-                sim->getGrid()[i][j] = 0b10000000;
+                std::unique_lock<std::mutex> l(m_commandMutex);
+                m_commandAdded.wait(l, [&]() { return !m_commands.empty() || !m_paused; });
+                commands.swap(m_commands);
             }
+            for (const Command& command : commands)
+            {
+                switch (command.kind)
+                {
+                case Command::Quit: return;
+                case Command::Pause: paused = true; stepsLeft = 0; break;
+                case Command::Resume: paused = false; stepsLeft = 0; break;
+                case Command::Step: paused = true; stepsLeft += command.value; break;
+                case Command::Inflow:
+                    inflow[0].concentration = command.left;
+                    inflow[1].concentration = command.right;
+                    sim.setInflow(inflow);
+                    break;
+                case Command::SampleEvery: sampleEvery = command.value; break;
+                case Command::Threads: sim.setNumThreads(command.value); break;
+                case Command::View: refreshView = true; break;
+                }
+            }
+            if (!paused || stepsLeft > 0) break;
         }
-    });
-
-    std::vector<std::vector<std::pair<double, double>>> velField;
-    auto t = std::chrono::system_clock::now();
-    std::vector<std::vector<double>> dField;
-    std::vector<std::vector<double>> vmField;
-    velField = sim.getVelocityField(imageSampleWH, imageSampleWH);
-    auto info = sim.getVelocityMagnitudeAndDensityField(imageSampleWH, imageSampleWH);
-    vmField = info.first;
-    dField = info.second;
 
-    std::vector<std::pair<double, double>> parts;
-    for(int i = 0; i < 50; i++)
-    {
-        for(int j = 0; j < 50; j++)
+        // the steps up to the next one that is looked at run as one batch, without a barrier between them
+        int first = i;
+        int last = paused ? i + stepsLeft - 1 : std::numeric_limits<int>::max();
+        while (i + 1 != steps && i < last && !sampled(i) && i % 1000 != 999) i++;
+        if (paused)
         {
-            parts.push_back({w/50 * j + 1, h/50 * i + 1});
+            stepsLeft -= i - first + 1;
+            refreshView = stepsLeft == 0;
         }
-    }
-
-    for (int i = 0; i < steps; i++)
-    {
-        sim.moveStep();
-        sim.colissionStep();
-        sim.spawnAtX(0.4, 0, reserveWidth);
-        sim.spawnAtX(0.2, w - reserveWidth, reserveWidth);
+        sim.advance(i - first + 1, [&](const Lattice& grid, int fromRow, int toRow, uint64_t)
+        {
+            probes.sample(grid, lanes, fromRow, toRow);
+        });
 
-        if (i % 10 == 0) qDebug() << i;
+        if (i / 10 * 10 >= first) qDebug() << i;
+        if (i % 1000 == 999)
+        {
+            // mean drag and lift of the last 1000 steps, or of all of them in a shorter run
+            const auto& forces = sim.getObstacleForces(block);
+            std::pair<double, double> mean = {0., 0.};
+            size_t from = std::max<size_t>(forces.size(), 1000) - 1000;
+            for (size_t j = from; j < forces.size(); j++)
+            {
+                mean = average(mean, int(j - from), forces[j]);
+            }
+            qDebug() << "drag" << mean.first << "lift" << mean.second;
+            for (int p = 0; p < probes.getNumProbes(); p++)
+            {
+                Probes::Estimate estimate = probes.getEstimate(p);
+                if (estimate.windows > 0) qDebug() << "probe" << p << "shedding frequency" << estimate.frequency << "per step, mean vy" << estimate.mean;
+            }
+        }
 
         // velocity field saving
 /*
@@ -205,7 +416,7 @@ void SimRunner::plate(int w, int h, int reserveWidth, int steps, int barrierHeig
         if (i >= steps - 5000)
         {
             if (i == steps - 5000) velField = sim.getVelocityField(4, 4);
-            else velField = average(velField, i - (steps - 5000), sim.getVelocityField(4, 4));
+            else velField.accumulate(sim.getVelocityField(4, 4), i - (steps - 5000));
         }
         if (i == 1000)
         {
@@ -215,65 +426,37 @@ void SimRunner::plate(int w, int h, int reserveWidth, int steps, int barrierHeig
 
         // flow lines + density field data generation
         // save flow line image to velocity magnitude data just for simplicity
-        if((i < 30000 && i%200 <= 10) || (i >= 30000 && i%100 <= 10))
+        if(sampled(i))
         {
+            std::array<int, 6> region = viewportRegion();
+            if (region != viewRegion || i % every(i) == 0) viewCount = 0;
+            viewRegion = region;
+
             // generation of data only after 10 temporal samples
-            if(i%100==10)
+            if(i % every(i) == 10)
             {
-                parts.clear();
-                for(int k = 0; k < 30; k++)
-                {
-                    for(int j = 0; j < 100; j++)
-                    {
-                        parts.push_back({w/100 * j + 1, h/30 * k + 1});
-                    }
-                }
-
-                for(auto& v : vmField)
-                {
-                    v.assign(v.size(), 0);
-                }
-
-                for(int i = 0; i < 500; i++)
-                {
-                    for(int j = 0; j < parts.size(); j++)
-                    {
-                        auto& p = parts[j];
-                        if(p.first > w-1 || p.first < 0 || p.second > h-1 || p.second < 0)continue;
-                        auto v = velField[p.second/imageSampleWH][p.first/imageSampleWH];
-                        auto m = sqrt(pow(v.first, 2.) + pow(v.second, 2.));
-                        if(m<0.000001)
-                        {
-                            continue;
-                        }
-                        else
-                        {
-                            vmField[p.second/imageSampleWH][p.first/imageSampleWH] = fmin(m, 1);
-                            p.first = p.first + (v.first / m);
-                            p.second = p.second + (v.second /m);
-                        }
-                    }
-                }
                 std::unique_lock<std::mutex> l1(m_velMagnitudeMutex);
-                m_velMagnitude = vmField;
+                m_velMagnitude = flowLines(viewField);
                 l1.unlock();
                 std::unique_lock<std::mutex> l2(m_densityMutex);
-                m_density = dField;
+                m_density = viewField.select(Field::Density);
                 l2.unlock();
+                // never blocks, viewers pick the frame up whenever they like
+                if (ring.isValid()) ring.publish(sim.getTime(), velField, flowLines(velField));
             }
             else
             {
-                auto info = sim.getVelocityAndDensityField(imageSampleWH, imageSampleWH);
-                dField = average(dField, i%10, info.second);
-                velField = average(velField, i%10, info.first);
+                Field sample = sim.getRegionField(region[0], region[1], region[2], region[3], region[4], region[5], Field::Velocity | Field::Density, viewSamples);
+                if (viewCount == 0) viewField = sample;
+                else viewField.accumulate(sample, viewCount);
+                viewCount++;
+                if (ring.isValid())
+                {
+                    if (i % every(i) == 0) velField = sim.getVelocityAndDensityField(imageSampleWH, imageSampleWH);
+                    else velField.accumulate(sim.getVelocityAndDensityField(imageSampleWH, imageSampleWH), i % every(i));
+                }
             }
         }
-
-        if(m_stopThread)
-        {
-            m_stopThread = false;
-            return;
-        }
     }
 
     //std::unique_lock<std::mutex> l1(m_velMagnitudeMutex);
@@ -4,45 +4,132 @@
 #include <QObject>
 #include <thread>
 #include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <mutex>
+#include "field.h"
+#include "framering.h"
 
+/* runs one simulation session on its own thread, the lattice lives as long as the session,
+pausing, stepping and changing inflow, sampling or threads go through a command queue
+that the simulation thread drains between batches of steps, so the developed flow is never thrown away */
 class SimRunner : public QObject
 {
     Q_OBJECT
+    Q_PROPERTY(bool paused READ isPaused NOTIFY pausedChanged)
 public:
     explicit SimRunner(QObject *parent = nullptr);
 
-    std::vector<std::vector<double>> density();
-    std::vector<std::vector<double>> velMagnitude();
+    // Field::Density only, of the viewport
+    Field density();
+    // Field::Magnitude only, of the viewport
+    Field velMagnitude();
+
+    // runs also publish their fields into the shared-memory ring name, for viewers in other processes
+    void publishTo(const std::string& name);
+
+    /* viewer only, density()/velMagnitude() show the newest frame of the ring name instead of running a simulation,
+    the ring doesn't have to exist yet and may come and go */
+    void attachTo(const std::string& name);
+
+    bool isPaused() const;
 
     ~SimRunner();
 
 public slots:
+    // starts the session, or resumes it if there is one
     void start();
-    void stop();
+    // the session stops stepping after the current batch and keeps its lattice
+    void pause();
+    // runs steps more steps and pauses again
+    void step(int steps);
+    // ends the session and starts a new one from the initial conditions
+    void reset();
+
+    // concentrations the inflow and outflow reservoirs are kept at
+    void setInflow(double left, double right);
+    // a view refresh every steps steps (at least 20), 0 goes back to the default (every 200, every 100 after 30000)
+    void setSampleEvery(int steps);
+    void setThreads(int threads);
+
+    /* the part of the domain the GUI shows, x/y/width/height in fractions of the domain, and its size in screen pixels
+    density()/velMagnitude() then only cover that part, reduced to about one cell per pixel (at least one site a cell),
+    so rendering costs what the screen has pixels whatever the size of the domain, viewers attached to a ring show its whole frames */
+    void setViewport(double x, double y, double width, double height, int pixelWidth, int pixelHeight);
 
 signals:
+    // the session reached the steps it was started for and paused, it can still be resumed
+    void finished();
+    void pausedChanged();
 
 private:
     static inline std::pair<double, double> average(const std::pair<double, double>& prev, int sampleCount, const std::pair<double, double>& sample);
 
-    static inline std::vector<std::vector<std::pair<double, double>>> average(const std::vector<std::vector<std::pair<double, double>>>& prev, int sampleCount, const std::vector<std::vector<std::pair<double, double>>>& sample);
-
-    static inline std::vector<std::vector<double>> average(const std::vector<std::vector<double>>& prev, int sampleCount, const std::vector<std::vector<double>>& sample);
+    static void saveVelToFile(std::string name, const Field& velField);
 
-    static void saveVelToFile(std::string name, const std::vector<std::vector<std::pair<double, double>>>& velField);
+    // flow lines traced through velField from a 100 x 30 raster of seeds, drawn into the magnitude of a field of the same size
+    static Field flowLines(const Field& velField);
 
-    void plate(int w, int h, int reserveWidth, int steps, int barrierHeight, int barrierPos);
+    // replicas > 1 runs an ensemble, fields are then ensemble averages and need fewer temporal samples
+    void plate(int w, int h, int reserveWidth, int steps, int barrierHeight, int barrierPos, int replicas = 1);
 
     void wave(int w, int h, int originX, int originY, int radius);
 
     std::thread m_simThread;
-    std::atomic_bool m_stopThread = false;
 
-    std::vector<std::vector<double>> m_density;
-    std::vector<std::vector<double>> m_velMagnitude;
+    struct Command
+    {
+        enum Kind
+        {
+            Pause,
+            Resume,
+            Step,
+            Inflow,
+            SampleEvery,
+            Threads,
+            View, // the viewport changed, a paused session reduces the lattice again
+            Quit
+        };
+        Kind kind;
+        // steps of Step and SampleEvery, threads of Threads
+        int value = 0;
+        float left = 0;
+        float right = 0;
+    };
+    std::deque<Command> m_commands;
+    std::mutex m_commandMutex;
+    std::condition_variable m_commandAdded;
+    std::atomic_bool m_paused = false;
+
+    void post(const Command& command);
+    // ends the session, returns when its thread has
+    void quit();
+
+    Field m_density;
+    Field m_velMagnitude;
     std::mutex m_densityMutex;
     std::mutex m_velMagnitudeMutex;
+
+    struct Viewport
+    {
+        double x = 0;
+        double y = 0;
+        double width = 1;
+        double height = 1;
+        // 0 until the GUI reports its size, the whole domain is then shown at the default cell size
+        int pixelWidth = 0;
+        int pixelHeight = 0;
+    };
+    Viewport m_viewport;
+    std::mutex m_viewportMutex;
+
+    std::string m_publishName;
+    std::string m_attachName;
+    FrameRing m_attachedRing;
+    std::mutex m_attachMutex;
+
+    // reads the newest frame of the attached ring, density or velocity magnitude
+    Field attachedField(bool density);
 };
 
 #endif // SIMRUNNER_H
@@ -1,70 +1,288 @@
 #include "simulation.h"
+#include <algorithm>
 #include <bitset>
-#include <thread>
+#include <cmath>
 
-const std::array<std::array<uint8_t, 256>, 2> Simulation::collisionLUT = Simulation::generateCollisionLUT();
+const std::array<std::array<uint8_t, 256>, 2> Simulation::collisionLUT = Simulation::generateCollisionLUT(Simulation::Variant::FHP3);
+const Simulation::SiteMoments Simulation::siteMoments = Simulation::generateSiteMoments();
+const std::array<std::array<std::array<uint8_t, 256>, 2>, 3> Simulation::variantLUTs = {
+    Simulation::generateCollisionLUT(Simulation::Variant::FHP1),
+    Simulation::generateCollisionLUT(Simulation::Variant::FHP2),
+    Simulation::generateCollisionLUT(Simulation::Variant::FHP3)
+};
 
-Simulation::Simulation(int gridWidth, int gridHeight, int numThreads, const std::function<void(Simulation*)>& initialConditionsGenerator) :
+Simulation::Simulation(int gridWidth, int gridHeight, int numThreads, const std::function<void(Simulation*)>& initialConditionsGenerator, int replicas, const std::string& backingFile, uint32_t seed) :
     m_gridWidth(gridWidth),
     m_gridHeight(gridHeight),
     m_numThreads(numThreads),
-    m_grid()
+    m_replicas(1),
+    m_grid(),
+    m_streamTile(&Simulation::streamTileImpl<OpenBoundary, OpenBoundary>)
 {
-    std::vector<uint8_t> temp;
-    temp.assign(m_gridWidth, 0);
-    m_grid.assign(m_gridHeight, temp);
+    // continuing an ensemble, the file already holds the interleaved lanes
+    bool continued = replicas > 1 && !initialConditionsGenerator;
+    if (continued) m_grid = backingFile.empty() ? Lattice(m_gridWidth * replicas, m_gridHeight) : Lattice::mapFile(backingFile, m_gridWidth * replicas, m_gridHeight);
+    else if (replicas == 1 && !backingFile.empty()) m_grid = Lattice::mapFile(backingFile, m_gridWidth, m_gridHeight);
+    else m_grid = Lattice(m_gridWidth, m_gridHeight);
+    m_zeroRow.assign(m_gridWidth * replicas, 0);
 
-    std::random_device rd;
-    m_randGen = std::mt19937(rd());
+    seedReplica(seed, 0);
 
-    initialConditionsGenerator(this);
+    if (initialConditionsGenerator) initialConditionsGenerator(this);
+
+    if (continued) m_replicas = replicas;
+    else if (replicas > 1)
+    {
+        Lattice ensemble = backingFile.empty() ? Lattice(m_gridWidth * replicas, m_gridHeight) : Lattice::mapFile(backingFile, m_gridWidth * replicas, m_gridHeight);
+
+        for (int r = 0; r < replicas; r++)
+        {
+            if (r > 0)
+            {
+                std::fill(m_grid.data(), m_grid.data() + m_grid.size(), 0);
+                seedReplica(seed, r);
+                initialConditionsGenerator(this);
+            }
+            for (int y = 0; y < m_gridHeight; y++)
+            {
+                for (int x = 0; x < m_gridWidth; x++)
+                {
+                    ensemble[y][x * replicas + r] = m_grid[y][x];
+                }
+            }
+        }
+        m_grid = std::move(ensemble);
+        m_replicas = replicas;
+    }
+
+    // scratch lattice of the same kind, an out-of-core run keeps it in an unlinked file next to the lattice
+    if (m_grid.isMapped()) m_nextGrid = Lattice::mapFile(backingFile + ".next", m_gridWidth * m_replicas, m_gridHeight, true);
+    else m_nextGrid = Lattice(m_gridWidth * m_replicas, m_gridHeight);
+
+    refreshTiles();
+    setBandRows(0);
+}
+
+void Simulation::seedReplica(uint32_t seed, int replica)
+{
+    // a sequence instead of seed + replica, so neighbouring seeds don't share replicas
+    std::seed_seq sequence = { seed, uint32_t(replica) };
+    m_randGen.seed(sequence);
+}
+
+Simulation::~Simulation()
+{
+    syncBackingFile();
 }
 
 int Simulation::countColOccuppancy(int at) const
 {
     int count = 0;
-    for (const auto& row : m_grid)
+    for (int y = 0; y < m_gridHeight; y++)
+    {
+        for (int r = 0; r < m_replicas; r++)
+        {
+            count += std::bitset<8>(m_grid[y][column(at) * m_replicas + r] & 0b01111111).count();
+        }
+    }
+    return count;
+}
+
+int Simulation::countColOccuppancy(int at, int replica) const
+{
+    int count = 0;
+    for (int y = 0; y < m_gridHeight; y++)
     {
-        count += std::bitset<8>(row[at] & 0b01111111).count();
+        count += std::bitset<8>(m_grid[y][column(at) * m_replicas + replica] & 0b01111111).count();
     }
     return count;
 }
 
 void Simulation::spawnAtX(float concentration, int at, int width)
 {
-    int occupancy = 0;
-    for (int i = at; i < at + width; i++)
+    spawnRows(m_grid, concentration, at, width, 0, m_gridHeight, m_randGen, nullptr);
+}
+
+void Simulation::spawnRows(Lattice& grid, float concentration, int at, int width, int fromRow, int toRow, std::mt19937& randGen, const int* fluid)
+{
+    int height = toRow - fromRow;
+    std::uniform_int_distribution<> yDist(fromRow, toRow - 1);
+    // no rest particles in FHP-I
+    int channels = m_variant == Variant::FHP1 ? 6 : 7;
+    uint8_t channelBits = uint8_t((1 << channels) - 1);
+    std::uniform_int_distribution<> dirDist(0, channels - 1);
+    // particles per 7 channels like Field::Density, more than every free channel would never be reached
+    concentration = std::min(std::max(concentration, 0.f), channels / 7.f);
+
+    for (int r = 0; r < m_replicas; r++)
     {
-        occupancy = countColOccuppancy(i);
-        int wallcount = 0;
-        for(int y = 0; y < m_gridHeight; y++)
+        int occupancy = 0;
+        for (int i = at; i < at + width; i++)
         {
-            wallcount += (m_grid[y][i] & 0b10000000) >> 7;
+            int site = column(i) * m_replicas + r;
+            occupancy = 0;
+            int fluidSites = fluid ? fluid[(i - at) * m_replicas + r] : height;
+            for(int y = fromRow; y < toRow; y++)
+            {
+                occupancy += std::bitset<8>(grid[y][site] & channelBits).count();
+                if (!fluid) fluidSites -= grid[y][site] >> 7;
+            }
+            if (occupancy >= fluidSites * 7 * concentration) break;
+
+            int toSpawn = fluidSites * 7 * concentration - occupancy;
+
+            while (toSpawn > 0)
+            {
+                int y = yDist(randGen);
+                int dir = dirDist(randGen);
+                if (grid[y][site] & (1 << dir) || grid[y][site] & 0b10000000) continue;
+                grid[y][site] |= 1 << dir;
+                toSpawn--;
+            }
         }
-        // 7 possible particles
-        if (occupancy >= (m_gridHeight - wallcount) * 7 * concentration) return;
+    }
+}
 
-        int toSpawn = (m_gridHeight - wallcount) * 7 * concentration - occupancy;
+void Simulation::seedEquilibrium(const Field& field, int cellSizeX, int cellSizeY)
+{
+    if (!field.has(Field::Velocity) || !field.has(Field::Density)) throw "Simulation::seedEquilibrium field needs velocity and density";
+    if (field.width() * cellSizeX < m_gridWidth || field.height() * cellSizeY < m_gridHeight) throw "Simulation::seedEquilibrium field doesn't cover the grid";
 
-        std::uniform_int_distribution<> yDist(0, m_gridHeight - 1);
-        std::uniform_int_distribution<> dirDist(0, 6);
+    // thresholds for a 32 bit random number, one Newton solve per cell
+    bool rest = m_variant != Variant::FHP1;
+    std::vector<std::array<uint32_t, 7>> thresholds(field.size());
+    TileScheduler(field.width(), field.height(), 64, 8).run(m_numThreads, [&](const TileScheduler::Tile& tile)
+    {
+        for (int i = tile.y0; i < tile.y1; i++)
+        {
+            for (int j = tile.x0; j < tile.x1; j++)
+            {
+                size_t c = field.at(j, i);
+                std::array<double, 7> occupation = equilibrium(field.density()[c], field.vx()[c], field.vy()[c], rest);
+                for (int k = 0; k < 7; k++)
+                {
+                    thresholds[c][k] = uint32_t(std::min(occupation[k] * 4294967296., 4294967295.));
+                }
+            }
+        }
+    });
 
-        while (toSpawn > 0)
+    uint32_t seed = m_randGen();
+    TileScheduler(1, m_gridHeight, 1, 8).run(m_numThreads, [&](const TileScheduler::Tile& tile)
+    {
+        for (int y = tile.y0; y < tile.y1; y++)
         {
-            int y = yDist(m_randGen);
-            int dir = dirDist(m_randGen);
-            if (m_grid[y][i] & (1 << dir) || m_grid[y][i] & 0b10000000) continue;
-            m_grid[y][i] |= 1 << dir;
-            toSpawn--;
+            // per row, so the result doesn't depend on the threads
+            std::mt19937 randGen(seed + uint32_t(y) * 0x9E3779B9u);
+            uint8_t* row = m_grid[y].data();
+            const std::array<uint32_t, 7>* cells = thresholds.data() + field.at(0, y / cellSizeY);
+            for (int x = 0; x < m_gridWidth; x++)
+            {
+                const std::array<uint32_t, 7>& threshold = cells[x / cellSizeX];
+                for (int r = 0; r < m_replicas; r++)
+                {
+                    uint8_t& site = row[column(x) * m_replicas + r];
+                    if (site & 0b10000000)
+                    {
+                        site = 0b10000000;
+                        continue;
+                    }
+                    uint8_t value = 0;
+                    for (int k = 0; k < 7; k++)
+                    {
+                        if (randGen() < threshold[k]) value |= 1 << k;
+                    }
+                    site = value;
+                }
+            }
         }
+    });
+}
+
+std::array<double, 7> Simulation::equilibrium(double density, double vx, double vy, bool restParticles)
+{
+    // unit velocities of the directions, vx/vy of siteMoments, the rest particle doesn't move
+    const double cx[7] = { -0.5, 0.5, 1, 0.5, -0.5, -1, 0 };
+    const double cy[7] = { 0.8660254, 0.8660254, 0, -0.8660254, -0.8660254, 0, 0 };
+    int channels = restParticles ? 7 : 6;
+    double mass = std::clamp(density * 7, 1e-6, channels - 1e-6);
+
+    std::array<double, 7> occupation = {};
+    for (int attempt = 0; attempt < 20; attempt++)
+    {
+        double jx = mass * vx;
+        double jy = mass * vy;
+        // the resting distribution as the start
+        double h = std::log(channels / mass - 1);
+        double qx = 0;
+        double qy = 0;
+        bool converged = false;
+        for (int iteration = 0; iteration < 50 && !converged; iteration++)
+        {
+            // residual r and Jacobian -sum w (1, cx, cy)^T (1, cx, cy)
+            double r[3] = { -mass, -jx, -jy };
+            double a[3][3] = {};
+            for (int k = 0; k < channels; k++)
+            {
+                double f = 1 / (1 + std::exp(h + qx * cx[k] + qy * cy[k]));
+                occupation[k] = f;
+                double basis[3] = { 1, cx[k], cy[k] };
+                for (int m = 0; m < 3; m++)
+                {
+                    r[m] += f * basis[m];
+                    for (int n = 0; n < 3; n++) a[m][n] -= f * (1 - f) * basis[m] * basis[n];
+                }
+            }
+            if (std::fabs(r[0]) + std::fabs(r[1]) + std::fabs(r[2]) < 1e-12 * channels)
+            {
+                converged = true;
+                break;
+            }
+
+            // a d = -r by Cramer's rule
+            auto det = [](double m[3][3])
+            {
+                return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+            };
+            double d = det(a);
+            if (d == 0 || !std::isfinite(d)) break;
+            double step[3];
+            for (int n = 0; n < 3; n++)
+            {
+                double b[3][3];
+                for (int m = 0; m < 3; m++)
+                {
+                    for (int l = 0; l < 3; l++) b[m][l] = l == n ? -r[m] : a[m][l];
+                }
+                step[n] = det(b) / d;
+            }
+            // damped, far from the solution a full step overshoots the logistic
+            double length = std::fabs(step[0]) + std::fabs(step[1]) + std::fabs(step[2]);
+            double scale = length > 2 ? 2 / length : 1;
+            h += scale * step[0];
+            qx += scale * step[1];
+            qy += scale * step[2];
+        }
+        if (converged) return occupation;
+        vx /= 2;
+        vy /= 2;
     }
+    // no momentum at all is always possible
+    occupation.fill(mass / channels);
+    if (!restParticles) occupation[6] = 0;
+    return occupation;
 }
 
-std::vector<std::vector<uint8_t>>& Simulation::getGrid()
+Lattice& Simulation::getGrid()
 {
     return m_grid;
 }
 
+int Simulation::getReplicas() const
+{
+    return m_replicas;
+}
+
 std::pair<int, int> Simulation::getRegionVelocity(int fromX, int toX, int fromY, int toY)
 {
     int vx = 0;
@@ -79,8 +297,9 @@ std::pair<int, int> Simulation::getRegionVelocity(int fromX, int toX, int fromY,
     */
     for (int y = fromY; y < toY; y++)
     {
-        for (int x = fromX; x < toX; x++)
+        for (int i = fromX * m_replicas; i < toX * m_replicas; i++)
         {
+            int x = column(i / m_replicas) * m_replicas + i % m_replicas;
             vx = vx - (m_grid[y][x] & 0b00000001) - ((m_grid[y][x] & 0b00010000) >> 4) // -1/2
                 + ((m_grid[y][x] & 0b00000010) >> 1) + ((m_grid[y][x] & 0b00001000) >> 3) // 1/2
                 + ((m_grid[y][x] & 0b00000100) >> 1) - ((m_grid[y][x] & 0b00100000) >> 4); // +/- 1 (moved to 2nd place)
@@ -100,8 +319,9 @@ std::pair<double, double> Simulation::getRegionAverageVelocity(int fromX, int to
 
     for (int y = fromY; y < toY; y++)
     {
-        for (int x = fromX; x < toX; x++)
+        for (int i = fromX * m_replicas; i < toX * m_replicas; i++)
         {
+            int x = column(i / m_replicas) * m_replicas + i % m_replicas;
             vx = vx - (m_grid[y][x] & 0b00000001) - ((m_grid[y][x] & 0b00010000) >> 4) // -1/2
                 + ((m_grid[y][x] & 0b00000010) >> 1) + ((m_grid[y][x] & 0b00001000) >> 3) // 1/2
                 + ((m_grid[y][x] & 0b00000100) >> 1) - ((m_grid[y][x] & 0b00100000) >> 4); // +/- 1 (moved to 2nd place)
@@ -113,556 +333,899 @@ std::pair<double, double> Simulation::getRegionAverageVelocity(int fromX, int to
     return { count != 0 ? (double(vx) / 2.) / count : 0, count != 0 ? (double(vy) * 0.8660254) / count : 0 };
 }
 
-std::vector<std::vector<std::pair<double, double>>> Simulation::getVelocityField(int cellSizeX, int cellSizeY)
+Field Simulation::getField(int cellSizeX, int cellSizeY, int channels)
 {
-    if (m_gridHeight % cellSizeY != 0 || m_gridWidth % cellSizeX != 0) throw "Simulation::getVelocityField grid size non-divisible by cellSize";
+    if (m_gridHeight % cellSizeY != 0 || m_gridWidth % cellSizeX != 0) throw "Simulation::getField grid size non-divisible by cellSize";
+    return getRegionField(0, 0, m_gridWidth, m_gridHeight, cellSizeX, cellSizeY, channels);
+}
 
-    std::vector<std::vector<std::pair<double, double>>> velField;
+Field Simulation::getRegionField(int x0, int y0, int x1, int y1, int cellSizeX, int cellSizeY, int channels, int maxSamples)
+{
+    if (cellSizeX < 1 || cellSizeY < 1) throw "Simulation::getRegionField bad cell size";
+    x0 = std::max(x0, 0);
+    y0 = std::max(y0, 0);
+    x1 = std::min(x1, m_gridWidth);
+    y1 = std::min(y1, m_gridHeight);
+    if (x1 <= x0 || y1 <= y0) return Field(0, 0, channels);
 
-    for (int y = 0; y < m_gridHeight / cellSizeY; y++)
+    // coarser sub-grid in the longer direction first, so the samples stay spread over the whole cell
+    int strideX = 1;
+    int strideY = 1;
+    while (maxSamples > 0 && ((cellSizeX + strideX - 1) / strideX) * ((cellSizeY + strideY - 1) / strideY) > maxSamples)
     {
-        velField.push_back(std::vector<std::pair<double, double>>());
-        for (int x = 0; x < m_gridWidth / cellSizeX; x++)
+        if ((cellSizeX + strideX - 1) / strideX >= (cellSizeY + strideY - 1) / strideY) strideX++;
+        else strideY++;
+    }
+
+    int cellsX = (x1 - x0 + cellSizeX - 1) / cellSizeX;
+    int cellsY = (y1 - y0 + cellSizeY - 1) / cellSizeY;
+    Field field(cellsX, cellsY, channels);
+    // momentum per site, vorticity is differentiated from it
+    std::vector<float> momentumX(channels & Field::Vorticity ? field.size() : 0);
+    std::vector<float> momentumY(momentumX.size());
+
+    cellTiles(cellsX, cellsY, cellSizeX, cellSizeY).run(m_numThreads, [&](const TileScheduler::Tile& tile)
+    {
+        int cells = tile.x1 - tile.x0;
+        std::vector<int> vx(cells), vy(cells), count(cells), sites(cells);
+        for (int i = tile.y0; i < tile.y1; i++)
         {
-            velField[y].push_back(getRegionAverageVelocity(cellSizeX * x, cellSizeX * (x + 1), cellSizeY * y, cellSizeY * (y + 1)));
+            vx.assign(cells, 0);
+            vy.assign(cells, 0);
+            count.assign(cells, 0);
+            sites.assign(cells, 0);
+            // rows of the cell row one after another, so the grid is read front to back
+            for (int y = y0 + cellSizeY * i; y < std::min(y0 + cellSizeY * (i + 1), y1); y += strideY)
+            {
+                const uint8_t* row = m_grid[y].data();
+                for (int j = 0; j < cells; j++)
+                {
+                    int from = x0 + cellSizeX * (tile.x0 + j);
+                    int to = std::min(from + cellSizeX, x1);
+                    if (strideX == 1)
+                    {
+                        // at most two runs of stored columns, the second one after the seam of a moving window
+                        int first = column(from);
+                        int run = std::min(to - from, m_gridWidth - first);
+                        for (auto range : { std::make_pair(first, first + run), std::make_pair(0, to - from - run) })
+                        {
+                            for (int x = range.first * m_replicas; x < range.second * m_replicas; x++)
+                            {
+                                uint8_t value = row[x];
+                                vx[j] += siteMoments.vx[value];
+                                vy[j] += siteMoments.vy[value];
+                                count[j] += siteMoments.count[value];
+                            }
+                        }
+                        sites[j] += (to - from) * m_replicas;
+                        continue;
+                    }
+                    for (int x = from; x < to; x += strideX)
+                    {
+                        for (int r = 0; r < m_replicas; r++)
+                        {
+                            uint8_t value = row[column(x) * m_replicas + r];
+                            vx[j] += siteMoments.vx[value];
+                            vy[j] += siteMoments.vy[value];
+                            count[j] += siteMoments.count[value];
+                        }
+                        sites[j] += m_replicas;
+                    }
+                }
+            }
+
+            for (int j = 0; j < cells; j++)
+            {
+                size_t c = field.at(tile.x0 + j, i);
+                double cellVx = count[j] != 0 ? (double(vx[j]) / 2.) / count[j] : 0;
+                double cellVy = count[j] != 0 ? (double(vy[j]) * 0.8660254) / count[j] : 0;
+                if (field.has(Field::Velocity))
+                {
+                    field.vx()[c] = float(cellVx);
+                    field.vy()[c] = float(cellVy);
+                }
+                if (channels & Field::Density) field.density()[c] = float(double(count[j]) / (double(sites[j]) * 7));
+                if (channels & Field::Magnitude) field.magnitude()[c] = float(sqrt(cellVx * cellVx + cellVy * cellVy));
+                if (channels & Field::Sums)
+                {
+                    field.sumVx()[c] = vx[j];
+                    field.sumVy()[c] = vy[j];
+                    field.count()[c] = count[j];
+                }
+                if (channels & Field::Vorticity)
+                {
+                    momentumX[c] = float((double(vx[j]) / 2.) / sites[j]);
+                    momentumY[c] = float((double(vy[j]) * 0.8660254) / sites[j]);
+                }
+            }
         }
-    }
+    });
+    if (channels & Field::Vorticity) field.computeVorticity(momentumX.data(), momentumY.data(), cellSizeX, cellSizeY);
+    return field;
+}
+
+Field Simulation::getVelocityField(int cellSizeX, int cellSizeY)
+{
+    return getField(cellSizeX, cellSizeY, Field::Velocity);
+}
+
+Field Simulation::getVelocityMagnitudeAndDensityField(int cellSizeX, int cellSizeY)
+{
+    return getField(cellSizeX, cellSizeY, Field::Magnitude | Field::Density);
+}
 
-    return velField;
+Field Simulation::getVelocityAndDensityField(int cellSizeX, int cellSizeY)
+{
+    return getField(cellSizeX, cellSizeY, Field::Velocity | Field::Density);
 }
 
-std::pair<std::vector<std::vector<double>>, std::vector<std::vector<double>>> Simulation::getVelocityMagnitudeAndDensityField(int cellSizeX, int cellSizeY)
+FieldPyramid Simulation::getFieldPyramid(int numLevels)
 {
-    std::vector<std::vector<double>> vmField;
-    std::vector<std::vector<double>> densityField;
-    std::vector<double> t;
-    t.assign(m_gridWidth/cellSizeX, 0.);
-    vmField.assign(m_gridHeight/cellSizeY, t);
-    densityField.assign(m_gridHeight/cellSizeY, t);
+    FieldPyramid::Level base;
+    base.cellSize = 2;
+    base.width = (m_gridWidth + 1) / 2;
+    base.height = (m_gridHeight + 1) / 2;
+    base.vx.assign(base.width * base.height, 0);
+    base.vy.assign(base.width * base.height, 0);
+    base.count.assign(base.width * base.height, 0);
+    base.sites.assign(base.width * base.height, 0);
 
-    runThreaded([&](int threadNo)
+    // only the finest level touches the grid
+    cellTiles(base.width, base.height, 2, 2).run(m_numThreads, [&](const TileScheduler::Tile& tile)
     {
-        int n = m_gridHeight / cellSizeY / m_numThreads;
-        for (int i = n*threadNo; i < n*(threadNo+1); i++)
+        for (int i = tile.y0; i < tile.y1; i++)
         {
-            for (int j = 0; j < m_gridWidth / cellSizeX; j++)
+            int* vx = base.vx.data() + i * base.width;
+            int* vy = base.vy.data() + i * base.width;
+            int* count = base.count.data() + i * base.width;
+            int* sites = base.sites.data() + i * base.width;
+            for (int y = 2 * i; y < std::min(2 * i + 2, m_gridHeight); y++)
             {
-                int vx = 0;
-                int vy = 0;
-                int count = 0;
-
-                for (int y = cellSizeY * i; y < cellSizeY * (i+1); y++)
+                const uint8_t* row = m_grid[y].data();
+                for (int x = 2 * tile.x0; x < std::min(2 * tile.x1, m_gridWidth); x++)
                 {
-                    for (int x = cellSizeX * j; x < cellSizeX * (j+1); x++)
+                    int j = x / 2;
+                    for (int r = 0; r < m_replicas; r++)
                     {
-                        vx = vx - (m_grid[y][x] & 0b00000001) - ((m_grid[y][x] & 0b00010000) >> 4) // -1/2
-                            + ((m_grid[y][x] & 0b00000010) >> 1) + ((m_grid[y][x] & 0b00001000) >> 3) // 1/2
-                            + ((m_grid[y][x] & 0b00000100) >> 1) - ((m_grid[y][x] & 0b00100000) >> 4); // +/- 1 (moved to 2nd place)
-                        vy = vy + (m_grid[y][x] & 0b00000001) + ((m_grid[y][x] & 0b00000010) >> 1) // sqrt(3)/2
-                            - ((m_grid[y][x] & 0b00001000) >> 3) - ((m_grid[y][x] & 0b00010000) >> 4); // -sqrt(3)/2
-                        count += std::bitset<8>(m_grid[y][x] & 0b01111111).count();
+                        uint8_t value = row[x * m_replicas + r];
+                        vx[j] += siteMoments.vx[value];
+                        vy[j] += siteMoments.vy[value];
+                        count[j] += siteMoments.count[value];
                     }
+                    sites[j] += m_replicas;
                 }
-                if(count != 0)
-                    vmField[i][j] = sqrt(pow((double(vx) / 2.) / count, 2) +  pow((double(vy) * 0.8660254) / count, 2));
-                else
-                    vmField[i][j] = 0;
-                densityField[i][j] = double(count) / double(cellSizeX*cellSizeY*7);
             }
         }
     });
-    return {vmField, densityField};
+
+    return FieldPyramid(std::move(base), numLevels);
+}
+
+void Simulation::moveStep()
+{
+    streamBands(false);
+}
+
+void Simulation::step()
+{
+    streamBands(true);
+    recordObstacleForces(m_obstacleMomentum.data());
+    m_time++;
 }
 
-std::pair<std::vector<std::vector<std::pair<double, double> > >, std::vector<std::vector<double> > > Simulation::getVelocityAndDensityField(int cellSizeX, int cellSizeY)
+void Simulation::setInflow(const std::vector<Inflow>& inflow)
 {
-    std::vector<std::vector<std::pair<double, double>>> vField;
-    std::vector<std::vector<double>> densityField;
-    std::vector<double> t;
-    t.assign(m_gridWidth/cellSizeX, 0.);
-    densityField.assign(m_gridHeight/cellSizeY, t);
-    std::vector<std::pair<double, double>> t2;
-    t2.assign(m_gridWidth/cellSizeX, {0., 0.});
-    vField.assign(m_gridHeight/cellSizeY, t2);
+    m_inflow = inflow;
+    countInflowFluid();
+}
 
-    runThreaded([&](int threadNo)
+void Simulation::countInflowFluid()
+{
+    const std::vector<TileScheduler::Tile>& tiles = m_tiles.getTiles();
+    m_inflowFluid.assign(m_inflow.size(), std::vector<int>());
+    for (size_t k = 0; k < m_inflow.size(); k++)
     {
-        int n = m_gridHeight / cellSizeY / m_numThreads;
-        for (int i = n*threadNo; i < n*(threadNo+1); i++)
+        const Inflow& inflow = m_inflow[k];
+        for (size_t i = 0; i < tiles.size(); i++)
         {
-            for (int j = 0; j < m_gridWidth / cellSizeX; j++)
+            // once per band, from its first tile
+            if (i > 0 && tiles[i].y0 == tiles[i - 1].y0) continue;
+            for (int x = inflow.at; x < inflow.at + inflow.width; x++)
             {
-                int vx = 0;
-                int vy = 0;
-                int count = 0;
-
-                for (int y = cellSizeY * i; y < cellSizeY * (i+1); y++)
+                for (int r = 0; r < m_replicas; r++)
                 {
-                    for (int x = cellSizeX * j; x < cellSizeX * (j+1); x++)
+                    int count = 0;
+                    for (int y = tiles[i].y0; y < tiles[i].y1; y++)
                     {
-                        vx = vx - (m_grid[y][x] & 0b00000001) - ((m_grid[y][x] & 0b00010000) >> 4) // -1/2
-                            + ((m_grid[y][x] & 0b00000010) >> 1) + ((m_grid[y][x] & 0b00001000) >> 3) // 1/2
-                            + ((m_grid[y][x] & 0b00000100) >> 1) - ((m_grid[y][x] & 0b00100000) >> 4); // +/- 1 (moved to 2nd place)
-                        vy = vy + (m_grid[y][x] & 0b00000001) + ((m_grid[y][x] & 0b00000010) >> 1) // sqrt(3)/2
-                            - ((m_grid[y][x] & 0b00001000) >> 3) - ((m_grid[y][x] & 0b00010000) >> 4); // -sqrt(3)/2
-                        count += std::bitset<8>(m_grid[y][x] & 0b01111111).count();
+                        count += !(m_grid[y][column(x) * m_replicas + r] & 0b10000000);
                     }
+                    m_inflowFluid[k].push_back(count);
                 }
-                vField[i][j] = { count != 0 ? (double(vx) / 2.) / count : 0, count != 0 ? (double(vy) * 0.8660254) / count : 0 };
-                densityField[i][j] = double(count) / double(cellSizeX*cellSizeY*7);
             }
         }
-    });
-    return {vField, densityField};
+    }
 }
 
-void Simulation::moveStep()
+void Simulation::advance(int steps, const std::function<void(const Lattice& grid, int fromRow, int toRow, uint64_t time)>& bandDone)
 {
-    std::vector<std::vector<uint8_t>> tempGrid;
-    std::vector<uint8_t> temp;
-    temp.assign(m_gridWidth, 0);
-    tempGrid.assign(m_gridHeight, temp);
+    if (steps <= 0) return;
+
+    // a band is one row of tiles, tiles are row-major so its tiles are contiguous
+    const std::vector<TileScheduler::Tile>& tiles = m_tiles.getTiles();
+    std::vector<int> bandTiles(1, 0);
+    for (int i = 1; i <= int(tiles.size()); i++)
+    {
+        if (i == int(tiles.size()) || tiles[i].y0 != tiles[i - 1].y0) bandTiles.push_back(i);
+    }
+    int numBands = int(bandTiles.size()) - 1;
+
+    // everything random is drawn up front, in the same order every run
+    std::vector<int> shifts(steps);
+    for (auto& shift : shifts)
+    {
+        shift = nextChiralityShift();
+    }
+    if (int(m_bandRandGens.size()) != numBands)
+    {
+        m_bandRandGens.clear();
+        for (int band = 0; band < numBands; band++)
+        {
+            m_bandRandGens.push_back(std::mt19937(m_randGen()));
+        }
+    }
+    // steps of different bands run at the same time, every step gets its own momentum sums
+    int labels = getNumObstacles();
+    std::vector<std::atomic<long long>> obstacleMomentum(size_t(steps) * 2 * labels);
 
-    runThreaded([this, &tempGrid](int i) {
-        int to = i != m_numThreads - 1 ? (m_gridHeight / m_numThreads) * (i + 1) : m_gridHeight;
-        for (int y = (m_gridHeight / m_numThreads) * i; y < to; y++)
+    Lattice* lattices[2] = { &m_grid, &m_nextGrid };
+    TaskGraph(numBands, m_yBoundary == Boundary::Periodic).run(m_numThreads, steps, [&](int band, int step)
+    {
+        const Lattice& grid = *lattices[step & 1];
+        Lattice& next = *lattices[(step + 1) & 1];
+        for (int i = bandTiles[band]; i < bandTiles[band + 1]; i++)
         {
-            moveRow(y, tempGrid);
+            (this->*m_streamTile)(grid, next, tiles[i]);
+            collideTile(next, tiles[i], shifts[step], m_time + step, obstacleMomentum.data() + size_t(step) * 2 * labels);
         }
+
+        int fromRow = tiles[bandTiles[band]].y0;
+        int toRow = tiles[bandTiles[band]].y1;
+        for (size_t k = 0; k < m_inflow.size(); k++)
+        {
+            const Inflow& inflow = m_inflow[k];
+            const int* fluid = m_inflowFluid[k].data() + size_t(band) * inflow.width * m_replicas;
+            spawnRows(next, inflow.concentration, inflow.at, inflow.width, fromRow, toRow, m_bandRandGens[band], fluid);
+        }
+        if (bandDone) bandDone(next, fromRow, toRow, m_time + step + 1);
     });
 
-    m_grid.swap(tempGrid);
+    if (steps & 1)
+    {
+        m_grid.swap(m_nextGrid);
+        m_gridIsPrimary = !m_gridIsPrimary;
+    }
+    for (int step = 0; step < steps; step++)
+    {
+        recordObstacleForces(obstacleMomentum.data() + size_t(step) * 2 * labels);
+    }
+    m_time += steps;
 }
 
-void Simulation::colissionStep()
+void Simulation::syncBackingFile()
+{
+    if (!m_grid.isMapped()) return;
+    restorePrimaryGrid();
+    m_grid.flush(0, m_gridHeight, true);
+}
+
+void Simulation::restorePrimaryGrid()
+{
+    if (m_gridIsPrimary) return;
+    m_nextGrid.copyFrom(m_grid);
+    m_grid.swap(m_nextGrid);
+    m_gridIsPrimary = true;
+}
+
+void Simulation::setBandRows(int rows)
 {
-    std::uniform_int_distribution<> which(0, 1);
+    // in memory everything is one band, files get bands of about 64MB
+    if (rows <= 0) rows = m_grid.isMapped() ? (64 << 20) / std::max(1, m_gridWidth * m_replicas) : m_gridHeight;
+    m_bandRows = std::max(1, (rows + m_tileHeight - 1) / m_tileHeight) * m_tileHeight;
+}
+
+/* we are looking at the incoming, instead of outgoing so that 1 run only acceses 1 row,
+so it can be parallelised, see streamRow in boundaries.h
+rows on the top and bottom edge get a ghost neighbour from YBoundary,
+sites on the left and right edge are resolved by XBoundary */
+template<class XBoundary, class YBoundary>
+void Simulation::streamTileImpl(const Lattice& grid, Lattice& next, const TileScheduler::Tile& tile)
+{
+    const uint8_t* above = YBoundary::ghostRow(grid[m_gridHeight - 1].data(), m_zeroRow.data());
+    const uint8_t* below = YBoundary::ghostRow(grid[0].data(), m_zeroRow.data());
+    int from = tile.x0 * m_replicas;
+    int length = (tile.x1 - tile.x0) * m_replicas;
+    for (int y = tile.y0; y < tile.y1; y++)
+    {
+        const uint8_t* up = y > 0 ? grid[y - 1].data() : above;
+        const uint8_t* down = y < m_gridHeight - 1 ? grid[y + 1].data() : below;
+        streamRow<XBoundary>(up, grid[y].data(), down, next[y].data(), m_gridWidth, y % 2 == 0, m_replicas, tile.x0, tile.x1);
+        if (m_xOrigin != 0) streamSeam(up, grid[y].data(), down, next[y].data(), y % 2 == 0, tile.x0, tile.x1);
+        if (y == 0) YBoundary::fixTopRow(next[y].data() + from, grid[y].data() + from, length);
+        if (y == m_gridHeight - 1) YBoundary::fixBottomRow(next[y].data() + from, grid[y].data() + from, length);
+    }
+}
+
+/* the rows are done in bands, while a band is streamed the next one is prefetched and
+finished ones are written back, so a backing file is read and written once per step in order */
+void Simulation::streamBands(bool collide)
+{
+    int shift = collide ? nextChiralityShift() : 0;
+
+    auto streamTile = [this, collide, shift](const TileScheduler::Tile& tile) {
+        (this->*m_streamTile)(m_grid, m_nextGrid, tile);
+        if (collide) collideTile(m_nextGrid, tile, shift, m_time, m_obstacleMomentum.data());
+    };
+
+    for (int band = 0; band < m_gridHeight; band += m_bandRows)
+    {
+        int bandEnd = std::min(band + m_bandRows, m_gridHeight);
+        m_grid.willNeed(bandEnd, bandEnd + m_bandRows + 1);
+        m_nextGrid.willNeed(bandEnd, bandEnd + m_bandRows);
+
+        m_tiles.run(m_numThreads, streamTile, band, bandEnd);
 
-    runThreaded([this, &which](int i) {
-        int to = i != m_numThreads - 1 ? (m_gridHeight / m_numThreads) * (i + 1) : m_gridHeight;
-        for (int y = (m_gridHeight / m_numThreads) * i; y < to; y++)
+        m_nextGrid.flush(band, bandEnd, false);
+        m_nextGrid.dontNeed(band, bandEnd);
+        // the next band still reads the last row of this one
+        m_grid.dontNeed(band - 1, bandEnd - 1);
+    }
+
+    m_grid.swap(m_nextGrid);
+    m_gridIsPrimary = !m_gridIsPrimary;
+}
+
+template<class XBoundary>
+void (Simulation::*Simulation::streamTileFor(Boundary y))(const Lattice& grid, Lattice& next, const TileScheduler::Tile& tile)
+{
+    switch (y)
+    {
+    case Boundary::Periodic: return &Simulation::streamTileImpl<XBoundary, PeriodicBoundary>;
+    case Boundary::BounceBack: return &Simulation::streamTileImpl<XBoundary, BounceBackBoundary>;
+    default: return &Simulation::streamTileImpl<XBoundary, OpenBoundary>;
+    }
+}
+
+void Simulation::setBoundaries(Boundary x, Boundary y)
+{
+    if (y == Boundary::Periodic && m_gridHeight % 2 != 0) throw "Simulation::setBoundaries periodic y needs even grid height";
+
+    if (x != Boundary::Open && m_xOrigin != 0) throw "Simulation::setBoundaries a moving window needs open x";
+
+    m_xBoundary = x;
+    m_yBoundary = y;
+    selectStreamKernel();
+}
+
+void Simulation::selectStreamKernel()
+{
+    // a shifted window wraps around the stored columns, its seam is fixed up by streamSeam
+    Boundary x = m_xOrigin != 0 ? Boundary::Periodic : m_xBoundary;
+    switch (x)
+    {
+    case Boundary::Periodic: m_streamTile = streamTileFor<PeriodicBoundary>(m_yBoundary); break;
+    case Boundary::BounceBack: m_streamTile = streamTileFor<BounceBackBoundary>(m_yBoundary); break;
+    default: m_streamTile = streamTileFor<OpenBoundary>(m_yBoundary); break;
+    }
+}
+
+void Simulation::streamSeam(const uint8_t* up, const uint8_t* row, const uint8_t* down, uint8_t* out, bool evenRow, int fromX, int toX)
+{
+    // the first and last window column again, as open edges of a two column row
+    int last = (m_xOrigin + m_gridWidth - 1) % m_gridWidth;
+    for (int edge = 0; edge < 2; edge++)
+    {
+        int stored = edge == 0 ? m_xOrigin : last;
+        if (stored < fromX || stored >= toX) continue;
+        int columns[2] = { edge == 0 ? m_xOrigin : (last + m_gridWidth - 1) % m_gridWidth, edge == 0 ? (m_xOrigin + 1) % m_gridWidth : last };
+        for (int r = 0; r < m_replicas; r++)
         {
-            for (auto& value : m_grid[y])
+            uint8_t pairUp[2], pairRow[2], pairDown[2];
+            for (int i = 0; i < 2; i++)
             {
-                // don't generate random if not needed, it is way faster
-                value = collisionLUT[collisionLUT[0][value] == collisionLUT[1][value] ? 0 : which(m_randGen)][value];
+                pairUp[i] = up[columns[i] * m_replicas + r];
+                pairRow[i] = row[columns[i] * m_replicas + r];
+                pairDown[i] = down[columns[i] * m_replicas + r];
             }
+            out[stored * m_replicas + r] = streamEdgeSite<OpenBoundary>(pairUp, pairRow, pairDown, 2, 1, evenRow, edge, 0);
         }
+    }
+}
+
+void Simulation::shiftWindow(int columns, double density, double vx, double vy, const std::function<bool(int64_t x, int y)>& wall)
+{
+    if (columns <= 0) return;
+    if (m_xBoundary != Boundary::Open) throw "Simulation::shiftWindow needs open x boundaries";
+    if (m_gridWidth < 2) throw "Simulation::shiftWindow grid too narrow";
+
+    // further than the window is wide every column is new, only the offset keeps counting
+    int recycled = std::min(columns, m_gridWidth);
+    m_xOrigin = int((m_xOrigin + int64_t(columns)) % m_gridWidth);
+    m_windowOffset += columns;
+
+    std::array<double, 7> occupation = equilibrium(density, vx, vy, m_variant != Variant::FHP1);
+    std::array<uint32_t, 7> threshold;
+    for (int k = 0; k < 7; k++)
+    {
+        threshold[k] = uint32_t(std::min(occupation[k] * 4294967296., 4294967295.));
+    }
+    bool wallsChanged = false;
+    for (int x = m_gridWidth - recycled; x < m_gridWidth; x++)
+    {
+        int stored = column(x);
+        for (int y = 0; y < m_gridHeight; y++)
+        {
+            bool isWall = wall && wall(m_windowOffset + x, y);
+            for (int r = 0; r < m_replicas; r++)
+            {
+                uint8_t& site = m_grid[y][stored * m_replicas + r];
+                wallsChanged = wallsChanged || isWall != bool(site & 0b10000000);
+                uint8_t value = isWall ? 0b10000000 : 0;
+                for (int k = 0; k < 7 && !isWall; k++)
+                {
+                    if (m_randGen() < threshold[k]) value |= 1 << k;
+                }
+                site = value;
+            }
+        }
+    }
+
+    // obstacle sites in the recycled columns are gone, new walls are plain walls
+    for (auto& sites : m_obstacleRows)
+    {
+        sites.erase(std::remove_if(sites.begin(), sites.end(), [&](const std::pair<int, int>& site)
+        {
+            return (site.first - m_xOrigin + m_gridWidth) % m_gridWidth >= m_gridWidth - recycled;
+        }), sites.end());
+    }
+    if (wallsChanged) refreshTiles();
+    // the window moved, the inflow columns are other stored columns now
+    else countInflowFluid();
+    selectStreamKernel();
+}
+
+int Simulation::getWindowOrigin() const
+{
+    return m_xOrigin;
+}
+
+int64_t Simulation::getWindowOffset() const
+{
+    return m_windowOffset;
+}
+
+Simulation::Boundary Simulation::getXBoundary() const
+{
+    return m_xBoundary;
+}
+
+Simulation::Boundary Simulation::getYBoundary() const
+{
+    return m_yBoundary;
+}
+
+void Simulation::setVariant(Variant variant)
+{
+    m_variant = variant;
+    m_collisionLUT = &variantLUTs[int(variant)];
+}
+
+Simulation::Variant Simulation::getVariant() const
+{
+    return m_variant;
+}
+
+void Simulation::colissionStep()
+{
+    int shift = nextChiralityShift();
+    m_tiles.run(m_numThreads, [this, shift](const TileScheduler::Tile& tile) {
+        collideTile(m_grid, tile, shift, m_time, m_obstacleMomentum.data());
     });
+    recordObstacleForces(m_obstacleMomentum.data());
+    m_time++;
+}
+
+int Simulation::nextChiralityShift()
+{
+    if (m_collisionMode != CollisionMode::RandomPlane) return 0;
+    // only one random number per step, rows read the plane at different shifted offsets
+    int range = int(m_chiralityPlane.size()) - m_gridWidth * m_replicas;
+    return std::uniform_int_distribution<>(0, range - 1)(m_randGen);
 }
 
-/* optimized to eliminate almost all bound checks(it's faster)
-we are looking at the incoming, instead of outgoing so that 1 run only acceses 1 row,
-so it can be parallelised
-basically it does:
-
-if (y % 2 == 0)
-    for (int x = 0; x < m_gridWidth; x++)
-        tempGrid[y][x] = m_grid[y][x] & 0b11000000;
-        tempGrid[y][x] |= m_grid[y + 1][x + 1] & 0b00000001;
-        tempGrid[y][x] |= m_grid[y + 1][x] & 0b00000010;
-        tempGrid[y][x] |= m_grid[y][x - 1] & 0b00000100;
-        tempGrid[y][x] |= m_grid[y - 1][x] & 0b00001000;
-        tempGrid[y][x] |= m_grid[y - 1][x + 1] & 0b00010000;
-        tempGrid[y][x] |= m_grid[y][x + 1] & 0b00100000;
-else
-    for (int x = 0; x < m_gridWidth; x++)
-        tempGrid[y][x] = m_grid[y][x] & 0b11000000;
-        tempGrid[y][x] |= m_grid[y + 1][x] & 0b00000001;
-        tempGrid[y][x] |= m_grid[y + 1][x - 1] & 0b00000010;
-        tempGrid[y][x] |= m_grid[y][x - 1] & 0b00000100;
-        tempGrid[y][x] |= m_grid[y - 1][x - 1] & 0b00001000;
-        tempGrid[y][x] |= m_grid[y - 1][x] & 0b00010000;
-        tempGrid[y][x] |= m_grid[y][x + 1] & 0b00100000;
-
-+ bounds checking
-*/
-inline void Simulation::moveRow(int y, std::vector<std::vector<uint8_t>>& tempGrid)
-{
-    if (y % 2 == 0)
-    {
-        for (int x = 1; x < m_gridWidth - 1; x++)
+void Simulation::collideTile(Lattice& grid, const TileScheduler::Tile& tile, int shift, uint64_t time, std::atomic<long long>* obstacleMomentum)
+{
+    // locals, writes through uint8_t* could alias members otherwise
+    const uint8_t* tables[2] = { (*m_collisionLUT)[0].data(), (*m_collisionLUT)[1].data() };
+    const int replicas = m_replicas;
+    const int from = tile.x0 * replicas;
+    const int to = tile.x1 * replicas;
+
+    if (!m_obstacleRows.empty()) measureObstacles(grid, tile, obstacleMomentum);
+
+    switch (m_collisionMode)
+    {
+    case CollisionMode::Random:
+    {
+        std::uniform_int_distribution<> which(0, 1);
+        for (int y = tile.y0; y < tile.y1; y++)
         {
-            tempGrid[y][x] = m_grid[y][x] & 0b11000000;
-            tempGrid[y][x] |= m_grid[y][x - 1] & 0b00000100;
-            tempGrid[y][x] |= m_grid[y][x + 1] & 0b00100000;
+            uint8_t* row = grid[y].data();
+            for (int x = from; x < to; x++)
+            {
+                uint8_t value = row[x];
+                // don't generate random if not needed, it is way faster
+                row[x] = tables[tables[0][value] == tables[1][value] ? 0 : which(m_randGen)][value];
+            }
         }
-        tempGrid[y][0] = m_grid[y][0] & 0b11000000;
-        tempGrid[y][0] |= m_grid[y][1] & 0b00100000;
-        tempGrid[y][m_gridWidth - 1] = m_grid[y][m_gridWidth - 1] & 0b11000000;
-        tempGrid[y][m_gridWidth - 1] |= m_grid[y][m_gridWidth - 2] & 0b00000100;
-        if (y - 1 >= 0)
+        break;
+    }
+    case CollisionMode::Alternating:
+    {
+        // chirality alternates between neighbouring sites and between time steps,
+        // so both tables are used equally often and the model stays isotropic on average
+        for (int y = tile.y0; y < tile.y1; y++)
         {
-            for (int x = 0; x < m_gridWidth - 1; x++)
+            uint8_t* row = grid[y].data();
+            int phase = (y + time) & 1;
+            for (int x = tile.x0; x < tile.x1; x++)
             {
-                tempGrid[y][x] |= m_grid[y - 1][x] & 0b00001000;
-                tempGrid[y][x] |= m_grid[y - 1][x + 1] & 0b00010000;
+                // replicas start with different parity so they don't share a pattern
+                for (int r = 0; r < replicas; r++)
+                {
+                    uint8_t& value = row[x * replicas + r];
+                    value = tables[(x + r + phase) & 1][value];
+                }
             }
-            tempGrid[y][m_gridWidth - 1] |= m_grid[y - 1][m_gridWidth - 1] & 0b00001000;
         }
-        if (y + 1 < m_gridHeight)
+        break;
+    }
+    case CollisionMode::RandomPlane:
+    {
+        int range = int(m_chiralityPlane.size()) - m_gridWidth * replicas;
+        for (int y = tile.y0; y < tile.y1; y++)
         {
-            for (int x = 0; x < m_gridWidth - 1; x++)
+            uint8_t* row = grid[y].data();
+            const uint8_t* chirality = m_chiralityPlane.data() + (shift + int64_t(y) * 7919) % range;
+            for (int x = from; x < to; x++)
             {
-                tempGrid[y][x] |= m_grid[y + 1][x + 1] & 0b00000001;
-                tempGrid[y][x] |= m_grid[y + 1][x] & 0b00000010;
+                row[x] = tables[chirality[x]][row[x]];
             }
-            tempGrid[y][m_gridWidth - 1] |= m_grid[y + 1][m_gridWidth - 1] & 0b00000010;
         }
+        break;
+    }
     }
-    else
+}
+
+/* a wall site sends every particle back where it came from, so the obstacle takes
+p_in - p_out = 2 * p_in of momentum, read straight from the tile while it is in cache
+the sites are stored sparsely, fluid sites don't pay anything */
+void Simulation::measureObstacles(const Lattice& grid, const TileScheduler::Tile& tile, std::atomic<long long>* obstacleMomentum)
+{
+    long long momentum[maxObstacles][2] = {};
+    const int replicas = m_replicas;
+
+    for (int y = tile.y0; y < tile.y1; y++)
     {
-        for (int x = 1; x < m_gridWidth - 1; x++)
+        const std::vector<std::pair<int, int>>& sites = m_obstacleRows[y];
+        const uint8_t* row = grid[y].data();
+        auto it = std::lower_bound(sites.begin(), sites.end(), std::pair<int, int>(tile.x0, 0));
+        for (; it != sites.end() && it->first < tile.x1; ++it)
         {
-            tempGrid[y][x] = m_grid[y][x] & 0b11000000;
-            tempGrid[y][x] |= m_grid[y][x - 1] & 0b00000100;
-            tempGrid[y][x] |= m_grid[y][x + 1] & 0b00100000;
+            for (int r = 0; r < replicas; r++)
+            {
+                // replicas may have different walls, fluid lanes of the site don't count
+                uint8_t value = row[it->first * replicas + r];
+                int wall = value >> 7;
+                momentum[it->second][0] += wall * siteMoments.vx[value];
+                momentum[it->second][1] += wall * siteMoments.vy[value];
+            }
         }
-        tempGrid[y][0] = m_grid[y][0] & 0b11000000;
-        tempGrid[y][0] |= m_grid[y][1] & 0b00100000;
-        tempGrid[y][m_gridWidth - 1] = m_grid[y][m_gridWidth - 1] & 0b11000000;
-        tempGrid[y][m_gridWidth - 1] |= m_grid[y][m_gridWidth - 2] & 0b00000100;
-        if (y - 1 >= 0)
+    }
+
+    for (int label = 0; label < getNumObstacles(); label++)
+    {
+        if (momentum[label][0] != 0) obstacleMomentum[2 * label] += momentum[label][0];
+        if (momentum[label][1] != 0) obstacleMomentum[2 * label + 1] += momentum[label][1];
+    }
+}
+
+void Simulation::recordObstacleForces(std::atomic<long long>* obstacleMomentum)
+{
+    for (int label = 0; label < getNumObstacles(); label++)
+    {
+        // 2 * p_in, per replica
+        std::pair<int, int> momentum(int(obstacleMomentum[2 * label].exchange(0)), int(obstacleMomentum[2 * label + 1].exchange(0)));
+        m_obstacleForces[label].push_back(asNormalVelocity({2 * momentum.first, 2 * momentum.second}, m_replicas, m_replicas));
+    }
+}
+
+int Simulation::addObstacle(const std::function<bool(int x, int y)>& inside)
+{
+    int label = getNumObstacles();
+    if (label == maxObstacles) throw "Simulation::addObstacle too many obstacles";
+
+    if (m_obstacleRows.empty()) m_obstacleRows.resize(m_gridHeight);
+    // rows are independent, inside has to be callable from several threads
+    TileScheduler(1, m_gridHeight, 1, 8).run(m_numThreads, [&](const TileScheduler::Tile& tile)
+    {
+        for (int y = tile.y0; y < tile.y1; y++)
         {
-            for (int x = 1; x < m_gridWidth; x++)
+            auto& sites = m_obstacleRows[y];
+            size_t claimed = sites.size();
+            for (int x = 0; x < m_gridWidth; x++)
             {
-                tempGrid[y][x] |= m_grid[y - 1][x - 1] & 0b00001000;
-                tempGrid[y][x] |= m_grid[y - 1][x] & 0b00010000;
+                // a site belongs to the first obstacle that claims it
+                bool wall = false;
+                for (int r = 0; r < m_replicas; r++)
+                {
+                    wall = wall || (m_grid[y][x * m_replicas + r] & 0b10000000);
+                }
+                if (!wall || !inside(x, y)) continue;
+                auto it = std::lower_bound(sites.begin(), sites.begin() + claimed, std::pair<int, int>(x, 0));
+                if (it != sites.begin() + claimed && it->first == x) continue;
+                sites.push_back({x, label});
             }
-            tempGrid[y][0] |= m_grid[y - 1][0] & 0b00010000;
+            // both parts are sorted by x
+            std::inplace_merge(sites.begin(), sites.begin() + claimed, sites.end());
         }
-        if (y + 1 < m_gridHeight)
+    });
+
+    m_obstacleMomentum = std::vector<std::atomic<long long>>(2 * (label + 1));
+    m_obstacleForces.resize(label + 1);
+    return label;
+}
+
+int Simulation::getNumObstacles() const
+{
+    return int(m_obstacleForces.size());
+}
+
+const std::vector<std::pair<double, double>>& Simulation::getObstacleForces(int label) const
+{
+    return m_obstacleForces[label];
+}
+
+void Simulation::clearObstacleForces()
+{
+    for (auto& forces : m_obstacleForces)
+    {
+        forces.clear();
+    }
+}
+
+void Simulation::setCollisionMode(CollisionMode mode)
+{
+    m_collisionMode = mode;
+    if (mode == CollisionMode::RandomPlane && m_chiralityPlane.empty())
+    {
+        // a few row lengths of random bits, odd length so rows don't line up
+        std::uniform_int_distribution<> bit(0, 1);
+        m_chiralityPlane.resize(4 * m_gridWidth * m_replicas + 4093);
+        for (auto& value : m_chiralityPlane)
         {
-            for (int x = 1; x < m_gridWidth; x++)
+            value = bit(m_randGen);
+        }
+    }
+}
+
+Simulation::CollisionMode Simulation::getCollisionMode() const
+{
+    return m_collisionMode;
+}
+
+void Simulation::setSeed(uint32_t seed)
+{
+    m_randGen.seed(seed);
+}
+
+uint64_t Simulation::getTime() const
+{
+    return m_time;
+}
+
+void Simulation::setTime(uint64_t time)
+{
+    m_time = time;
+}
+
+void Simulation::setNumThreads(int numThreads)
+{
+    m_numThreads = numThreads;
+}
+
+int Simulation::getNumThreads() const
+{
+    return m_numThreads;
+}
+
+void Simulation::setTileSize(int tileWidth, int tileHeight)
+{
+    m_tileWidth = tileWidth;
+    m_tileHeight = tileHeight;
+    refreshTiles();
+    setBandRows(0);
+}
+
+int Simulation::getTileWidth() const
+{
+    return m_tileWidth;
+}
+
+int Simulation::getTileHeight() const
+{
+    return m_tileHeight;
+}
+
+void Simulation::setFieldTileSize(int tileWidth, int tileHeight)
+{
+    m_fieldTileWidth = tileWidth;
+    m_fieldTileHeight = tileHeight;
+}
+
+int Simulation::getFieldTileWidth() const
+{
+    return m_fieldTileWidth;
+}
+
+int Simulation::getFieldTileHeight() const
+{
+    return m_fieldTileHeight;
+}
+
+void Simulation::refreshTiles()
+{
+    // streaming costs the same everywhere, collisions only do real work on fluid sites
+    m_tiles = TileScheduler(m_gridWidth, m_gridHeight, m_tileWidth, m_tileHeight, [this](const TileScheduler::Tile& tile)
+    {
+        int weight = 0;
+        for (int y = tile.y0; y < tile.y1; y++)
+        {
+            for (int x = tile.x0 * m_replicas; x < tile.x1 * m_replicas; x++)
             {
-                tempGrid[y][x] |= m_grid[y + 1][x] & 0b00000001;
-                tempGrid[y][x] |= m_grid[y + 1][x - 1] & 0b00000010;
+                weight += m_grid[y][x] & 0b10000000 ? 1 : 4;
             }
-            tempGrid[y][0] |= m_grid[y + 1][0] & 0b00000001;
         }
+        return weight;
+    });
+    countInflowFluid();
+}
+
+TileScheduler Simulation::cellTiles(int cellsX, int cellsY, int cellSizeX, int cellSizeY) const
+{
+    int tileWidth = m_fieldTileWidth > 0 ? m_fieldTileWidth : m_tileWidth;
+    int tileHeight = m_fieldTileHeight > 0 ? m_fieldTileHeight : m_tileHeight;
+    return TileScheduler(cellsX, cellsY, std::max(1, tileWidth / cellSizeX), std::max(1, tileHeight / cellSizeY));
+}
+
+constexpr Simulation::SiteMoments Simulation::generateSiteMoments()
+{
+    SiteMoments moments = SiteMoments();
+    for (int v = 0; v < 256; v++)
+    {
+        moments.vx[v] = int8_t(-(v & 1) - ((v >> 4) & 1) + ((v >> 1) & 1) + ((v >> 3) & 1) + 2 * ((v >> 2) & 1) - 2 * ((v >> 5) & 1));
+        moments.vy[v] = int8_t((v & 1) + ((v >> 1) & 1) - ((v >> 3) & 1) - ((v >> 4) & 1));
+        int count = 0;
+        for (int k = 0; k < 7; k++) count += (v >> k) & 1;
+        moments.count[v] = uint8_t(count);
     }
+    return moments;
+}
+
+namespace
+{
+constexpr int countBits(uint8_t value)
+{
+    int count = 0;
+    for (; value; value &= value - 1) count++;
+    return count;
+}
+
+constexpr uint8_t dirBit(int dir)
+{
+    return uint8_t(1 << ((dir % 6 + 6) % 6));
+}
+
+// rotates moving particles by turn * 60 degrees, rest and wall bits stay
+constexpr uint8_t rotate(uint8_t state, int turn)
+{
+    int r = (turn % 6 + 6) % 6;
+    int moving = state & 0b00111111;
+    return uint8_t((state & 0b11000000) | (((moving << r) | (moving >> (6 - r))) & 0b00111111));
+}
+
+constexpr bool isHeadOnPair(int moving)
+{
+    return moving == 0b001001 || moving == 0b010010 || moving == 0b100100;
 }
 
-void Simulation::runThreaded(std::function<void(int threadNumber)> fn)
+/* collision of a state with at most 3 moving particles and no wall
+turn is the chirality, -1 or 1, head-on pairs rotate by it
+returns the state unchanged if no rule of the variant applies */
+constexpr uint8_t collideParticles(uint8_t state, int turn, Simulation::Variant variant)
 {
-    std::vector<std::thread> threads;
-    for (int i = 0; i < m_numThreads; i++)
+    uint8_t rest = state & 0b01000000;
+    int moving = state & 0b00111111;
+    int count = countBits(uint8_t(moving));
+
+    // head-on pair, with a rest particle as spectator since FHP-II
+    if (count == 2 && isHeadOnPair(moving))
     {
-        threads.push_back(std::thread(fn, i));
+        if (rest && variant == Simulation::Variant::FHP1) return state;
+        return rotate(state, turn);
     }
-    for (auto& t : threads) t.join();
+    // symmetric triple flips to the other one
+    if (count == 3 && (moving == 0b010101 || moving == 0b101010))
+    {
+        if (rest && variant == Simulation::Variant::FHP1) return state;
+        return uint8_t(rest | (moving ^ 0b111111));
+    }
+    if (variant == Simulation::Variant::FHP1) return state;
+
+    // two particles 120 degrees apart <-> rest particle + one moving in direction of their sum
+    for (int d = 0; d < 6; d++)
+    {
+        if (!rest && moving == (dirBit(d - 1) | dirBit(d + 1))) return uint8_t(0b01000000 | dirBit(d));
+        if (rest && moving == dirBit(d)) return uint8_t(dirBit(d - 1) | dirBit(d + 1));
+    }
+    if (variant == Simulation::Variant::FHP2) return state;
+
+    /* head-on pair with moving spectator d, the pair rotates by turn,
+    the orientation along d is blocked by the spectator and is replaced by rest + (d - 1, d + 1) */
+    for (int d = 0; d < 6; d++)
+    {
+        if (count == 3 && !rest && (moving & dirBit(d)) && isHeadOnPair(moving ^ dirBit(d)))
+        {
+            int orientation = (moving ^ dirBit(d)) & 0b001001 ? 0 : (moving ^ dirBit(d)) & 0b010010 ? 1 : 2;
+            int next = ((orientation + turn) % 3 + 3) % 3;
+            if (next == d % 3) return uint8_t(0b01000000 | dirBit(d - 1) | dirBit(d + 1));
+            return uint8_t(dirBit(d) | dirBit(next) | dirBit(next + 3));
+        }
+        if (count == 2 && rest && moving == (dirBit(d - 1) | dirBit(d + 1)))
+        {
+            int next = ((d + turn) % 3 + 3) % 3;
+            return uint8_t(dirBit(d) | dirBit(next) | dirBit(next + 3));
+        }
+    }
+    return state;
+}
 }
 
-constexpr std::array<std::array<uint8_t, 256>, 2> Simulation::generateCollisionLUT()
+/* builds the tables from the collision rules above
+table[0] turns head-on pairs clockwise, table[1] counterclockwise
+wall sites bounce every moving particle back, FHP-III states with more than 3 particles
+collide like their hole (inverted) state, in FHP-II only a symmetric triple with a rest particle has that many */
+constexpr std::array<std::array<uint8_t, 256>, 2> Simulation::generateCollisionLUT(Variant variant)
 {
     std::array<std::array<uint8_t, 256>, 2> table = std::array<std::array<uint8_t, 256>, 2>();
-    table[0][0b00000000] = 0b00000000;
-    table[0][0b00000001] = 0b00000001;
-    table[0][0b00000010] = 0b00000010;
-    table[0][0b00000011] = 0b00000011;
-    table[0][0b00000100] = 0b00000100;
-    table[0][0b00000101] = 0b01000010;
-    table[0][0b00000110] = 0b00000110;
-    table[0][0b00000111] = 0b00000111;
-    table[0][0b00001000] = 0b00001000;
-    table[0][0b00001001] = 0b00100100;
-    table[0][0b00001010] = 0b01000100;
-    table[0][0b00001011] = 0b00100110;
-    table[0][0b00001100] = 0b00001100;
-    table[0][0b00001101] = 0b01001010;
-    table[0][0b00001110] = 0b00001110;
-    table[0][0b00001111] = 0b00001111;
-    table[0][0b00010000] = 0b00010000;
-    table[0][0b00010001] = 0b01100000;
-    table[0][0b00010010] = 0b00001001;
-    table[0][0b00010011] = 0b01100010;
-    table[0][0b00010100] = 0b01001000;
-    table[0][0b00010101] = 0b00101010;
-    table[0][0b00010110] = 0b00001101;
-    table[0][0b00010111] = 0b01100110;
-    table[0][0b00011000] = 0b00011000;
-    table[0][0b00011001] = 0b00110100;
-    table[0][0b00011010] = 0b01010100;
-    table[0][0b00011011] = 0b00101101;
-    table[0][0b00011100] = 0b00011100;
-    table[0][0b00011101] = 0b01011010;
-    table[0][0b00011110] = 0b00011110;
-    table[0][0b00011111] = 0b01101110;
-    table[0][0b00100000] = 0b00100000;
-    table[0][0b00100001] = 0b00100001;
-    table[0][0b00100010] = 0b01000001;
-    table[0][0b00100011] = 0b00100011;
-    table[0][0b00100100] = 0b00010010;
-    table[0][0b00100101] = 0b00010011;
-    table[0][0b00100110] = 0b01000101;
-    table[0][0b00100111] = 0b00100111;
-    table[0][0b00101000] = 0b01010000;
-    table[0][0b00101001] = 0b01010001;
-    table[0][0b00101010] = 0b00010101;
-    table[0][0b00101011] = 0b01010011;
-    table[0][0b00101100] = 0b00011010;
-    table[0][0b00101101] = 0b00110110;
-    table[0][0b00101110] = 0b01001101;
-    table[0][0b00101111] = 0b01010111;
-    table[0][0b00110000] = 0b00110000;
-    table[0][0b00110001] = 0b00110001;
-    table[0][0b00110010] = 0b00101001;
-    table[0][0b00110011] = 0b00110011;
-    table[0][0b00110100] = 0b01101000;
-    table[0][0b00110101] = 0b01101001;
-    table[0][0b00110110] = 0b00011011;
-    table[0][0b00110111] = 0b01101011;
-    table[0][0b00111000] = 0b00111000;
-    table[0][0b00111001] = 0b00111001;
-    table[0][0b00111010] = 0b01110100;
-    table[0][0b00111011] = 0b01110101;
-    table[0][0b00111100] = 0b00111100;
-    table[0][0b00111101] = 0b01111010;
-    table[0][0b00111110] = 0b01011101;
-    table[0][0b00111111] = 0b00111111;
-    table[0][0b01000000] = 0b01000000;
-    table[0][0b01000001] = 0b00100010;
-    table[0][0b01000010] = 0b00000101;
-    table[0][0b01000011] = 0b01000011;
-    table[0][0b01000100] = 0b00001010;
-    table[0][0b01000101] = 0b00001011;
-    table[0][0b01000110] = 0b01000110;
-    table[0][0b01000111] = 0b01000111;
-    table[0][0b01001000] = 0b00010100;
-    table[0][0b01001001] = 0b01100100;
-    table[0][0b01001010] = 0b00010110;
-    table[0][0b01001011] = 0b00010111;
-    table[0][0b01001100] = 0b01001100;
-    table[0][0b01001101] = 0b01010110;
-    table[0][0b01001110] = 0b01001110;
-    table[0][0b01001111] = 0b01001111;
-    table[0][0b01010000] = 0b00101000;
-    table[0][0b01010001] = 0b00110010;
-    table[0][0b01010010] = 0b01001001;
-    table[0][0b01010011] = 0b01100101;
-    table[0][0b01010100] = 0b00101100;
-    table[0][0b01010101] = 0b01101010;
-    table[0][0b01010110] = 0b00101110;
-    table[0][0b01010111] = 0b00101111;
-    table[0][0b01011000] = 0b01011000;
-    table[0][0b01011001] = 0b00111010;
-    table[0][0b01011010] = 0b01101100;
-    table[0][0b01011011] = 0b01101101;
-    table[0][0b01011100] = 0b01011100;
-    table[0][0b01011101] = 0b00111110;
-    table[0][0b01011110] = 0b01011110;
-    table[0][0b01011111] = 0b01011111;
-    table[0][0b01100000] = 0b00010001;
-    table[0][0b01100001] = 0b01100001;
-    table[0][0b01100010] = 0b00100101;
-    table[0][0b01100011] = 0b01100011;
-    table[0][0b01100100] = 0b01010010;
-    table[0][0b01100101] = 0b00101011;
-    table[0][0b01100110] = 0b01001011;
-    table[0][0b01100111] = 0b01100111;
-    table[0][0b01101000] = 0b00011001;
-    table[0][0b01101001] = 0b01110010;
-    table[0][0b01101010] = 0b01010101;
-    table[0][0b01101011] = 0b00110111;
-    table[0][0b01101100] = 0b00011101;
-    table[0][0b01101101] = 0b01110110;
-    table[0][0b01101110] = 0b00011111;
-    table[0][0b01101111] = 0b01101111;
-    table[0][0b01110000] = 0b01110000;
-    table[0][0b01110001] = 0b01110001;
-    table[0][0b01110010] = 0b00110101;
-    table[0][0b01110011] = 0b01110011;
-    table[0][0b01110100] = 0b01011001;
-    table[0][0b01110101] = 0b00111011;
-    table[0][0b01110110] = 0b01011011;
-    table[0][0b01110111] = 0b01110111;
-    table[0][0b01111000] = 0b01111000;
-    table[0][0b01111001] = 0b01111001;
-    table[0][0b01111010] = 0b00111101;
-    table[0][0b01111011] = 0b01111011;
-    table[0][0b01111100] = 0b01111100;
-    table[0][0b01111101] = 0b01111101;
-    table[0][0b01111110] = 0b01111110;
-    table[0][0b01111111] = 0b01111111;
-    table[0][0b10000000] = 0b10000000;
-    table[0][0b10000001] = 0b10001000;
-    table[0][0b10000010] = 0b10010000;
-    table[0][0b10000011] = 0b10011000;
-    table[0][0b10000100] = 0b10100000;
-    table[0][0b10000101] = 0b10101000;
-    table[0][0b10000110] = 0b10110000;
-    table[0][0b10000111] = 0b10111000;
-    table[0][0b10001000] = 0b10000001;
-    table[0][0b10001001] = 0b10001001;
-    table[0][0b10001010] = 0b10010001;
-    table[0][0b10001011] = 0b10011001;
-    table[0][0b10001100] = 0b10100001;
-    table[0][0b10001101] = 0b10101001;
-    table[0][0b10001110] = 0b10110001;
-    table[0][0b10001111] = 0b10111001;
-    table[0][0b10010000] = 0b10000010;
-    table[0][0b10010001] = 0b10001010;
-    table[0][0b10010010] = 0b10010010;
-    table[0][0b10010011] = 0b10011010;
-    table[0][0b10010100] = 0b10100010;
-    table[0][0b10010101] = 0b10101010;
-    table[0][0b10010110] = 0b10110010;
-    table[0][0b10010111] = 0b10111010;
-    table[0][0b10011000] = 0b10000011;
-    table[0][0b10011001] = 0b10001011;
-    table[0][0b10011010] = 0b10010011;
-    table[0][0b10011011] = 0b10011011;
-    table[0][0b10011100] = 0b10100011;
-    table[0][0b10011101] = 0b10101011;
-    table[0][0b10011110] = 0b10110011;
-    table[0][0b10011111] = 0b10111011;
-    table[0][0b10100000] = 0b10000100;
-    table[0][0b10100001] = 0b10001100;
-    table[0][0b10100010] = 0b10010100;
-    table[0][0b10100011] = 0b10011100;
-    table[0][0b10100100] = 0b10100100;
-    table[0][0b10100101] = 0b10101100;
-    table[0][0b10100110] = 0b10110100;
-    table[0][0b10100111] = 0b10111100;
-    table[0][0b10101000] = 0b10000101;
-    table[0][0b10101001] = 0b10001101;
-    table[0][0b10101010] = 0b10010101;
-    table[0][0b10101011] = 0b10011101;
-    table[0][0b10101100] = 0b10100101;
-    table[0][0b10101101] = 0b10101101;
-    table[0][0b10101110] = 0b10110101;
-    table[0][0b10101111] = 0b10111101;
-    table[0][0b10110000] = 0b10000110;
-    table[0][0b10110001] = 0b10001110;
-    table[0][0b10110010] = 0b10010110;
-    table[0][0b10110011] = 0b10011110;
-    table[0][0b10110100] = 0b10100110;
-    table[0][0b10110101] = 0b10101110;
-    table[0][0b10110110] = 0b10110110;
-    table[0][0b10110111] = 0b10111110;
-    table[0][0b10111000] = 0b10000111;
-    table[0][0b10111001] = 0b10001111;
-    table[0][0b10111010] = 0b10010111;
-    table[0][0b10111011] = 0b10011111;
-    table[0][0b10111100] = 0b10100111;
-    table[0][0b10111101] = 0b10101111;
-    table[0][0b10111110] = 0b10110111;
-    table[0][0b10111111] = 0b10111111;
-    table[0][0b11000000] = 0b11000000;
-    table[0][0b11000001] = 0b11001000;
-    table[0][0b11000010] = 0b11010000;
-    table[0][0b11000011] = 0b11011000;
-    table[0][0b11000100] = 0b11100000;
-    table[0][0b11000101] = 0b11101000;
-    table[0][0b11000110] = 0b11110000;
-    table[0][0b11000111] = 0b11111000;
-    table[0][0b11001000] = 0b11000001;
-    table[0][0b11001001] = 0b11001001;
-    table[0][0b11001010] = 0b11010001;
-    table[0][0b11001011] = 0b11011001;
-    table[0][0b11001100] = 0b11100001;
-    table[0][0b11001101] = 0b11101001;
-    table[0][0b11001110] = 0b11110001;
-    table[0][0b11001111] = 0b11111001;
-    table[0][0b11010000] = 0b11000010;
-    table[0][0b11010001] = 0b11001010;
-    table[0][0b11010010] = 0b11010010;
-    table[0][0b11010011] = 0b11011010;
-    table[0][0b11010100] = 0b11100010;
-    table[0][0b11010101] = 0b11101010;
-    table[0][0b11010110] = 0b11110010;
-    table[0][0b11010111] = 0b11111010;
-    table[0][0b11011000] = 0b11000011;
-    table[0][0b11011001] = 0b11001011;
-    table[0][0b11011010] = 0b11010011;
-    table[0][0b11011011] = 0b11011011;
-    table[0][0b11011100] = 0b11100011;
-    table[0][0b11011101] = 0b11101011;
-    table[0][0b11011110] = 0b11110011;
-    table[0][0b11011111] = 0b11111011;
-    table[0][0b11100000] = 0b11000100;
-    table[0][0b11100001] = 0b11001100;
-    table[0][0b11100010] = 0b11010100;
-    table[0][0b11100011] = 0b11011100;
-    table[0][0b11100100] = 0b11100100;
-    table[0][0b11100101] = 0b11101100;
-    table[0][0b11100110] = 0b11110100;
-    table[0][0b11100111] = 0b11111100;
-    table[0][0b11101000] = 0b11000101;
-    table[0][0b11101001] = 0b11001101;
-    table[0][0b11101010] = 0b11010101;
-    table[0][0b11101011] = 0b11011101;
-    table[0][0b11101100] = 0b11100101;
-    table[0][0b11101101] = 0b11101101;
-    table[0][0b11101110] = 0b11110101;
-    table[0][0b11101111] = 0b11111101;
-    table[0][0b11110000] = 0b11000110;
-    table[0][0b11110001] = 0b11001110;
-    table[0][0b11110010] = 0b11010110;
-    table[0][0b11110011] = 0b11011110;
-    table[0][0b11110100] = 0b11100110;
-    table[0][0b11110101] = 0b11101110;
-    table[0][0b11110110] = 0b11110110;
-    table[0][0b11110111] = 0b11111110;
-    table[0][0b11111000] = 0b11000111;
-    table[0][0b11111001] = 0b11001111;
-    table[0][0b11111010] = 0b11010111;
-    table[0][0b11111011] = 0b11011111;
-    table[0][0b11111100] = 0b11100111;
-    table[0][0b11111101] = 0b11101111;
-    table[0][0b11111110] = 0b11110111;
-    table[0][0b11111111] = 0b11111111;
-
-    table[1] = table[0];
-
-    table[1][0b00001001] = 0b00010010;
-    table[1][0b00001011] = 0b01000101;
-    table[1][0b00001101] = 0b00010110;
-    table[1][0b00010010] = 0b00100100;
-    table[1][0b00010011] = 0b00100101;
-    table[1][0b00010110] = 0b01001010;
-    table[1][0b00010111] = 0b01001011;
-    table[1][0b00011001] = 0b01101000;
-    table[1][0b00011010] = 0b00101100;
-    table[1][0b00011011] = 0b00110110;
-    table[1][0b00011101] = 0b01101100;
-    table[1][0b00100100] = 0b00001001;
-    table[1][0b00100101] = 0b01100010;
-    table[1][0b00100110] = 0b00001011;
-    table[1][0b00101001] = 0b00110010;
-    table[1][0b00101011] = 0b01100101;
-    table[1][0b00101100] = 0b01010100;
-    table[1][0b00101101] = 0b00011011;
-    table[1][0b00101110] = 0b01010110;
-    table[1][0b00110010] = 0b01010001;
-    table[1][0b00110100] = 0b00011001;
-    table[1][0b00110101] = 0b01110010;
-    table[1][0b00110110] = 0b00101101;
-    table[1][0b00111010] = 0b01011001;
-    table[1][0b01000101] = 0b00100110;
-    table[1][0b01001001] = 0b01010010;
-    table[1][0b01001010] = 0b00001101;
-    table[1][0b01001011] = 0b01100110;
-    table[1][0b01001101] = 0b00101110;
-    table[1][0b01010001] = 0b00101001;
-    table[1][0b01010010] = 0b01100100;
-    table[1][0b01010011] = 0b00101011;
-    table[1][0b01010100] = 0b00011010;
-    table[1][0b01010110] = 0b01001101;
-    table[1][0b01011001] = 0b01110100;
-    table[1][0b01011010] = 0b00011101;
-    table[1][0b01011011] = 0b01110110;
-    table[1][0b01100010] = 0b00010011;
-    table[1][0b01100100] = 0b01001001;
-    table[1][0b01100101] = 0b01010011;
-    table[1][0b01100110] = 0b00010111;
-    table[1][0b01101000] = 0b00110100;
-    table[1][0b01101001] = 0b00110101;
-    table[1][0b01101100] = 0b01011010;
-    table[1][0b01101101] = 0b01011011;
-    table[1][0b01110010] = 0b01101001;
-    table[1][0b01110100] = 0b00111010;
-    table[1][0b01110110] = 0b01101101;
-
+    for (int chirality = 0; chirality < 2; chirality++)
+    {
+        int turn = chirality == 0 ? -1 : 1;
+        for (int state = 0; state < 256; state++)
+        {
+            uint8_t s = uint8_t(state);
+            if (s & 0b10000000)
+            {
+                table[chirality][state] = rotate(s, 3);
+            }
+            else if (countBits(s) > 3 && variant == Variant::FHP3)
+            {
+                table[chirality][state] = uint8_t(~collideParticles(uint8_t(~s & 0b01111111), turn, variant) & 0b01111111);
+            }
+            else
+            {
+                table[chirality][state] = collideParticles(s, turn, variant);
+            }
+        }
+    }
     return table;
 }
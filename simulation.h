@@ -1,59 +1,317 @@
 #ifndef SIMULATION_H
 #define SIMULATION_H
 #include <array>
+#include <atomic>
 #include <functional>
 #include <random>
+#include <string>
 #include <vector>
+#include "boundaries.h"
+#include "field.h"
+#include "fieldpyramid.h"
+#include "lattice.h"
+#include "taskgraph.h"
+#include "tilescheduler.h"
 
 class Simulation
 {
 public:
-    Simulation(int gridWidth, int gridHeight, int numThreads, const std::function<void(Simulation*)>& initialConditionsGenerator);
+    // how colissionStep picks between the two chiral tables of collisionLUT
+    enum class CollisionMode
+    {
+        Random,      // fresh random bit per ambiguous site (original behaviour)
+        Alternating, // chirality from (x + y + time) parity, no RNG at all
+        RandomPlane  // precomputed random bit-plane, shifted every step
+    };
+
+    // what happens to particles at the edges of the grid, separately for x and y
+    enum class Boundary
+    {
+        Open,      // particles leaving the grid are lost
+        Periodic,  // torus, y needs even grid height
+        BounceBack // edges act as walls
+    };
+
+    // collision rule set
+    enum class Variant
+    {
+        FHP1, // head-on pairs and symmetric triples only
+        FHP2, // + rest particle collisions
+        FHP3  // collision saturated, + spectators and particle-hole duality
+    };
+
+    /* replicas > 1 runs that many independent lattices in lockstep (ensemble mode),
+    initialConditionsGenerator is called once per replica on a plain gridWidth wide grid,
+    replica r starts its generator from std::seed_seq{seed, r}, afterwards the replicas are interleaved site by site,
+    the same seed gives the same ensemble, the default draws one from std::random_device
+
+    non-empty backingFile keeps the lattice in that memory-mapped file instead of memory (out-of-core),
+    an existing file of the right size is used as it is, pass an empty generator to continue a run (ensembles too, the file holds the interleaved lanes),
+    steps then go over the file in bands of rows with prefetch and write-back, see step() */
+    Simulation(int gridWidth, int gridHeight, int numThreads, const std::function<void(Simulation*)>& initialConditionsGenerator, int replicas = 1, const std::string& backingFile = "", uint32_t seed = std::random_device()());
 
-    // counts number of particles in a column
+    // writes the current lattice back to the backing file
+    ~Simulation();
+
+    // counts number of particles in a column, summed over all replicas
     int countColOccuppancy(int at) const;
 
-    // spawns particles at columns [at...at+width] until desired concentration[0...1] is reached
+    // counts number of particles in a column of one replica
+    int countColOccuppancy(int at, int replica) const;
+
+    /* spawns particles at columns [at...at+width] until desired concentration[0...1] (particles per 7 channels) is reached, in every replica
+    FHP-I has no rest particle, its columns fill up at 6/7 */
     void spawnAtX(float concentration, int at, int width);
 
-    std::vector<std::vector<uint8_t>>& getGrid();
+    /* fills every fluid site, in every replica, from the FHP equilibrium of the cell of field it is in,
+    field has Velocity and Density of cellSizeX x cellSizeY site cells (like getField, cut short cells at the edge are fine),
+    wall sites are left as they are, without particles, rows are filled in parallel, each from its own generator seeded from this one */
+    void seedEquilibrium(const Field& field, int cellSizeX, int cellSizeY);
+
+    /* Fermi-Dirac equilibrium of FHP: occupation probabilities 1 / (1 + exp(h + q.c_k)) of the 6 directions and the rest particle,
+    h and q are solved for by Newton's method so that the mean site has density (particles / 7 channels, like Field::Density)
+    and the mean particle velocity vx, vy, without rest particles (FHP-I) the 7th is 0,
+    a velocity the density can't carry is halved until it can */
+    static std::array<double, 7> equilibrium(double density, double vx, double vy, bool restParticles);
+
+    // rows are gridWidth * replicas long, site x of replica r is at [y][x * replicas + r]
+    Lattice& getGrid();
+
+    int getReplicas() const;
+
+    // field getters sum over all replicas, so with replicas > 1 they give ensemble averages
 
     // returns pair(total x velocity(multiple of 1/2), total y velocity(multiple of sqrt(3)/2))
     std::pair<int, int> getRegionVelocity(int fromX, int toX, int fromY, int toY);
 
     std::pair<double, double> getRegionAverageVelocity(int fromX, int toX, int fromY, int toY);
 
-    // returns average velocity in cellSize x cellSize grid
-    std::vector<std::vector<std::pair<double, double>>> getVelocityField(int cellSizeX, int cellSizeY);
+    // average velocity/density... of cellSizeX x cellSizeY cells, channels is a combination of Field::Channel
+    Field getField(int cellSizeX, int cellSizeY, int channels);
+
+    /* getField of the cells covering sites [x0...x1) x [y0...y1), clipped to the grid, the last column/row of cells may be cut short
+    maxSamples > 0 reads about that many sites of a cell at most, on an evenly spaced sub-grid, so a view of a large region
+    costs as much as its number of cells, the sums are then over the sites read */
+    Field getRegionField(int x0, int y0, int x1, int y1, int cellSizeX, int cellSizeY, int channels, int maxSamples = 0);
 
-    std::pair<std::vector<std::vector<double>>, std::vector<std::vector<double>>> getVelocityMagnitudeAndDensityField(int cellSizeX, int cellSizeY);
+    // getField with the usual channels
+    Field getVelocityField(int cellSizeX, int cellSizeY);
 
-    std::pair<std::vector<std::vector<std::pair<double, double>>>, std::vector<std::vector<double>>> getVelocityAndDensityField(int cellSizeX, int cellSizeY);
+    Field getVelocityMagnitudeAndDensityField(int cellSizeX, int cellSizeY);
+
+    Field getVelocityAndDensityField(int cellSizeX, int cellSizeY);
+
+    // momentum/particle sums for cell sizes 2, 4, 8... up to 2^numLevels, one pass over the grid
+    FieldPyramid getFieldPyramid(int numLevels);
 
     void moveStep();
 
     void colissionStep();
 
+    // moveStep + colissionStep in one pass, every tile collides right after streaming while it is still in cache
+    void step();
+
+    // columns kept at a particle concentration by advance(), like spawnAtX after every step
+    struct Inflow
+    {
+        float concentration;
+        int at;
+        int width;
+    };
+    void setInflow(const std::vector<Inflow>& inflow);
+
+    /* steps times step() + inflow on a task graph of row bands (one row of tiles each), without a barrier per step,
+    a band streams, collides, gets its inflow and is handed to bandDone as soon as its neighbours are done with the step before
+    bandDone(grid, fromRow, toRow, time) runs concurrently for different bands and may only read its own rows of grid
+    inflow is kept per band, so the concentration holds for every band of the columns instead of the whole columns */
+    void advance(int steps, const std::function<void(const Lattice& grid, int fromRow, int toRow, uint64_t time)>& bandDone = nullptr);
+
+    // makes the backing file hold the current lattice, no-op for in-memory simulations
+    void syncBackingFile();
+
+    /* after an odd number of steps the lattice is in the streaming target, this copies it back
+    so getGrid() is the buffer it was before the first step and pointers into it see the current state */
+    void restorePrimaryGrid();
+
+    // rows per band when streaming over a backing file, rounded to whole tiles
+    void setBandRows(int rows);
+
+    void setNumThreads(int numThreads);
+    int getNumThreads() const;
+
+    // every phase runs on tiles of this many sites, default 1024 x 16
+    void setTileSize(int tileWidth, int tileHeight);
+    int getTileWidth() const;
+    int getTileHeight() const;
+
+    // sites per tile of getField and getFieldPyramid, 0 x 0 (default) uses the tile size of the steps
+    void setFieldTileSize(int tileWidth, int tileHeight);
+    int getFieldTileWidth() const;
+    int getFieldTileHeight() const;
+
+    // recomputes the tile weights and the fluid sites of the inflow columns, call after changing walls outside of the initial conditions
+    void refreshTiles();
+
+    // picks the streaming kernel instantiated for this combination of policies
+    void setBoundaries(Boundary x, Boundary y);
+    Boundary getXBoundary() const;
+    Boundary getYBoundary() const;
+
+    void setVariant(Variant variant);
+    Variant getVariant() const;
+
+    void setCollisionMode(CollisionMode mode);
+    CollisionMode getCollisionMode() const;
+
+    // reseeds the generator used by spawnAtX and the random collision modes, Random mode is reproducible with one thread
+    void setSeed(uint32_t seed);
+
+    // number of collision steps done so far
+    uint64_t getTime() const;
+
+    // sets the step counter, e.g. when a run continues from a recorded lattice, Alternating chirality follows it
+    void setTime(uint64_t time);
+
+    /* moving window: the window moves columns further downstream (+x), in O(columns * height) instead of moving the lattice
+    the stored columns are a ring, the first columns of the window are recycled as its new last ones,
+    drawn from the equilibrium of density and velocity vx, vy (see equilibrium()), wall(x, y) makes walls of them,
+    x counted from the start of the run (getWindowOffset() + window column), the seam streams as an open x edge
+    obstacle sites that leave the window aren't measured any more, x boundary has to be Open
+    column arguments (spawnAtX, inflow, getField...) are window columns, window column x is stored at
+    (x + getWindowOrigin()) % width of getGrid(), getFieldPyramid and bandDone see the stored columns */
+    void shiftWindow(int columns, double density, double vx, double vy, const std::function<bool(int64_t x, int y)>& wall = nullptr);
+    int getWindowOrigin() const;
+    // columns the window has moved in total
+    int64_t getWindowOffset() const;
+
+    static constexpr int maxObstacles = 16;
+
+    /* wall sites where inside(x, y) is true become an obstacle, returns its label
+    every collision then measures the momentum the obstacle takes from bouncing particles back
+    rows are labelled in parallel, so inside may be called from several threads at once */
+    int addObstacle(const std::function<bool(int x, int y)>& inside);
+    int getNumObstacles() const;
+
+    /* force on obstacle label in every collision step since it was added or cleared,
+    pair(drag (x), lift (y)) per replica, momentum per step in the units of asNormalVelocity */
+    const std::vector<std::pair<double, double>>& getObstacleForces(int label) const;
+    void clearObstacleForces();
+
     inline static std::pair<double, double> asNormalVelocity(const std::pair<int, int>& v, double normFactorX = 1, double normFactorY = 1)
     {
         return { (double(v.first) / 2)/normFactorX, (double(v.second) * 0.8660254)/normFactorY };
     }
 
+    // momentum (vx multiple of 1/2, vy multiple of sqrt(3)/2) and particle count of every state
+    struct SiteMoments
+    {
+        std::array<int8_t, 256> vx;
+        std::array<int8_t, 256> vy;
+        std::array<uint8_t, 256> count;
+    };
+    static const SiteMoments siteMoments;
+    static constexpr SiteMoments generateSiteMoments();
+
+    // FHP-III table, [chirality][input state] -> output state
     static const std::array<std::array<uint8_t, 256>, 2> collisionLUT;
-    static constexpr std::array<std::array<uint8_t, 256>, 2> generateCollisionLUT();
+    // tables of all variants, indexed by Variant
+    static const std::array<std::array<std::array<uint8_t, 256>, 2>, 3> variantLUTs;
+    static constexpr std::array<std::array<uint8_t, 256>, 2> generateCollisionLUT(Variant variant = Variant::FHP3);
 
 private:
     int m_gridWidth;
     int m_gridHeight;
     int m_numThreads;
-    std::vector<std::vector<uint8_t>> m_grid;
+    int m_replicas;
+    Lattice m_grid;
+    // streaming target, swapped with m_grid after every step
+    Lattice m_nextGrid;
+    // false while the current lattice is in the streaming target (the scratch file of an out-of-core run)
+    bool m_gridIsPrimary = true;
+    int m_bandRows = 0;
     std::mt19937 m_randGen;
+    Variant m_variant = Variant::FHP3;
+    const std::array<std::array<uint8_t, 256>, 2>* m_collisionLUT = &collisionLUT;
+    // streamTileImpl instance for the current boundaries
+    void (Simulation::*m_streamTile)(const Lattice& grid, Lattice& next, const TileScheduler::Tile& tile);
+    Boundary m_xBoundary = Boundary::Open;
+    Boundary m_yBoundary = Boundary::Open;
+    // stored column of window column 0, see shiftWindow
+    int m_xOrigin = 0;
+    int64_t m_windowOffset = 0;
+    // all zero row used as the outside neighbour of open/bounce-back edges
+    std::vector<uint8_t> m_zeroRow;
+    CollisionMode m_collisionMode = CollisionMode::Random;
+    uint64_t m_time = 0;
+    // random 0/1 chirality values used by CollisionMode::RandomPlane
+    std::vector<uint8_t> m_chiralityPlane;
+
+    // streams into m_nextGrid band by band, with collide the tiles collide right after streaming
+    void streamBands(bool collide);
+
+    // streams the sites of tile from grid into next
+    template<class XBoundary, class YBoundary>
+    void streamTileImpl(const Lattice& grid, Lattice& next, const TileScheduler::Tile& tile);
+
+    // stored column of window column x
+    inline int column(int x) const
+    {
+        int stored = x + m_xOrigin;
+        return stored >= m_gridWidth ? stored - m_gridWidth : stored;
+    }
+
+    // sets m_streamTile for the boundaries and the window
+    void selectStreamKernel();
+
+    // streams the stored columns of window columns 0 and width - 1 within [fromX...toX) of one row again, as open edges
+    void streamSeam(const uint8_t* up, const uint8_t* row, const uint8_t* down, uint8_t* out, bool evenRow, int fromX, int toX);
+
+    template<class XBoundary>
+    static void (Simulation::*streamTileFor(Boundary y))(const Lattice& grid, Lattice& next, const TileScheduler::Tile& tile);
+
+    /* collides the sites of tile in grid, shift is the chirality plane offset and time the step,
+    obstacle momentum is added to obstacleMomentum (vx, vy for every label) */
+    void collideTile(Lattice& grid, const TileScheduler::Tile& tile, int shift, uint64_t time, std::atomic<long long>* obstacleMomentum);
+
+    /* spawnAtX limited to rows [fromRow...toRow) of grid, fluid has the fluid sites in these rows
+    per column and lane ((x - at) * replicas + lane), nullptr counts the walls of the columns */
+    void spawnRows(Lattice& grid, float concentration, int at, int width, int fromRow, int toRow, std::mt19937& randGen, const int* fluid);
+
+    std::vector<Inflow> m_inflow;
+    // fluid sites of every inflow per band (row of tiles), column and lane, so steps don't count walls again
+    std::vector<std::vector<int>> m_inflowFluid;
+    // recounts m_inflowFluid, after the inflow, the tiles or the walls changed
+    void countInflowFluid();
+    // one generator per band, advance() runs the inflow of bands in parallel
+    std::vector<std::mt19937> m_bandRandGens;
+
+    // random offset into the chirality plane for this step, 0 if it is not used
+    int nextChiralityShift();
+
+    // starts m_randGen for the initial conditions of replica, see the constructor
+    void seedReplica(uint32_t seed, int replica);
+
+    // per row pair(x, label) of the obstacle wall sites, sorted by x
+    std::vector<std::vector<std::pair<int, int>>> m_obstacleRows;
+    // momentum (vx, vy for every label) taken by the obstacles in the current step, summed over tiles
+    std::vector<std::atomic<long long>> m_obstacleMomentum;
+    std::vector<std::vector<std::pair<double, double>>> m_obstacleForces;
+
+    // adds the momentum of the particles about to bounce off obstacle sites of tile, before they collide
+    void measureObstacles(const Lattice& grid, const TileScheduler::Tile& tile, std::atomic<long long>* obstacleMomentum);
+
+    // moves the momentum of one step into m_obstacleForces
+    void recordObstacleForces(std::atomic<long long>* obstacleMomentum);
 
-    // update single row
-    void moveRow(int y, std::vector<std::vector<uint8_t>>& tempGrid);
+    int m_tileWidth = 1024;
+    int m_tileHeight = 16;
+    int m_fieldTileWidth = 0;
+    int m_fieldTileHeight = 0;
+    // site tiles weighted by fluid sites, used by moveStep and colissionStep
+    TileScheduler m_tiles;
 
-    // runs m_numThreads instances of function fn with parameter threadNumber [0...m_numThreads-1]
-    void runThreaded(std::function<void(int threadNumber)> fn);
+    // tiles over a field of cellsX x cellsY cells, about the size of the field tiles
+    TileScheduler cellTiles(int cellsX, int cellsY, int cellSizeX, int cellSizeY) const;
 };
 
 #endif // SIMULATION_H
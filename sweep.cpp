@@ -0,0 +1,467 @@
+#include "sweep.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <numeric>
+#include <sstream>
+#include <thread>
+#include "recorder.h"
+#include "warmstart.h"
+
+Sweep::FileSink::FileSink(const std::string& prefix) :
+    m_prefix(prefix)
+{
+    // a new run starts a new force series
+    std::ofstream(m_prefix + "forces.dat", std::ios::out | std::ios::trunc);
+}
+
+void Sweep::FileSink::forces(const Scenario& /*scenario*/, uint64_t firstStep, const std::vector<std::pair<double, double>>& forces)
+{
+    std::ofstream f(m_prefix + "forces.dat", std::ios::out | std::ios::app);
+    for (size_t i = 0; i < forces.size(); i++)
+    {
+        f << firstStep + i << "\t" << forces[i].first << "\t" << forces[i].second << "\n";
+    }
+}
+
+void Sweep::FileSink::sample(const Scenario& /*scenario*/, uint64_t step, const Field& field)
+{
+    std::ofstream f(m_prefix + "vel" + std::to_string(step) + ".dat", std::ios::out);
+    for (int y = 0; y < field.height(); y++)
+    {
+        for (int x = 0; x < field.width(); x++)
+        {
+            size_t c = field.at(x, y);
+            double vx = field.vx()[c];
+            double vy = field.vy()[c];
+            double magnitude = std::sqrt(vx * vx + vy * vy);
+            f << x << "\t" << y << "\t" << vx / magnitude << "\t" << vy / magnitude << "\t" << magnitude << "\t" << field.density()[c] << "\t" << field.vorticity()[c] << "\n";
+        }
+    }
+}
+
+void Sweep::FileSink::finished(const Scenario& scenario, const Summary& summary)
+{
+    std::ofstream f(m_prefix + "summary.dat", std::ios::out);
+    f << "name\t" << scenario.name << "\n"
+      << "steps\t" << summary.steps << "\n"
+      << "seconds\t" << summary.seconds << "\n"
+      << "warmstart\t" << summary.warmStartSeconds << "\n"
+      << "drag\t" << summary.meanDrag << "\n"
+      << "lift\t" << summary.meanLift << "\n"
+      << "stopped\t" << summary.stopped << "\n"
+      << "window\t" << summary.windowOffset << "\n";
+    if (scenario.geometry) f << "fluid\t" << double(scenario.geometry->fluidSites()) / (double(scenario.width) * scenario.height) << "\n";
+    for (size_t i = 0; i < summary.probes.size(); i++)
+    {
+        const Probes::Probe& probe = scenario.probes[i];
+        const Probes::Estimate& estimate = summary.probes[i];
+        f << "probe\t" << probe.x << "\t" << probe.y << "\tfrequency\t" << estimate.frequency << "\tpower\t" << estimate.power << "\twindows\t" << estimate.windows << "\n";
+    }
+    if (!summary.error.empty()) f << "error\t" << summary.error << "\n";
+}
+
+Sweep::Sweep(int numThreads) :
+    m_numThreads(numThreads > 0 ? numThreads : std::max(1u, std::thread::hardware_concurrency()))
+{
+}
+
+int Sweep::add(const Scenario& scenario)
+{
+    m_scenarios.push_back(scenario);
+    return int(m_scenarios.size()) - 1;
+}
+
+void Sweep::stop()
+{
+    m_stop = true;
+}
+
+int Sweep::getNumThreads() const
+{
+    return m_numThreads;
+}
+
+int Sweep::preferredThreads(const Scenario& scenario, int maxThreads)
+{
+    // below that a thread spends more time starting and syncing than stepping
+    const long long bytesPerThread = 1 << 18;
+    long long bytes = (long long)scenario.width * scenario.height * scenario.replicas;
+    return int(std::max(1LL, std::min<long long>(maxThreads, bytes / bytesPerThread)));
+}
+
+std::vector<Sweep::Summary> Sweep::run()
+{
+    m_stop = false;
+    int numJobs = int(m_scenarios.size());
+    std::vector<Summary> summaries(numJobs);
+
+    // largest work first, the small jobs fill the gaps at the end
+    std::vector<int> queue(numJobs);
+    std::iota(queue.begin(), queue.end(), 0);
+    auto work = [this](int j)
+    {
+        const Scenario& s = m_scenarios[j];
+        return double(s.width) * s.height * s.replicas * s.steps;
+    };
+    std::stable_sort(queue.begin(), queue.end(), [&](int a, int b) { return work(a) > work(b); });
+
+    struct Job
+    {
+        std::thread thread;
+        std::atomic<int> share = 0;
+        int preferred = 1;
+        bool running = false;
+        bool done = false;
+    };
+    std::unique_ptr<Job[]> jobs(new Job[numJobs]);
+    std::mutex mutex;
+    std::condition_variable jobDone;
+    int freeThreads = m_numThreads;
+    int running = 0;
+    size_t next = 0;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        while (next < queue.size() && freeThreads > 0 && !m_stop)
+        {
+            int j = queue[next++];
+            Job& job = jobs[j];
+            job.preferred = preferredThreads(m_scenarios[j], m_numThreads);
+            job.share = std::min(job.preferred, freeThreads);
+            freeThreads -= job.share;
+            job.running = true;
+            running++;
+            job.thread = std::thread([&, j]()
+            {
+                Summary summary = runJob(m_scenarios[j], jobs[j].share, m_stop);
+                std::scoped_lock l(mutex);
+                summaries[j] = summary;
+                jobs[j].done = true;
+                jobDone.notify_one();
+            });
+        }
+        if (m_stop)
+        {
+            // queued jobs never start
+            for (; next < queue.size(); next++)
+            {
+                summaries[queue[next]].stopped = true;
+            }
+        }
+
+        // nothing left to start, spare threads go to the running jobs that are furthest below their preferred count
+        while (next == queue.size() && freeThreads > 0)
+        {
+            int best = -1;
+            for (int j = 0; j < numJobs; j++)
+            {
+                if (!jobs[j].running || jobs[j].done || jobs[j].share >= jobs[j].preferred) continue;
+                if (best < 0 || jobs[j].preferred - jobs[j].share > jobs[best].preferred - jobs[best].share) best = j;
+            }
+            if (best < 0) break;
+            jobs[best].share++;
+            freeThreads--;
+        }
+
+        if (running == 0) break;
+        jobDone.wait(lock, [&]()
+        {
+            for (int j = 0; j < numJobs; j++)
+            {
+                if (jobs[j].running && jobs[j].done) return true;
+            }
+            return false;
+        });
+        for (int j = 0; j < numJobs; j++)
+        {
+            if (!jobs[j].running || !jobs[j].done) continue;
+            jobs[j].thread.join();
+            jobs[j].running = false;
+            freeThreads += jobs[j].share;
+            running--;
+        }
+    }
+    return summaries;
+}
+
+std::shared_ptr<Geometry> Sweep::plateGeometry(const Scenario& scenario, int numThreads)
+{
+    int h = scenario.height;
+    auto geometry = std::make_shared<Geometry>(scenario.width, h);
+    geometry->addChannelWalls();
+    geometry->addRect(scenario.barrierPos - scenario.barrierHeight / 4, h / 2 - scenario.barrierHeight / 2,
+        scenario.barrierPos + scenario.barrierHeight / 4, h / 2 + scenario.barrierHeight / 2, true);
+    geometry->rasterise(numThreads);
+    return geometry;
+}
+
+Sweep::Scenario Sweep::loadScenario(const std::string& path, int numThreads)
+{
+    std::ifstream f(path, std::ios::in);
+    if (!f) throw "Sweep::loadScenario can't open file";
+    std::string directory = path.find('/') == std::string::npos ? "" : path.substr(0, path.rfind('/') + 1);
+
+    Scenario scenario;
+    scenario.name = path;
+    std::shared_ptr<Geometry> geometry;
+    std::string line;
+    while (std::getline(f, line))
+    {
+        line = line.substr(0, line.find('#'));
+        std::istringstream in(line);
+        std::string directive;
+        if (!(in >> directive)) continue;
+
+        // the rest of the line, optional words have to be at the end
+        auto measured = [&in]()
+        {
+            std::string word;
+            return bool(in >> word) && word == "measure";
+        };
+        auto needGeometry = [&geometry]()
+        {
+            if (!geometry) throw "Sweep::loadScenario shape before size";
+        };
+
+        // particles per 7 channels
+        auto inRange = [](float concentration)
+        {
+            return concentration >= 0 && concentration <= 1;
+        };
+
+        bool ok = true;
+        if (directive == "size")
+        {
+            ok = bool(in >> scenario.width >> scenario.height) && scenario.width > 0 && scenario.height > 0;
+            if (ok) geometry = std::make_shared<Geometry>(scenario.width, scenario.height);
+        }
+        else if (directive == "steps") ok = bool(in >> scenario.steps);
+        else if (directive == "reserve") ok = bool(in >> scenario.reserveWidth);
+        else if (directive == "inflow") ok = bool(in >> scenario.inflowLeft >> scenario.inflowRight) && inRange(scenario.inflowLeft) && inRange(scenario.inflowRight);
+        else if (directive == "initial") ok = bool(in >> scenario.initialConcentration) && inRange(scenario.initialConcentration);
+        else if (directive == "replicas") ok = bool(in >> scenario.replicas) && scenario.replicas > 0;
+        else if (directive == "sample") ok = bool(in >> scenario.sampleEvery >> scenario.cellSize);
+        else if (directive == "variant")
+        {
+            std::string variant;
+            ok = bool(in >> variant);
+            if (variant == "fhp1") scenario.variant = Simulation::Variant::FHP1;
+            else if (variant == "fhp2") scenario.variant = Simulation::Variant::FHP2;
+            else if (variant == "fhp3") scenario.variant = Simulation::Variant::FHP3;
+            else ok = false;
+        }
+        else if (directive == "channel")
+        {
+            needGeometry();
+            geometry->addChannelWalls();
+        }
+        else if (directive == "rect")
+        {
+            needGeometry();
+            int x0, y0, x1, y1;
+            ok = bool(in >> x0 >> y0 >> x1 >> y1);
+            if (ok) geometry->addRect(x0, y0, x1, y1, measured());
+        }
+        else if (directive == "circle")
+        {
+            needGeometry();
+            double cx, cy, r;
+            ok = bool(in >> cx >> cy >> r);
+            if (ok) geometry->addCircle(cx, cy, r, measured());
+        }
+        else if (directive == "mask")
+        {
+            needGeometry();
+            std::string file;
+            int x, y;
+            ok = bool(in >> file >> x >> y);
+            int scale = 1;
+            bool measure = false;
+            std::string word;
+            while (ok && in >> word)
+            {
+                if (word == "measure") measure = true;
+                else scale = std::atoi(word.c_str());
+            }
+            if (ok) geometry->addMask(file[0] == '/' ? file : directory + file, x, y, scale, measure);
+        }
+        else if (directive == "probe")
+        {
+            Probes::Probe probe{0, 0, 2};
+            ok = bool(in >> probe.x >> probe.y);
+            int radius;
+            if (in >> radius) probe.radius = radius;
+            scenario.probes.push_back(probe);
+        }
+        else if (directive == "record")
+        {
+            ok = bool(in >> scenario.recordFrom >> scenario.recordTo) && scenario.recordFrom >= 0 && scenario.recordTo > scenario.recordFrom;
+            int keyframes;
+            if (in >> keyframes) scenario.recordKeyframes = keyframes;
+        }
+        else if (directive == "warmstart")
+        {
+            ok = bool(in >> scenario.warmStartFactor) && scenario.warmStartFactor > 1;
+            int steps;
+            if (in >> steps) scenario.warmStartSteps = steps;
+        }
+        else if (directive == "window") ok = bool(in >> scenario.windowFrom >> scenario.windowEvery >> scenario.windowColumns) && scenario.windowFrom >= 0 && scenario.windowEvery > 0 && scenario.windowColumns > 0;
+        else if (directive == "spectrum") ok = bool(in >> scenario.probeMinFrequency >> scenario.probeMaxFrequency >> scenario.probeBins >> scenario.probeWindow);
+        else if (directive == "porous")
+        {
+            needGeometry();
+            int count, size;
+            uint32_t seed;
+            ok = bool(in >> count >> size >> seed);
+            if (ok) geometry->addPorous(count, size, seed);
+        }
+        else throw "Sweep::loadScenario unknown directive";
+        if (!ok) throw "Sweep::loadScenario bad arguments";
+    }
+    if (!geometry) throw "Sweep::loadScenario no size";
+    // the variant may come after the concentrations, FHP-I has no rest particle
+    float most = scenario.variant == Simulation::Variant::FHP1 ? 6 / 7.f : 1.f;
+    if (scenario.inflowLeft > most || scenario.inflowRight > most || scenario.initialConcentration > most) throw "Sweep::loadScenario bad arguments";
+
+    geometry->rasterise(numThreads);
+    scenario.geometry = geometry;
+    return scenario;
+}
+
+Sweep::Summary Sweep::runJob(const Scenario& scenario, const std::atomic<int>& share, const std::atomic_bool& stop)
+{
+    Summary summary;
+    auto t = std::chrono::steady_clock::now();
+    try
+    {
+        int w = scenario.width;
+        int h = scenario.height;
+        std::shared_ptr<const Geometry> geometry = scenario.geometry ? scenario.geometry : plateGeometry(scenario, share);
+        if (geometry->width() != w || geometry->height() != h) throw "Sweep::runJob geometry size differs from scenario";
+        bool moving = scenario.windowEvery > 0 && scenario.windowColumns > 0;
+        if (moving && (!scenario.probes.empty() || !scenario.recordPath.empty())) throw "Sweep::runJob probes and recording need a still window";
+        std::vector<Simulation::Inflow> inflow = {{scenario.inflowLeft, 0, scenario.reserveWidth}, {scenario.inflowRight, w - scenario.reserveWidth, scenario.reserveWidth}};
+        WarmStart::Coarse coarse;
+        if (scenario.warmStartFactor > 1)
+        {
+            coarse = WarmStart::develop(*geometry, inflow, scenario.initialConcentration, scenario.variant, scenario.warmStartFactor, scenario.warmStartSteps, share);
+            summary.warmStartSeconds = coarse.seconds;
+        }
+
+        Simulation sim(w, h, share, [&](Simulation* sim)
+        {
+            // before spawning, FHP-I has no rest particles
+            sim->setVariant(scenario.variant);
+            // walls first, so spawning only counts and fills fluid sites
+            geometry->paint(sim->getGrid(), 1, share);
+            if (coarse.cellSize > 0) sim->seedEquilibrium(coarse.field, coarse.cellSize, coarse.cellSize);
+            else
+            {
+                sim->spawnAtX(scenario.initialConcentration, 0, w);
+                sim->spawnAtX(scenario.inflowLeft, 0, scenario.reserveWidth);
+            }
+        }, scenario.replicas);
+        std::vector<int> obstacles = geometry->addObstacles(sim);
+        int block = obstacles.empty() ? -1 : obstacles[0];
+        sim.setInflow(inflow);
+        Probes probes(scenario.probeMinFrequency, scenario.probeMaxFrequency, scenario.probeBins, scenario.probeWindow);
+        for (const Probes::Probe& probe : scenario.probes)
+        {
+            probes.add(probe.x, probe.y, probe.radius);
+        }
+        int lanes = sim.getReplicas();
+        std::unique_ptr<Recorder> recorder;
+        if (!scenario.recordPath.empty()) recorder.reset(new Recorder(scenario.recordPath, sim, scenario.recordKeyframes));
+        bool developed = false;
+        if (scenario.sink) scenario.sink->started(scenario, share);
+
+        int batch = scenario.sampleEvery > 0 ? scenario.sampleEvery : 1000;
+        uint64_t developedFrom = uint64_t(scenario.steps) / 2;
+        std::pair<double, double> forceSum = {0., 0.};
+        uint64_t forceCount = 0;
+        while (summary.steps < uint64_t(scenario.steps) && !stop)
+        {
+            // up to the next multiple of the batch, the clips below would otherwise put the samples off their cadence
+            int n = int(std::min<uint64_t>(batch - summary.steps % batch, scenario.steps - summary.steps));
+            if (recorder && summary.steps >= uint64_t(scenario.recordFrom) && summary.steps < uint64_t(scenario.recordTo))
+            {
+                // step by step while recording, every frame is coded against the one before
+                recorder->record(sim);
+                n = 1;
+            }
+            else if (recorder && summary.steps < uint64_t(scenario.recordFrom)) n = int(std::min<uint64_t>(n, scenario.recordFrom - summary.steps));
+            if (moving)
+            {
+                // up to the next shift
+                uint64_t from = uint64_t(scenario.windowFrom);
+                uint64_t next = summary.steps < from ? from : from + ((summary.steps - from) / scenario.windowEvery + 1) * scenario.windowEvery;
+                n = int(std::min<uint64_t>(n, next - summary.steps));
+            }
+            if (!developed && summary.steps >= developedFrom)
+            {
+                probes.reset();
+                developed = true;
+            }
+            sim.setNumThreads(share);
+            sim.advance(n, [&](const Lattice& grid, int fromRow, int toRow, uint64_t)
+            {
+                probes.sample(grid, lanes, fromRow, toRow);
+            });
+
+            if (block >= 0)
+            {
+                const auto& forces = sim.getObstacleForces(block);
+                for (size_t i = 0; i < forces.size(); i++)
+                {
+                    if (summary.steps + i < developedFrom) continue;
+                    forceSum.first += forces[i].first;
+                    forceSum.second += forces[i].second;
+                    forceCount++;
+                }
+                if (scenario.sink) scenario.sink->forces(scenario, summary.steps, forces);
+                // a long run would otherwise keep every step's force
+                sim.clearObstacleForces();
+            }
+            summary.steps += n;
+
+            if (moving && summary.steps > uint64_t(scenario.windowFrom) && (summary.steps - scenario.windowFrom) % scenario.windowEvery == 0)
+            {
+                // new columns continue the flow in front of the outflow reservoir
+                int reserve = std::min(scenario.reserveWidth, w / 4);
+                Field outflow = sim.getRegionField(w - 2 * reserve - 1, 0, w - reserve, h, 2 * reserve + 1, h, Field::Velocity | Field::Density);
+                sim.shiftWindow(scenario.windowColumns, outflow.density()[0], outflow.vx()[0], outflow.vy()[0], [&](int64_t x, int y)
+                {
+                    return geometry->isWall(int(std::min<int64_t>(x, w - 1)), y);
+                });
+                summary.windowOffset = sim.getWindowOffset();
+            }
+
+            if (scenario.sink && scenario.sampleEvery > 0 && summary.steps % scenario.sampleEvery == 0)
+            {
+                scenario.sink->sample(scenario, summary.steps, sim.getField(scenario.cellSize, scenario.cellSize, Field::Velocity | Field::Density | Field::Vorticity));
+            }
+        }
+        summary.stopped = summary.steps < uint64_t(scenario.steps);
+        for (int p = 0; p < probes.getNumProbes(); p++)
+        {
+            summary.probes.push_back(probes.getEstimate(p));
+        }
+        if (forceCount > 0)
+        {
+            summary.meanDrag = forceSum.first / forceCount;
+            summary.meanLift = forceSum.second / forceCount;
+        }
+    }
+    catch (const char* message)
+    {
+        summary.error = message;
+    }
+    summary.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+    if (scenario.sink) scenario.sink->finished(scenario, summary);
+    return summary;
+}
@@ -0,0 +1,149 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+#include <atomic>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "field.h"
+#include "geometry.h"
+#include "probes.h"
+#include "simulation.h"
+
+/* runs a queue of plate-like scenarios side by side, sharing the hardware threads of the machine
+every job gets a share of the threads, as many as its grid scales to but never more than are free,
+so small grids run many at a time on one or two threads each and a big grid gets the whole machine
+jobs start largest first, threads freed by a finished job go to the next queued job or, once the queue is empty,
+to running jobs below their preferred count, a job takes a changed share between its batches of steps */
+class Sweep
+{
+public:
+    struct Summary
+    {
+        uint64_t steps = 0;
+        double seconds = 0;
+        // of seconds, developing the flow on the coarse lattice of the warm start
+        double warmStartSeconds = 0;
+        // obstacle force averaged over the second half of the run, when the flow has developed
+        double meanDrag = 0;
+        double meanLift = 0;
+        bool stopped = false;
+        // columns the moving window has moved, sampled field x + windowOffset is the column of the whole channel
+        int64_t windowOffset = 0;
+        // shedding estimates of the scenario's probes, spectra also only from the second half
+        std::vector<Probes::Estimate> probes;
+        // message of the exception the job threw, empty if it didn't
+        std::string error;
+    };
+
+    struct Scenario;
+
+    // receives the results of one job, called from that job's thread
+    class ResultSink
+    {
+    public:
+        virtual ~ResultSink() = default;
+        virtual void started(const Scenario& /*scenario*/, int /*threads*/) {}
+        // drag/lift of the block for steps [firstStep...firstStep + forces.size())
+        virtual void forces(const Scenario& /*scenario*/, uint64_t /*firstStep*/, const std::vector<std::pair<double, double>>& /*forces*/) {}
+        // velocity, density and vorticity every sampleEvery steps
+        virtual void sample(const Scenario& /*scenario*/, uint64_t /*step*/, const Field& /*field*/) {}
+        virtual void finished(const Scenario& /*scenario*/, const Summary& /*summary*/) {}
+    };
+
+    // writes prefix + "forces.dat" (step drag lift), prefix + "vel<step>.dat" like SimRunner::saveVelToFile plus density and vorticity and prefix + "summary.dat"
+    class FileSink : public ResultSink
+    {
+    public:
+        explicit FileSink(const std::string& prefix);
+        void forces(const Scenario& scenario, uint64_t firstStep, const std::vector<std::pair<double, double>>& forces) override;
+        void sample(const Scenario& scenario, uint64_t step, const Field& field) override;
+        void finished(const Scenario& scenario, const Summary& summary) override;
+
+    private:
+        std::string m_prefix;
+    };
+
+    // the channel of SimRunner::plate: walls top and bottom, reservoirs left and right and a block in the flow
+    struct Scenario
+    {
+        std::string name;
+        int width = 4000;
+        int height = 1000;
+        int reserveWidth = 50;
+        int steps = 100000;
+        int barrierHeight = 400;
+        int barrierPos = 700;
+        int replicas = 1;
+        float inflowLeft = 0.4f;
+        float inflowRight = 0.2f;
+        float initialConcentration = 0.2f;
+        Simulation::Variant variant = Simulation::Variant::FHP3;
+        // 0 takes no field samples
+        int sampleEvery = 0;
+        int cellSize = 4;
+        /* walls and obstacles, rasterised, the forces of the first measured shape are the ones reported
+        null makes the plate channel with the block of barrierHeight at barrierPos */
+        std::shared_ptr<const Geometry> geometry;
+        // shedding probes, spectra of probeBins bins over [probeMinFrequency...probeMaxFrequency] cycles per step, probeWindow steps a window
+        std::vector<Probes::Probe> probes;
+        double probeMinFrequency = 1e-4;
+        double probeMaxFrequency = 5e-3;
+        int probeBins = 50;
+        int probeWindow = 10000;
+        // the full lattice at every step of [recordFrom...recordTo) goes to recordPath, see Recorder, empty records nothing
+        std::string recordPath;
+        int recordFrom = 0;
+        int recordTo = 0;
+        int recordKeyframes = 100;
+        // > 1 starts from the flow developed on a lattice that many times coarser, see WarmStart, warmStartSteps 0 takes its default
+        int warmStartFactor = 0;
+        int warmStartSteps = 0;
+        /* moving window: from step windowFrom on the lattice moves windowColumns downstream every windowEvery steps,
+        see Simulation::shiftWindow, new columns get the walls of the geometry's last column and the equilibrium of the flow
+        in front of the outflow reservoir, 0 windowEvery keeps it still, probes and recording need a still window */
+        int windowFrom = 0;
+        int windowEvery = 0;
+        int windowColumns = 0;
+        std::shared_ptr<ResultSink> sink;
+    };
+
+    /* reads a scenario file, one directive per line, # starts a comment, size has to come before the shapes
+    size w h | steps n | reserve w | inflow left right | initial c | replicas n | variant fhp1/fhp2/fhp3 | sample every cellSize
+    channel | rect x0 y0 x1 y1 [measure] | circle cx cy r [measure] | mask file.pbm x y [scale] [measure] | porous count size seed
+    probe x y [radius] | spectrum minFrequency maxFrequency bins window | record fromStep toStep [keyframeInterval]
+    warmstart factor [coarseSteps] | window fromStep every columns
+    mask paths are relative to the scenario file, the geometry is rasterised right away on numThreads threads
+    concentrations are particles per 7 channels, up to 1, or 6/7 in FHP-I */
+    static Scenario loadScenario(const std::string& path, int numThreads);
+
+    // plate's channel and measured block for the size, barrierHeight and barrierPos of scenario, rasterised
+    static std::shared_ptr<Geometry> plateGeometry(const Scenario& scenario, int numThreads);
+
+    // numThreads 0 uses all hardware threads
+    explicit Sweep(int numThreads = 0);
+
+    // queues a job, returns its index
+    int add(const Scenario& scenario);
+
+    // runs all queued jobs, returns when they are done or stopped, the summaries are in job order
+    std::vector<Summary> run();
+
+    // running jobs end after their current batch, queued ones don't start
+    void stop();
+
+    int getNumThreads() const;
+
+    // threads a scenario still gains from on its own, roughly one per 256 KiB of lattice
+    static int preferredThreads(const Scenario& scenario, int maxThreads);
+
+private:
+    int m_numThreads;
+    std::vector<Scenario> m_scenarios;
+    std::atomic_bool m_stop = false;
+
+    // runs one scenario, share is read before every batch
+    static Summary runJob(const Scenario& scenario, const std::atomic<int>& share, const std::atomic_bool& stop);
+};
+
+#endif // SWEEP_H
@@ -0,0 +1,87 @@
+#include "taskgraph.h"
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+TaskGraph::TaskGraph(int numBands, bool wrap) :
+    m_numBands(numBands),
+    m_wrap(wrap)
+{
+}
+
+void TaskGraph::run(int numThreads, int numSteps, const std::function<void(int band, int step)>& fn) const
+{
+    if (m_numBands <= 0 || numSteps <= 0) return;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    // steps finished by every band, a band is queued at most once, for its next step
+    std::vector<int> done(m_numBands, 0);
+    std::vector<char> queued(m_numBands, 0);
+    std::deque<int> ready;
+    long long remaining = (long long)m_numBands * numSteps;
+
+    // call with the mutex held
+    auto enqueueIfReady = [&](int band)
+    {
+        if (!m_wrap && (band < 0 || band >= m_numBands)) return;
+        band = (band + m_numBands) % m_numBands;
+        int step = done[band];
+        if (queued[band] || step >= numSteps) return;
+        for (int neighbour : { band - 1, band + 1 })
+        {
+            if (!m_wrap && (neighbour < 0 || neighbour >= m_numBands)) continue;
+            if (done[(neighbour + m_numBands) % m_numBands] < step) return;
+        }
+        queued[band] = 1;
+        ready.push_back(band);
+    };
+
+    for (int band = 0; band < m_numBands; band++)
+    {
+        enqueueIfReady(band);
+    }
+
+    auto worker = [&]()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            wake.wait(lock, [&]() { return !ready.empty() || remaining == 0; });
+            if (remaining == 0) return;
+            int band = ready.front();
+            ready.pop_front();
+            int step = done[band];
+
+            lock.unlock();
+            fn(band, step);
+            lock.lock();
+
+            done[band]++;
+            queued[band] = 0;
+            remaining--;
+            for (int neighbour : { band - 1, band, band + 1 })
+            {
+                enqueueIfReady(neighbour);
+            }
+            // this thread takes the first ready band itself
+            if (remaining == 0) wake.notify_all();
+            for (size_t i = 1; i < ready.size(); i++)
+            {
+                wake.notify_one();
+            }
+        }
+    };
+
+    numThreads = std::max(1, std::min(numThreads, m_numBands));
+    std::vector<std::thread> threads;
+    for (int t = 1; t < numThreads; t++)
+    {
+        threads.push_back(std::thread(worker));
+    }
+    worker();
+    for (auto& t : threads) t.join();
+}
@@ -0,0 +1,23 @@
+#ifndef TASKGRAPH_H
+#define TASKGRAPH_H
+#include <functional>
+
+/* runs numSteps steps over numBands bands of rows without a barrier between the steps
+task (band b, step t) starts as soon as bands b-1, b and b+1 are done with step t-1, that covers
+both the rows b reads and, with two alternating lattices, the rows it overwrites
+so a wavefront of steps moves over the grid and no thread waits for the slowest band of the step */
+class TaskGraph
+{
+public:
+    // wrap makes the first and the last band neighbours (periodic y)
+    TaskGraph(int numBands, bool wrap);
+
+    // calls fn(band, step) for every band and step [0...numSteps) on numThreads threads, returns when all are done
+    void run(int numThreads, int numSteps, const std::function<void(int band, int step)>& fn) const;
+
+private:
+    int m_numBands;
+    bool m_wrap;
+};
+
+#endif // TASKGRAPH_H
@@ -0,0 +1,82 @@
+#include "tilescheduler.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+
+TileScheduler::TileScheduler(int width, int height, int tileWidth, int tileHeight, const std::function<int(const Tile&)>& weight)
+{
+    tileWidth = std::max(1, std::min(tileWidth, width));
+    tileHeight = std::max(1, std::min(tileHeight, height));
+
+    // row-major, so consecutive tiles of a thread stay close in memory
+    for (int y = 0; y < height; y += tileHeight)
+    {
+        for (int x = 0; x < width; x += tileWidth)
+        {
+            Tile tile = { x, y, std::min(x + tileWidth, width), std::min(y + tileHeight, height), 0 };
+            tile.weight = weight ? std::max(1, weight(tile)) : (tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+            m_tiles.push_back(tile);
+        }
+    }
+
+    m_weightSums.assign(m_tiles.size() + 1, 0);
+    for (size_t i = 0; i < m_tiles.size(); i++)
+    {
+        m_weightSums[i + 1] = m_weightSums[i] + m_tiles[i].weight;
+    }
+}
+
+const std::vector<TileScheduler::Tile>& TileScheduler::getTiles() const
+{
+    return m_tiles;
+}
+
+void TileScheduler::run(int numThreads, const std::function<void(const Tile&)>& fn) const
+{
+    run(numThreads, fn, 0, m_tiles.empty() ? 0 : m_tiles.back().y1);
+}
+
+void TileScheduler::run(int numThreads, const std::function<void(const Tile&)>& fn, int fromRow, int toRow) const
+{
+    // tiles are row-major, so the ones starting in the rows are a contiguous range
+    int first = int(std::lower_bound(m_tiles.begin(), m_tiles.end(), fromRow, [](const Tile& t, int row) { return t.y0 < row; }) - m_tiles.begin());
+    int last = int(std::lower_bound(m_tiles.begin(), m_tiles.end(), toRow, [](const Tile& t, int row) { return t.y0 < row; }) - m_tiles.begin());
+    int numTiles = last - first;
+    if (numTiles <= 0) return;
+    numThreads = std::max(1, std::min(numThreads, numTiles));
+
+    // thread t owns tiles [begin[t]...begin[t+1]), split so every thread gets the same weight
+    std::vector<int> begin(numThreads + 1, last);
+    begin[0] = first;
+    for (int t = 1; t < numThreads; t++)
+    {
+        long long target = m_weightSums[first] + (m_weightSums[last] - m_weightSums[first]) * t / numThreads;
+        begin[t] = int(std::lower_bound(m_weightSums.begin() + first, m_weightSums.begin() + last, target) - m_weightSums.begin());
+        begin[t] = std::max(begin[t], begin[t - 1]);
+    }
+
+    // next unclaimed tile of every queue, owner and thieves both claim with fetch_add
+    std::unique_ptr<std::atomic<int>[]> next(new std::atomic<int>[numThreads]);
+    for (int t = 0; t < numThreads; t++) next[t] = begin[t];
+
+    auto worker = [&](int t)
+    {
+        for (int k = 0; k < numThreads; k++)
+        {
+            int queue = (t + k) % numThreads;
+            for (int i = next[queue]++; i < begin[queue + 1]; i = next[queue]++)
+            {
+                fn(m_tiles[i]);
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int t = 1; t < numThreads; t++)
+    {
+        threads.push_back(std::thread(worker, t));
+    }
+    worker(0);
+    for (auto& t : threads) t.join();
+}
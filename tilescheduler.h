@@ -0,0 +1,40 @@
+#ifndef TILESCHEDULER_H
+#define TILESCHEDULER_H
+#include <functional>
+#include <vector>
+
+/* splits a width x height index space into 2D tiles and runs them on a set of threads
+tiles are handed out to the threads as contiguous runs of roughly equal total weight,
+a thread that runs out of its own tiles steals the next unclaimed ones from the others */
+class TileScheduler
+{
+public:
+    struct Tile
+    {
+        int x0;
+        int y0;
+        int x1; // exclusive
+        int y1; // exclusive
+        int weight;
+    };
+
+    TileScheduler() = default;
+
+    // weight estimates the cost of a tile, tiles cost their area if it's not given
+    TileScheduler(int width, int height, int tileWidth, int tileHeight, const std::function<int(const Tile&)>& weight = nullptr);
+
+    const std::vector<Tile>& getTiles() const;
+
+    // runs fn on every tile exactly once using numThreads threads, returns when all are done
+    void run(int numThreads, const std::function<void(const Tile&)>& fn) const;
+
+    // same, only for the tiles starting in rows [fromRow...toRow)
+    void run(int numThreads, const std::function<void(const Tile&)>& fn, int fromRow, int toRow) const;
+
+private:
+    std::vector<Tile> m_tiles;
+    // prefix sums of the weights, used to split the tiles between threads
+    std::vector<long long> m_weightSums;
+};
+
+#endif // TILESCHEDULER_H
@@ -0,0 +1,1086 @@
+#include "verifier.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <random>
+#include <tuple>
+#include <unistd.h>
+#include "autotune.h"
+#include "recorder.h"
+
+namespace
+{
+// where the particle arriving in direction k comes from: dx on even rows, dx on odd rows, dy
+const int sourceOffsets[6][3] = { {1, 0, 1}, {0, -1, 1}, {-1, -1, 0}, {0, -1, -1}, {1, 0, -1}, {1, 1, 0} };
+// momentum of direction k, vx in multiples of 1/2, vy in multiples of sqrt(3)/2
+const int dirVx[6] = { -1, 1, 2, 1, -1, -2 };
+const int dirVy[6] = { 1, 1, 0, -1, -1, 0 };
+
+const char* boundaryNames[] = { "open", "periodic", "bounce-back" };
+const char* variantNames[] = { "FHP-I", "FHP-II", "FHP-III" };
+const char* modeNames[] = { "random", "alternating", "random-plane" };
+
+// the hand-written FHP-III table the rule-based generator replaced, [chirality][state]
+const uint8_t fhp3Table[2][256] = {
+    {
+        0x00, 0x01, 0x02, 0x03, 0x04, 0x42, 0x06, 0x07, 0x08, 0x24, 0x44, 0x26, 0x0c, 0x4a, 0x0e, 0x0f,
+        0x10, 0x60, 0x09, 0x62, 0x48, 0x2a, 0x0d, 0x66, 0x18, 0x34, 0x54, 0x2d, 0x1c, 0x5a, 0x1e, 0x6e,
+        0x20, 0x21, 0x41, 0x23, 0x12, 0x13, 0x45, 0x27, 0x50, 0x51, 0x15, 0x53, 0x1a, 0x36, 0x4d, 0x57,
+        0x30, 0x31, 0x29, 0x33, 0x68, 0x69, 0x1b, 0x6b, 0x38, 0x39, 0x74, 0x75, 0x3c, 0x7a, 0x5d, 0x3f,
+        0x40, 0x22, 0x05, 0x43, 0x0a, 0x0b, 0x46, 0x47, 0x14, 0x64, 0x16, 0x17, 0x4c, 0x56, 0x4e, 0x4f,
+        0x28, 0x32, 0x49, 0x65, 0x2c, 0x6a, 0x2e, 0x2f, 0x58, 0x3a, 0x6c, 0x6d, 0x5c, 0x3e, 0x5e, 0x5f,
+        0x11, 0x61, 0x25, 0x63, 0x52, 0x2b, 0x4b, 0x67, 0x19, 0x72, 0x55, 0x37, 0x1d, 0x76, 0x1f, 0x6f,
+        0x70, 0x71, 0x35, 0x73, 0x59, 0x3b, 0x5b, 0x77, 0x78, 0x79, 0x3d, 0x7b, 0x7c, 0x7d, 0x7e, 0x7f,
+        0x80, 0x88, 0x90, 0x98, 0xa0, 0xa8, 0xb0, 0xb8, 0x81, 0x89, 0x91, 0x99, 0xa1, 0xa9, 0xb1, 0xb9,
+        0x82, 0x8a, 0x92, 0x9a, 0xa2, 0xaa, 0xb2, 0xba, 0x83, 0x8b, 0x93, 0x9b, 0xa3, 0xab, 0xb3, 0xbb,
+        0x84, 0x8c, 0x94, 0x9c, 0xa4, 0xac, 0xb4, 0xbc, 0x85, 0x8d, 0x95, 0x9d, 0xa5, 0xad, 0xb5, 0xbd,
+        0x86, 0x8e, 0x96, 0x9e, 0xa6, 0xae, 0xb6, 0xbe, 0x87, 0x8f, 0x97, 0x9f, 0xa7, 0xaf, 0xb7, 0xbf,
+        0xc0, 0xc8, 0xd0, 0xd8, 0xe0, 0xe8, 0xf0, 0xf8, 0xc1, 0xc9, 0xd1, 0xd9, 0xe1, 0xe9, 0xf1, 0xf9,
+        0xc2, 0xca, 0xd2, 0xda, 0xe2, 0xea, 0xf2, 0xfa, 0xc3, 0xcb, 0xd3, 0xdb, 0xe3, 0xeb, 0xf3, 0xfb,
+        0xc4, 0xcc, 0xd4, 0xdc, 0xe4, 0xec, 0xf4, 0xfc, 0xc5, 0xcd, 0xd5, 0xdd, 0xe5, 0xed, 0xf5, 0xfd,
+        0xc6, 0xce, 0xd6, 0xde, 0xe6, 0xee, 0xf6, 0xfe, 0xc7, 0xcf, 0xd7, 0xdf, 0xe7, 0xef, 0xf7, 0xff
+    },
+    {
+        0x00, 0x01, 0x02, 0x03, 0x04, 0x42, 0x06, 0x07, 0x08, 0x12, 0x44, 0x45, 0x0c, 0x16, 0x0e, 0x0f,
+        0x10, 0x60, 0x24, 0x25, 0x48, 0x2a, 0x4a, 0x4b, 0x18, 0x68, 0x2c, 0x36, 0x1c, 0x6c, 0x1e, 0x6e,
+        0x20, 0x21, 0x41, 0x23, 0x09, 0x62, 0x0b, 0x27, 0x50, 0x32, 0x15, 0x65, 0x54, 0x1b, 0x56, 0x57,
+        0x30, 0x31, 0x51, 0x33, 0x19, 0x72, 0x2d, 0x6b, 0x38, 0x39, 0x59, 0x75, 0x3c, 0x7a, 0x5d, 0x3f,
+        0x40, 0x22, 0x05, 0x43, 0x0a, 0x26, 0x46, 0x47, 0x14, 0x52, 0x0d, 0x66, 0x4c, 0x2e, 0x4e, 0x4f,
+        0x28, 0x29, 0x64, 0x2b, 0x1a, 0x6a, 0x4d, 0x2f, 0x58, 0x74, 0x1d, 0x76, 0x5c, 0x3e, 0x5e, 0x5f,
+        0x11, 0x61, 0x13, 0x63, 0x49, 0x53, 0x17, 0x67, 0x34, 0x35, 0x55, 0x37, 0x5a, 0x5b, 0x1f, 0x6f,
+        0x70, 0x71, 0x69, 0x73, 0x3a, 0x3b, 0x6d, 0x77, 0x78, 0x79, 0x3d, 0x7b, 0x7c, 0x7d, 0x7e, 0x7f,
+        0x80, 0x88, 0x90, 0x98, 0xa0, 0xa8, 0xb0, 0xb8, 0x81, 0x89, 0x91, 0x99, 0xa1, 0xa9, 0xb1, 0xb9,
+        0x82, 0x8a, 0x92, 0x9a, 0xa2, 0xaa, 0xb2, 0xba, 0x83, 0x8b, 0x93, 0x9b, 0xa3, 0xab, 0xb3, 0xbb,
+        0x84, 0x8c, 0x94, 0x9c, 0xa4, 0xac, 0xb4, 0xbc, 0x85, 0x8d, 0x95, 0x9d, 0xa5, 0xad, 0xb5, 0xbd,
+        0x86, 0x8e, 0x96, 0x9e, 0xa6, 0xae, 0xb6, 0xbe, 0x87, 0x8f, 0x97, 0x9f, 0xa7, 0xaf, 0xb7, 0xbf,
+        0xc0, 0xc8, 0xd0, 0xd8, 0xe0, 0xe8, 0xf0, 0xf8, 0xc1, 0xc9, 0xd1, 0xd9, 0xe1, 0xe9, 0xf1, 0xf9,
+        0xc2, 0xca, 0xd2, 0xda, 0xe2, 0xea, 0xf2, 0xfa, 0xc3, 0xcb, 0xd3, 0xdb, 0xe3, 0xeb, 0xf3, 0xfb,
+        0xc4, 0xcc, 0xd4, 0xdc, 0xe4, 0xec, 0xf4, 0xfc, 0xc5, 0xcd, 0xd5, 0xdd, 0xe5, 0xed, 0xf5, 0xfd,
+        0xc6, 0xce, 0xd6, 0xde, 0xe6, 0xee, 0xf6, 0xfe, 0xc7, 0xcf, 0xd7, 0xdf, 0xe7, 0xef, 0xf7, 0xff
+    }
+};
+
+typedef std::array<std::array<uint8_t, 256>, 2> Table;
+
+// the FHP-I and FHP-II rules written out one by one, apart from the generator, [chirality][state]
+Table ruleTable(Simulation::Variant variant)
+{
+    auto bit = [](int dir) { return 1 << ((dir + 6) % 6); };
+    Table table;
+    for (int chirality = 0; chirality < 2; chirality++)
+    {
+        // table 0 turns head-on pairs clockwise
+        int turn = chirality == 0 ? 5 : 1;
+        for (int state = 0; state < 256; state++)
+        {
+            int moving = state & 0b00111111;
+            int rest = state & 0b01000000;
+            int out = state;
+            // bounce-back on walls
+            if (state & 0b10000000) out = (state & 0b11000000) | (((moving << 3) | (moving >> 3)) & 0b00111111);
+            // head-on pairs and symmetric triples, FHP-II lets a rest particle watch
+            else if (rest && variant == Simulation::Variant::FHP1) out = state;
+            else if (moving == 0b001001 || moving == 0b010010 || moving == 0b100100) out = rest | (((moving << turn) | (moving >> (6 - turn))) & 0b00111111);
+            else if (moving == 0b010101 || moving == 0b101010) out = rest | (moving ^ 0b00111111);
+            else if (variant == Simulation::Variant::FHP2)
+            {
+                // two particles 120 degrees apart <-> rest particle + one along their sum
+                for (int d = 0; d < 6; d++)
+                {
+                    if (!rest && moving == (bit(d - 1) | bit(d + 1))) out = 0b01000000 | bit(d);
+                    if (rest && moving == bit(d)) out = bit(d - 1) | bit(d + 1);
+                }
+            }
+            table[chirality][state] = uint8_t(out);
+        }
+    }
+    return table;
+}
+
+// what the reference collides with, FHP-III is the hand-written table
+const Table& referenceTable(int variant)
+{
+    static const Table tables[3] = { ruleTable(Simulation::Variant::FHP1), ruleTable(Simulation::Variant::FHP2), []()
+    {
+        Table table;
+        for (int chirality = 0; chirality < 2; chirality++)
+        {
+            std::copy(fhp3Table[chirality], fhp3Table[chirality] + 256, table[chirality].begin());
+        }
+        return table;
+    }() };
+    return tables[variant];
+}
+
+/* the moveRow of the first solver, open edges, for lane r of row y
+it looks at the incoming particles, instead of the outgoing, so a row only reads its neighbour rows */
+void baselineMoveRow(const Lattice& grid, Lattice& out, int y, int r, int lanes, int width)
+{
+    const int height = grid.height();
+    auto in = [&](int yy, int x) { return grid[yy][x * lanes + r]; };
+    auto to = [&](int x) -> uint8_t& { return out[y][x * lanes + r]; };
+    if (y % 2 == 0)
+    {
+        for (int x = 1; x < width - 1; x++)
+        {
+            to(x) = in(y, x) & 0b11000000;
+            to(x) |= in(y, x - 1) & 0b00000100;
+            to(x) |= in(y, x + 1) & 0b00100000;
+        }
+        to(0) = in(y, 0) & 0b11000000;
+        to(0) |= in(y, 1) & 0b00100000;
+        to(width - 1) = in(y, width - 1) & 0b11000000;
+        to(width - 1) |= in(y, width - 2) & 0b00000100;
+        if (y - 1 >= 0)
+        {
+            for (int x = 0; x < width - 1; x++)
+            {
+                to(x) |= in(y - 1, x) & 0b00001000;
+                to(x) |= in(y - 1, x + 1) & 0b00010000;
+            }
+            to(width - 1) |= in(y - 1, width - 1) & 0b00001000;
+        }
+        if (y + 1 < height)
+        {
+            for (int x = 0; x < width - 1; x++)
+            {
+                to(x) |= in(y + 1, x + 1) & 0b00000001;
+                to(x) |= in(y + 1, x) & 0b00000010;
+            }
+            to(width - 1) |= in(y + 1, width - 1) & 0b00000010;
+        }
+    }
+    else
+    {
+        for (int x = 1; x < width - 1; x++)
+        {
+            to(x) = in(y, x) & 0b11000000;
+            to(x) |= in(y, x - 1) & 0b00000100;
+            to(x) |= in(y, x + 1) & 0b00100000;
+        }
+        to(0) = in(y, 0) & 0b11000000;
+        to(0) |= in(y, 1) & 0b00100000;
+        to(width - 1) = in(y, width - 1) & 0b11000000;
+        to(width - 1) |= in(y, width - 2) & 0b00000100;
+        if (y - 1 >= 0)
+        {
+            for (int x = 1; x < width; x++)
+            {
+                to(x) |= in(y - 1, x - 1) & 0b00001000;
+                to(x) |= in(y - 1, x) & 0b00010000;
+            }
+            to(0) |= in(y - 1, 0) & 0b00010000;
+        }
+        if (y + 1 < height)
+        {
+            for (int x = 1; x < width; x++)
+            {
+                to(x) |= in(y + 1, x) & 0b00000001;
+                to(x) |= in(y + 1, x - 1) & 0b00000010;
+            }
+            to(0) |= in(y + 1, 0) & 0b00000001;
+        }
+    }
+}
+
+// streams through the neighbour table, for every boundary combination
+void neighbourStream(const Lattice& grid, Lattice& out, int width, int lanes, Simulation::Boundary xBoundary, Simulation::Boundary yBoundary)
+{
+    const int height = grid.height();
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            for (int r = 0; r < lanes; r++)
+            {
+                uint8_t own = grid[y][x * lanes + r];
+                uint8_t value = own & 0b11000000;
+                for (int k = 0; k < 6; k++)
+                {
+                    // the particle that left this site in the opposite direction
+                    uint8_t reversed = (own >> ((k + 3) % 6)) & 1;
+                    int sx = x + sourceOffsets[k][y % 2 == 0 ? 0 : 1];
+                    int sy = y + sourceOffsets[k][2];
+                    bool yOutside = sy < 0 || sy >= height;
+                    // open and bounce-back have nothing beyond the edge rows
+                    bool rowExists = !yOutside || yBoundary == Simulation::Boundary::Periodic;
+                    sy = (sy + height) % height;
+
+                    uint8_t bit = 0;
+                    if (sx < 0 || sx >= width)
+                    {
+                        if (xBoundary == Simulation::Boundary::Periodic) bit = rowExists ? (grid[sy][((sx + width) % width) * lanes + r] >> k) & 1 : 0;
+                        else if (xBoundary == Simulation::Boundary::BounceBack) bit = reversed;
+                    }
+                    else if (rowExists)
+                    {
+                        bit = (grid[sy][sx * lanes + r] >> k) & 1;
+                    }
+                    if (yOutside && yBoundary == Simulation::Boundary::BounceBack) bit |= reversed;
+                    value |= bit << k;
+                }
+                out[y][x * lanes + r] = value;
+            }
+        }
+    }
+}
+
+struct Sums
+{
+    long long vx = 0;
+    long long vy = 0;
+    long long count = 0;
+};
+
+// plain bit by bit sums over sites [x0...x1) x [y0...y1) of all lanes
+Sums referenceSums(const Lattice& grid, int lanes, int x0, int x1, int y0, int y1)
+{
+    Sums sums;
+    for (int y = y0; y < y1; y++)
+    {
+        for (int x = x0 * lanes; x < x1 * lanes; x++)
+        {
+            uint8_t value = grid[y][x];
+            for (int k = 0; k < 6; k++)
+            {
+                if (!(value & (1 << k))) continue;
+                sums.vx += dirVx[k];
+                sums.vy += dirVy[k];
+                sums.count++;
+            }
+            sums.count += (value >> 6) & 1;
+        }
+    }
+    return sums;
+}
+
+bool near(double a, double b)
+{
+    return std::fabs(a - b) <= 1e-9 * std::max(1., std::fabs(b));
+}
+
+// fields are float32, so only to float precision
+bool nearFloat(float a, double b)
+{
+    return std::fabs(a - b) <= 1e-6 * std::max(1., std::fabs(b));
+}
+
+// random states everywhere, about every 8th site is a wall, walls may hold particles too
+std::function<void(Simulation*)> randomGrid(std::mt19937& rng, int width, int height)
+{
+    return [&rng, width, height](Simulation* sim)
+    {
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                uint8_t value = rng() & 0b01111111;
+                if (rng() % 8 == 0) value |= 0b10000000;
+                sim->getGrid()[y][x] = value;
+            }
+        }
+    };
+}
+}
+
+void Verifier::Result::check(bool ok, const std::string& what)
+{
+    checks++;
+    if (ok) return;
+    passed = false;
+    failures.push_back(what);
+}
+
+void Verifier::Result::add(const Result& other)
+{
+    passed = passed && other.passed;
+    checks += other.checks;
+    failures.insert(failures.end(), other.failures.begin(), other.failures.end());
+}
+
+Verifier::Result Verifier::checkCollisionTables()
+{
+    Result result;
+    const Simulation::SiteMoments& moments = Simulation::siteMoments;
+
+    for (int variant = 0; variant < 3; variant++)
+    {
+        const auto& table = Simulation::variantLUTs[variant];
+        std::string name = variantNames[variant];
+
+        // states grouped by (mass, momentum), the classes a collision may move within
+        std::map<std::tuple<int, int, int>, int> classSize;
+        for (int state = 0; state < 128; state++)
+        {
+            classSize[{moments.count[state], moments.vx[state], moments.vy[state]}]++;
+        }
+
+        for (int chirality = 0; chirality < 2; chirality++)
+        {
+            std::vector<int> hits(256, 0);
+            for (int state = 0; state < 256; state++)
+            {
+                uint8_t out = table[chirality][state];
+                hits[out]++;
+                std::string at = name + " table " + std::to_string(chirality) + " state " + std::to_string(state);
+
+                result.check(moments.count[out] == moments.count[state], at + " changes mass");
+                if (state & 0b10000000)
+                {
+                    // wall: every moving particle reversed, rest particle and wall stay
+                    int moving = state & 0b00111111;
+                    result.check(out == ((state & 0b11000000) | (((moving << 3) | (moving >> 3)) & 0b00111111)), at + " is not bounce-back");
+                    continue;
+                }
+                result.check(moments.vx[out] == moments.vx[state] && moments.vy[out] == moments.vy[state], at + " changes momentum");
+                result.check(!(out & 0b10000000), at + " creates a wall");
+                if (variant == int(Simulation::Variant::FHP1)) result.check(!(out & 0b01000000) || (state & 0b01000000), at + " creates a rest particle");
+                if (variant == int(Simulation::Variant::FHP3) && classSize[{moments.count[state], moments.vx[state], moments.vy[state]}] > 1)
+                {
+                    result.check(out != state, at + " doesn't collide");
+                }
+            }
+            // a permutation of the states, needed for semi-detailed balance
+            result.check(std::all_of(hits.begin(), hits.end(), [](int h) { return h == 1; }), name + " table " + std::to_string(chirality) + " is not bijective");
+
+            // since FHP-II head-on pairs and symmetric triples collide with a rest particle as spectator too
+            for (int rest : { 0, 0b01000000 })
+            {
+                if (rest && variant == int(Simulation::Variant::FHP1)) continue;
+                std::string with = name + " table " + std::to_string(chirality) + (rest ? " with rest particle" : "");
+                for (int triple : { 0b010101, 0b101010 })
+                {
+                    result.check(table[chirality][triple | rest] == ((triple ^ 0b111111) | rest), with + " doesn't flip triple " + std::to_string(triple));
+                }
+                for (int pair : { 0b001001, 0b010010, 0b100100 })
+                {
+                    result.check(table[chirality][pair | rest] != (pair | rest), with + " doesn't turn pair " + std::to_string(pair));
+                }
+            }
+        }
+    }
+    for (int chirality = 0; chirality < 2; chirality++)
+    {
+        for (int state = 0; state < 256; state++)
+        {
+            std::string at = " table " + std::to_string(chirality) + " state " + std::to_string(state);
+            for (int variant = 0; variant < 3; variant++)
+            {
+                result.check(Simulation::variantLUTs[variant][chirality][state] == referenceTable(variant)[chirality][state], variantNames[variant] + at + " differs from the reference table");
+            }
+            result.check(Simulation::collisionLUT[chirality][state] == fhp3Table[chirality][state], "collisionLUT" + at + " differs from the hand-written table");
+        }
+    }
+    return result;
+}
+
+Verifier::Result Verifier::checkKernels(int width, int height, int steps, uint32_t seed, const std::function<void(Simulation&)>& configure)
+{
+    Result result;
+    std::mt19937 rng(seed);
+    const Simulation::Boundary boundaries[] = { Simulation::Boundary::Open, Simulation::Boundary::Periodic, Simulation::Boundary::BounceBack };
+
+    for (int variant = 0; variant < 3; variant++)
+    {
+        for (Simulation::Boundary x : boundaries)
+        {
+            for (Simulation::Boundary y : boundaries)
+            {
+                if (y == Simulation::Boundary::Periodic && height % 2 != 0) continue;
+                for (int lanes : { 1, 3 })
+                {
+                    // moveStep() + colissionStep(), step(), advance()
+                    for (int kernel = 0; kernel < 3; kernel++)
+                    {
+                        Simulation sim(width, height, 4, randomGrid(rng, width, height), lanes);
+                        sim.setBoundaries(x, y);
+                        sim.setVariant(Simulation::Variant(variant));
+                        sim.setCollisionMode(Simulation::CollisionMode::Alternating);
+                        if (configure) configure(sim);
+
+                        Lattice reference(width * lanes, height);
+                        Lattice next(width * lanes, height);
+                        reference.copyFrom(sim.getGrid());
+
+                        std::string name = std::string(variantNames[variant]) + " x " + boundaryNames[int(x)] + " y " + boundaryNames[int(y)]
+                            + " lanes " + std::to_string(lanes) + (kernel == 0 ? " moveStep() + colissionStep()" : kernel == 1 ? " step()" : " advance()");
+                        if (kernel == 0 && x == Simulation::Boundary::Open && y == Simulation::Boundary::Open)
+                        {
+                            // the neighbour table streams the other edges, where both apply it has to agree with the first moveRow
+                            Lattice viaTable(width * lanes, height);
+                            neighbourStream(reference, viaTable, width, lanes, x, y);
+                            referenceStream(reference, next, width, lanes, x, y);
+                            result.check(std::memcmp(viaTable.data(), next.data(), next.size()) == 0, name + " neighbour table differs from the first moveRow");
+                        }
+                        for (int t = 0; t < steps; t++)
+                        {
+                            if (kernel == 0)
+                            {
+                                sim.moveStep();
+                                sim.colissionStep();
+                            }
+                            else if (kernel == 1)
+                            {
+                                sim.step();
+                            }
+                            else if (t == 0)
+                            {
+                                sim.advance(steps);
+                            }
+                            referenceStream(reference, next, width, lanes, x, y);
+                            referenceCollide(next, width, lanes, referenceTable(variant), t);
+                            reference.swap(next);
+                            // all steps run on one task graph, only the end can be compared
+                            if (kernel == 2 && t < steps - 1) continue;
+
+                            if (std::memcmp(reference.data(), sim.getGrid().data(), reference.size()) != 0)
+                            {
+                                size_t at = std::mismatch(reference.data(), reference.data() + reference.size(), sim.getGrid().data()).first - reference.data();
+                                result.check(false, name + " differs at x " + std::to_string(at % (width * lanes) / lanes) + " y " + std::to_string(at / (width * lanes))
+                                    + " after step " + std::to_string(t));
+                                break;
+                            }
+                            result.check(true, name);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return result;
+}
+
+Verifier::Result Verifier::checkConservation(int width, int height, int steps, uint32_t seed)
+{
+    Result result;
+    std::mt19937 rng(seed);
+    const Simulation::Boundary closed[] = { Simulation::Boundary::Periodic, Simulation::Boundary::BounceBack };
+    const Simulation::CollisionMode modes[] = { Simulation::CollisionMode::Random, Simulation::CollisionMode::Alternating, Simulation::CollisionMode::RandomPlane };
+    height += height % 2;
+
+    for (Simulation::CollisionMode mode : modes)
+    {
+        for (Simulation::Boundary x : closed)
+        {
+            for (Simulation::Boundary y : closed)
+            {
+                for (int lanes : { 1, 2 })
+                {
+                    Simulation sim(width, height, 4, randomGrid(rng, width, height), lanes);
+                    sim.setSeed(seed);
+                    sim.setBoundaries(x, y);
+                    sim.setCollisionMode(mode);
+                    // on a torus the walls are the only thing that changes the momentum of the fluid
+                    bool torus = x == Simulation::Boundary::Periodic && y == Simulation::Boundary::Periodic;
+                    int walls = torus ? sim.addObstacle([](int, int) { return true; }) : -1;
+
+                    std::string name = std::string(modeNames[int(mode)]) + " x " + boundaryNames[int(x)] + " y " + boundaryNames[int(y)] + " lanes " + std::to_string(lanes);
+                    Sums before = referenceSums(sim.getGrid(), lanes, 0, width, 0, height);
+                    for (int t = 0; t < steps; t++)
+                    {
+                        sim.step();
+                        Sums after = referenceSums(sim.getGrid(), lanes, 0, width, 0, height);
+                        result.check(after.count == before.count, name + " changes mass in step " + std::to_string(t));
+                        if (torus)
+                        {
+                            auto change = Simulation::asNormalVelocity({int(after.vx - before.vx), int(after.vy - before.vy)}, lanes, lanes);
+                            auto force = sim.getObstacleForces(walls)[t];
+                            result.check(near(change.first + force.first, 0) && near(change.second + force.second, 0), name + " changes momentum in step " + std::to_string(t));
+                        }
+                        before = after;
+                    }
+
+                    // the same over one task graph run, the forces still come step by step
+                    sim.advance(steps);
+                    Sums after = referenceSums(sim.getGrid(), lanes, 0, width, 0, height);
+                    result.check(after.count == before.count, name + " changes mass in advance()");
+                    if (torus)
+                    {
+                        auto change = Simulation::asNormalVelocity({int(after.vx - before.vx), int(after.vy - before.vy)}, lanes, lanes);
+                        const auto& forces = sim.getObstacleForces(walls);
+                        for (int t = steps; t < 2 * steps; t++)
+                        {
+                            change.first += forces[t].first;
+                            change.second += forces[t].second;
+                        }
+                        result.check(int(forces.size()) == 2 * steps && near(change.first, 0) && near(change.second, 0), name + " changes momentum in advance()");
+                    }
+                }
+            }
+        }
+    }
+    return result;
+}
+
+Verifier::Result Verifier::checkFields(int width, int height, uint32_t seed)
+{
+    Result result;
+    std::mt19937 rng(seed);
+
+    for (int lanes : { 1, 2 })
+    {
+        Simulation sim(width, height, 4, randomGrid(rng, width, height), lanes);
+        const Lattice& grid = sim.getGrid();
+        std::string name = "lanes " + std::to_string(lanes);
+
+        for (auto cell : { std::pair<int, int>(4, 4), std::pair<int, int>(3, 2) })
+        {
+            if (width % cell.first != 0 || height % cell.second != 0) continue;
+            Field velocity = sim.getVelocityField(cell.first, cell.second);
+            Field velocityAndDensity = sim.getVelocityAndDensityField(cell.first, cell.second);
+            Field magnitudeAndDensity = sim.getVelocityMagnitudeAndDensityField(cell.first, cell.second);
+            Field sumsField = sim.getField(cell.first, cell.second, Field::Sums);
+            std::string at = name + " cell " + std::to_string(cell.first) + "x" + std::to_string(cell.second);
+
+            bool ok = true;
+            for (int i = 0; i < height / cell.second; i++)
+            {
+                for (int j = 0; j < width / cell.first; j++)
+                {
+                    Sums sums = referenceSums(grid, lanes, j * cell.first, (j + 1) * cell.first, i * cell.second, (i + 1) * cell.second);
+                    double vx = sums.count != 0 ? (double(sums.vx) / 2.) / sums.count : 0;
+                    double vy = sums.count != 0 ? (double(sums.vy) * 0.8660254) / sums.count : 0;
+                    double density = double(sums.count) / double(cell.first * cell.second * 7 * lanes);
+                    size_t c = velocity.at(j, i);
+                    ok = ok && nearFloat(velocity.vx()[c], vx) && nearFloat(velocity.vy()[c], vy)
+                        && nearFloat(velocityAndDensity.vx()[c], vx) && nearFloat(velocityAndDensity.vy()[c], vy)
+                        && nearFloat(velocityAndDensity.density()[c], density)
+                        && nearFloat(magnitudeAndDensity.magnitude()[c], std::sqrt(vx * vx + vy * vy)) && nearFloat(magnitudeAndDensity.density()[c], density)
+                        && sumsField.sumVx()[c] == sums.vx && sumsField.sumVy()[c] == sums.vy && sumsField.count()[c] == sums.count;
+                }
+            }
+            result.check(ok, at + " velocity/density fields differ from the reference");
+
+            // vorticity by central differences of the reference momentum per site, rows are sqrt(3)/2 apart and y points up
+            Field vorticity = sim.getField(cell.first, cell.second, Field::Vorticity);
+            int cellsX = width / cell.first;
+            int cellsY = height / cell.second;
+            auto referenceVelocity = [&](int j, int i)
+            {
+                Sums sums = referenceSums(grid, lanes, j * cell.first, (j + 1) * cell.first, i * cell.second, (i + 1) * cell.second);
+                double sites = double(cell.first * cell.second * lanes);
+                return std::pair<double, double>((double(sums.vx) / 2.) / sites, (double(sums.vy) * 0.8660254) / sites);
+            };
+            ok = vorticity.channels() == Field::Vorticity;
+            for (int i = 0; i < cellsY; i++)
+            {
+                for (int j = 0; j < cellsX; j++)
+                {
+                    int left = std::max(j - 1, 0), right = std::min(j + 1, cellsX - 1);
+                    int up = std::max(i - 1, 0), down = std::min(i + 1, cellsY - 1);
+                    double dvy = (referenceVelocity(right, i).second - referenceVelocity(left, i).second) / (cell.first * (right - left));
+                    double dvx = (referenceVelocity(j, up).first - referenceVelocity(j, down).first) / (cell.second * 0.8660254 * (down - up));
+                    ok = ok && std::fabs(vorticity.vorticity()[vorticity.at(j, i)] - (dvy - dvx)) <= 1e-5;
+                }
+            }
+            result.check(ok, at + " vorticity differs from the reference");
+        }
+
+        // a region that starts and ends inside cells, cut short at the grid edge
+        int x0 = 5, y0 = 3, cellX = 7, cellY = 5;
+        Field region = sim.getRegionField(x0, y0, width + 10, height - 2, cellX, cellY, Field::Density | Field::Sums);
+        Field sparse = sim.getRegionField(x0, y0, width + 10, height - 2, cellX, cellY, Field::Sums, 1);
+        bool ok = region.width() == (width - x0 + cellX - 1) / cellX && region.height() == (height - 2 - y0 + cellY - 1) / cellY
+            && sparse.width() == region.width() && sparse.height() == region.height();
+        for (int i = 0; ok && i < region.height(); i++)
+        {
+            for (int j = 0; j < region.width(); j++)
+            {
+                int fromX = x0 + j * cellX, fromY = y0 + i * cellY;
+                int toX = std::min(fromX + cellX, width), toY = std::min(fromY + cellY, height - 2);
+                Sums sums = referenceSums(grid, lanes, fromX, toX, fromY, toY);
+                // one sample a cell is its first site
+                Sums first = referenceSums(grid, lanes, fromX, fromX + 1, fromY, fromY + 1);
+                size_t c = region.at(j, i);
+                ok = ok && region.sumVx()[c] == sums.vx && region.sumVy()[c] == sums.vy && region.count()[c] == sums.count
+                    && nearFloat(region.density()[c], double(sums.count) / double((toX - fromX) * (toY - fromY) * 7 * lanes))
+                    && sparse.sumVx()[c] == first.vx && sparse.sumVy()[c] == first.vy && sparse.count()[c] == first.count;
+            }
+        }
+        result.check(ok, name + " region field differs from the reference");
+
+        FieldPyramid pyramid = sim.getFieldPyramid(3);
+        for (int level = 0; level < pyramid.getNumLevels(); level++)
+        {
+            int size = pyramid.getLevel(level).cellSize;
+            Field field = pyramid.getField(size, Field::Velocity | Field::Density);
+            bool ok = true;
+            for (int i = 0; i < field.height(); i++)
+            {
+                for (int j = 0; j < field.width(); j++)
+                {
+                    // edge cells are cut off by the grid
+                    int x1 = std::min((j + 1) * size, width);
+                    int y1 = std::min((i + 1) * size, height);
+                    Sums sums = referenceSums(grid, lanes, j * size, x1, i * size, y1);
+                    int sites = (x1 - j * size) * (y1 - i * size) * lanes;
+                    size_t c = field.at(j, i);
+                    ok = ok && nearFloat(field.vx()[c], sums.count != 0 ? (double(sums.vx) / 2.) / sums.count : 0)
+                        && nearFloat(field.vy()[c], sums.count != 0 ? (double(sums.vy) * 0.8660254) / sums.count : 0)
+                        && nearFloat(field.density()[c], double(sums.count) / double(sites * 7));
+                }
+            }
+            result.check(ok, name + " pyramid cell " + std::to_string(size) + " differs from the reference");
+        }
+    }
+    return result;
+}
+
+Verifier::Result Verifier::runAll()
+{
+    Result result;
+    result.add(checkCollisionTables());
+    result.add(checkKernels(61, 24, 12, 1));
+    // odd tiles and more threads than rows per tile, so every tile edge case is hit
+    result.add(checkKernels(61, 24, 12, 2, [](Simulation& sim)
+    {
+        sim.setNumThreads(3);
+        sim.setTileSize(7, 3);
+    }));
+    result.add(checkConservation(48, 30, 20, 3));
+    result.add(checkFields(60, 36, 4));
+    result.add(checkFields(61, 37, 5));
+    result.add(checkRecording(45, 20, 30, 6));
+    result.add(checkEquilibrium(7));
+    result.add(checkAutotune(8));
+    result.add(checkMovingWindow(40, 24, 12, 9));
+    result.add(checkBackingFile(33, 20, 8, 10));
+    result.add(checkSeeding(40, 16, 10, 11));
+    return result;
+}
+
+Verifier::Result Verifier::checkRecording(int width, int height, int steps, uint32_t seed)
+{
+    Result result;
+    std::mt19937 rng(seed);
+    const Simulation::CollisionMode modes[] = { Simulation::CollisionMode::Random, Simulation::CollisionMode::Alternating, Simulation::CollisionMode::RandomPlane };
+    char path[] = "/tmp/fhph-recording-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0)
+    {
+        result.check(false, "recording can't create a temporary file");
+        return result;
+    }
+    close(fd);
+
+    for (Simulation::CollisionMode mode : modes)
+    {
+        for (int lanes : { 1, 3 })
+        {
+            Simulation sim(width, height, 2, randomGrid(rng, width, height), lanes);
+            sim.setSeed(seed);
+            sim.setBoundaries(Simulation::Boundary::Open, Simulation::Boundary::BounceBack);
+            sim.setCollisionMode(mode);
+            sim.setInflow({{0.5f, 0, 3}});
+            std::string name = std::string("recording ") + modeNames[int(mode)] + " lanes " + std::to_string(lanes);
+
+            std::vector<std::vector<uint8_t>> frames;
+            std::vector<uint64_t> times;
+            {
+                Recorder recorder(path, sim, 7);
+                for (int t = 0; t < steps; t++)
+                {
+                    // one gap, so a frame that can't be predicted is in there too
+                    sim.advance(t == steps / 2 ? 3 : 1);
+                    recorder.record(sim);
+                    frames.emplace_back(sim.getGrid().data(), sim.getGrid().data() + sim.getGrid().size());
+                    times.push_back(sim.getTime());
+                }
+            }
+
+            Recording recording(path);
+            result.check(recording.getNumFrames() == steps && recording.width() == width && recording.replicas() == lanes, name + " has the wrong size");
+            if (recording.getNumFrames() != steps) continue;
+            std::vector<int> order(steps);
+            for (int i = 0; i < steps; i++) order[i] = i;
+            std::shuffle(order.begin(), order.end(), rng);
+            for (int frame : order)
+            {
+                result.check(recording.read(frame) == frames[frame] && recording.getTime(frame) == times[frame], name + " differs in frame " + std::to_string(frame));
+            }
+
+            Simulation replay(width, height, 1, [](Simulation*) {}, lanes);
+            recording.load(steps - 1, replay);
+            result.check(replay.getTime() == times.back() && std::memcmp(replay.getGrid().data(), frames.back().data(), frames.back().size()) == 0, name + " doesn't load into a simulation");
+        }
+    }
+    unlink(path);
+    return result;
+}
+
+Verifier::Result Verifier::checkEquilibrium(uint32_t seed)
+{
+    Result result;
+    std::mt19937 rng(seed);
+    // well inside the feasible region, further out equilibrium() gives up velocity to stay in [0, 1]
+    std::uniform_real_distribution<> densities(0.05, 0.6);
+    std::uniform_real_distribution<> velocities(-0.15, 0.15);
+
+    for (int i = 0; i < 200; i++)
+    {
+        bool rest = i % 2 == 0;
+        double density = densities(rng) * (rest ? 1 : 6. / 7.);
+        double vx = velocities(rng);
+        double vy = velocities(rng);
+        std::array<double, 7> occupation = Simulation::equilibrium(density, vx, vy, rest);
+        double mass = 0, jx = 0, jy = 0;
+        for (int k = 0; k < 7; k++)
+        {
+            result.check(occupation[k] >= 0 && occupation[k] <= 1, "equilibrium occupation out of [0, 1]");
+            mass += occupation[k];
+            if (k < 6)
+            {
+                jx += occupation[k] * dirVx[k] / 2.;
+                jy += occupation[k] * dirVy[k] * 0.8660254;
+            }
+        }
+        std::string at = "equilibrium density " + std::to_string(density) + " velocity " + std::to_string(vx) + ", " + std::to_string(vy) + (rest ? "" : " without rest particles");
+        result.check(near(mass, 7 * density) && near(jx, 7 * density * vx) && near(jy, 7 * density * vy), at + " misses its moments");
+        result.check(rest || occupation[6] == 0, at + " has rest particles");
+    }
+
+    // one cell over the whole grid, the drawn sites have to come out at its density and velocity
+    int width = 400;
+    int height = 200;
+    Field field(1, 1, Field::Velocity | Field::Density);
+    field.density()[0] = 0.3f;
+    field.vx()[0] = 0.2f;
+    field.vy()[0] = -0.1f;
+    for (int lanes : { 1, 2 })
+    {
+        Simulation sim(width, height, 3, randomGrid(rng, width, height), lanes);
+        std::vector<bool> walls;
+        for (size_t i = 0; i < sim.getGrid().size(); i++) walls.push_back(sim.getGrid().data()[i] & 0b10000000);
+        sim.seedEquilibrium(field, width, height);
+
+        bool ok = true;
+        long long fluid = 0;
+        for (size_t i = 0; i < sim.getGrid().size(); i++)
+        {
+            uint8_t value = sim.getGrid().data()[i];
+            ok = ok && (walls[i] ? value == 0b10000000 : !(value & 0b10000000));
+            fluid += !walls[i];
+        }
+        std::string at = "seedEquilibrium lanes " + std::to_string(lanes);
+        result.check(ok, at + " changes the walls");
+        Sums sums = referenceSums(sim.getGrid(), lanes, 0, width, 0, height);
+        // walls hold nothing, so the density is over the fluid sites, a few standard deviations of ~10^5 draws
+        double density = double(sums.count) / (7. * fluid);
+        double vx = (double(sums.vx) / 2.) / sums.count;
+        double vy = (double(sums.vy) * 0.8660254) / sums.count;
+        result.check(std::fabs(density - 0.3) < 0.005 && std::fabs(vx - 0.2) < 0.01 && std::fabs(vy + 0.1) < 0.01, at + " draws the wrong moments");
+    }
+    return result;
+}
+
+Verifier::Result Verifier::checkAutotune(uint32_t seed)
+{
+    Result result;
+    std::mt19937 rng(seed);
+    int width = 300;
+    int height = 60;
+    Simulation sim(width, height, 2, randomGrid(rng, width, height), 2);
+    sim.setInflow({{0.3f, 0, 5}});
+    sim.advance(3);
+    std::vector<uint8_t> before(sim.getGrid().data(), sim.getGrid().data() + sim.getGrid().size());
+
+    Autotune::Options options;
+    options.maxThreads = 3;
+    options.steps = 2;
+    options.modes = { Simulation::CollisionMode::Random, Simulation::CollisionMode::Alternating };
+    Autotune::Config config = Autotune::tune(sim, options);
+    result.check(std::equal(before.begin(), before.end(), sim.getGrid().data()), "autotune changes the lattice");
+    result.check(sim.getTime() == 3 && sim.getNumThreads() == 2 && sim.getTileWidth() == 1024 && sim.getCollisionMode() == Simulation::CollisionMode::Random, "autotune changes the settings");
+    result.check(config.numThreads >= 1 && config.numThreads <= 3 && config.tileWidth >= 1 && config.tileWidth <= width && config.tileHeight >= 1 && config.tileHeight <= height && config.stepsPerSecond > 0,
+        "autotune picks an impossible config");
+
+    char path[] = "/tmp/fhph-autotune-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0)
+    {
+        result.check(false, "autotune can't create a temporary file");
+        return result;
+    }
+    close(fd);
+    Autotune::Config other;
+    other.numThreads = 7;
+    Autotune::save(path, "other", width, height, 2, other);
+    Autotune::save(path, "host", width, height, 2, other);
+    Autotune::save(path, "host", width, height, 2, config);
+    Autotune::Config loaded;
+    bool found = Autotune::load(path, "host", width, height, 2, loaded);
+    result.check(found && loaded.numThreads == config.numThreads && loaded.tileWidth == config.tileWidth && loaded.tileHeight == config.tileHeight && loaded.mode == config.mode
+        && loaded.fieldTileWidth == config.fieldTileWidth && loaded.fieldTileHeight == config.fieldTileHeight, "autotune profile doesn't round trip");
+    result.check(Autotune::load(path, "other", width, height, 2, loaded) && loaded.numThreads == 7, "autotune profile loses other hosts");
+    result.check(!Autotune::load(path, "host", width, height, 1, loaded), "autotune profile matches another grid");
+
+    // the kernel of the profile is only taken when kernels are tuned
+    other.numThreads = 2;
+    other.mode = Simulation::CollisionMode::RandomPlane;
+    Autotune::save(path, Autotune::hostKey(), width, height, 2, other);
+    sim.setCollisionMode(Simulation::CollisionMode::Alternating);
+    config = Autotune::tuned(sim, path);
+    result.check(config.mode == Simulation::CollisionMode::Alternating && sim.getCollisionMode() == Simulation::CollisionMode::Alternating, "autotune profile changes the kernel without modes");
+    config = Autotune::tuned(sim, path, options);
+    result.check(config.mode == Simulation::CollisionMode::RandomPlane && sim.getCollisionMode() == Simulation::CollisionMode::RandomPlane, "autotune profile doesn't set the kernel");
+    std::remove(path);
+    return result;
+}
+
+Verifier::Result Verifier::checkMovingWindow(int width, int height, int steps, uint32_t seed)
+{
+    Result result;
+    std::mt19937 rng(seed);
+    const Simulation::Boundary yBoundaries[] = { Simulation::Boundary::Open, Simulation::Boundary::Periodic, Simulation::Boundary::BounceBack };
+
+    // window column x of window as stored
+    auto at = [](Simulation& window, int x, int y, int r)
+    {
+        return window.getGrid()[y][((x + window.getWindowOrigin()) % (window.getGrid().width() / window.getReplicas())) * window.getReplicas() + r];
+    };
+
+    for (Simulation::Boundary yBoundary : yBoundaries)
+    {
+        for (int lanes : { 1, 2 })
+        {
+            // even shifts keep the column parity of Alternating chirality, odd ones are only streamed
+            for (int shift : { 6, 7, 2 * width + 4 })
+            {
+                bool collide = shift % 2 == 0;
+                std::string where = "moving window y " + std::to_string(int(yBoundary)) + " lanes " + std::to_string(lanes) + " shift " + std::to_string(shift);
+                Simulation window(width, height, 3, randomGrid(rng, width, height), lanes);
+                window.setBoundaries(Simulation::Boundary::Open, yBoundary);
+                window.setCollisionMode(Simulation::CollisionMode::Alternating);
+                std::vector<uint8_t> before(window.getGrid().data(), window.getGrid().data() + window.getGrid().size());
+                window.shiftWindow(shift, 0.25, 0.1, 0., [](int64_t, int y) { return y == 1; });
+
+                // the kept columns moved left, the new ones have the walls of the callback
+                int kept = std::max(0, width - shift);
+                bool moved = true;
+                bool walls = true;
+                long long count = 0;
+                long long fluid = 0;
+                for (int y = 0; y < height; y++)
+                {
+                    for (int x = 0; x < width; x++)
+                    {
+                        for (int r = 0; r < lanes; r++)
+                        {
+                            uint8_t value = at(window, x, y, r);
+                            if (x < kept)
+                            {
+                                moved = moved && value == before[size_t(y) * width * lanes + (x + shift) * lanes + r];
+                                continue;
+                            }
+                            walls = walls && (y == 1 ? value == 0b10000000 : !(value & 0b10000000));
+                            if (y == 1) continue;
+                            count += Simulation::siteMoments.count[value];
+                            fluid++;
+                        }
+                    }
+                }
+                result.check(moved, where + " loses the kept columns");
+                result.check(walls, where + " recycles with the wrong walls");
+                result.check(window.getWindowOffset() == shift, where + " has the wrong offset");
+                if (kept == 0) result.check(std::fabs(double(count) / (7. * fluid) - 0.25) < 0.03, where + " recycles with the wrong density");
+
+                // the same window column by column in a plain simulation
+                Simulation plain(width, height, 2, [&](Simulation* sim)
+                {
+                    for (int y = 0; y < height; y++)
+                    {
+                        for (int x = 0; x < width; x++)
+                        {
+                            sim->getGrid()[y][x] = 0;
+                        }
+                    }
+                }, lanes);
+                for (int y = 0; y < height; y++)
+                {
+                    for (int x = 0; x < width; x++)
+                    {
+                        for (int r = 0; r < lanes; r++)
+                        {
+                            plain.getGrid()[y][x * lanes + r] = at(window, x, y, r);
+                        }
+                    }
+                }
+                plain.setBoundaries(Simulation::Boundary::Open, yBoundary);
+                plain.setCollisionMode(Simulation::CollisionMode::Alternating);
+                plain.setTime(window.getTime());
+                plain.refreshTiles();
+                window.setTileSize(16, 8);
+                for (int step = 0; step < steps; step++)
+                {
+                    if (collide)
+                    {
+                        window.advance(1);
+                        plain.advance(1);
+                    }
+                    else
+                    {
+                        window.moveStep();
+                        plain.moveStep();
+                    }
+                }
+                bool same = true;
+                for (int y = 0; y < height; y++)
+                {
+                    for (int x = 0; x < width; x++)
+                    {
+                        for (int r = 0; r < lanes; r++)
+                        {
+                            same = same && at(window, x, y, r) == plain.getGrid()[y][x * lanes + r];
+                        }
+                    }
+                }
+                result.check(same, where + " steps differently from the moved lattice");
+
+                Field fromWindow = window.getRegionField(3, 0, width - 5, height, 4, 3, Field::Sums);
+                Field fromPlain = plain.getRegionField(3, 0, width - 5, height, 4, 3, Field::Sums);
+                Field sampledWindow = window.getRegionField(0, 0, width, height, 8, 6, Field::Sums, 5);
+                Field sampledPlain = plain.getRegionField(0, 0, width, height, 8, 6, Field::Sums, 5);
+                bool fields = true;
+                for (size_t c = 0; c < fromWindow.size(); c++)
+                {
+                    fields = fields && fromWindow.count()[c] == fromPlain.count()[c] && fromWindow.sumVx()[c] == fromPlain.sumVx()[c] && fromWindow.sumVy()[c] == fromPlain.sumVy()[c];
+                }
+                for (size_t c = 0; c < sampledWindow.size(); c++)
+                {
+                    fields = fields && sampledWindow.count()[c] == sampledPlain.count()[c] && sampledWindow.sumVx()[c] == sampledPlain.sumVx()[c];
+                }
+                result.check(fields, where + " region field isn't over window columns");
+                result.check(window.getRegionVelocity(2, width - 1, 0, height) == plain.getRegionVelocity(2, width - 1, 0, height)
+                    && window.countColOccuppancy(width - 1) == plain.countColOccuppancy(width - 1), where + " region velocity isn't over window columns");
+
+                // spawning touches the stored columns of those window columns only
+                std::vector<uint8_t> unspawned(window.getGrid().data(), window.getGrid().data() + window.getGrid().size());
+                int occupancy = window.countColOccuppancy(width - 2);
+                window.spawnAtX(0.9f, width - 3, 3);
+                bool full = window.countColOccuppancy(width - 2) >= occupancy;
+                for (int y = 0; y < height; y++)
+                {
+                    for (int x = 0; x < width - 3; x++)
+                    {
+                        for (int r = 0; r < lanes; r++)
+                        {
+                            size_t i = size_t(y) * width * lanes + ((x + window.getWindowOrigin()) % width) * lanes + r;
+                            full = full && window.getGrid().data()[i] == unspawned[i];
+                        }
+                    }
+                }
+                result.check(full, where + " spawns outside of the window columns");
+            }
+        }
+    }
+    return result;
+}
+
+void Verifier::referenceStream(const Lattice& grid, Lattice& out, int width, int lanes, Simulation::Boundary xBoundary, Simulation::Boundary yBoundary)
+{
+    // open edges stream like the first solver did
+    if (xBoundary == Simulation::Boundary::Open && yBoundary == Simulation::Boundary::Open)
+    {
+        for (int y = 0; y < grid.height(); y++)
+        {
+            for (int r = 0; r < lanes; r++)
+            {
+                baselineMoveRow(grid, out, y, r, lanes, width);
+            }
+        }
+    }
+    else neighbourStream(grid, out, width, lanes, xBoundary, yBoundary);
+}
+
+void Verifier::referenceCollide(Lattice& grid, int width, int lanes, const std::array<std::array<uint8_t, 256>, 2>& table, uint64_t time)
+{
+    for (int y = 0; y < grid.height(); y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            for (int r = 0; r < lanes; r++)
+            {
+                // the loop of the first colissionStep, the chirality alternates instead of being drawn
+                uint8_t& value = grid[y][x * lanes + r];
+                value = table[table[0][value] == table[1][value] ? 0 : (x + r + y + time) & 1][value];
+            }
+        }
+    }
+}
+
+Verifier::Result Verifier::checkBackingFile(int width, int height, int steps, uint32_t seed)
+{
+    Result result;
+    std::mt19937 rng(seed);
+    char path[] = "/tmp/fhph-backing-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0)
+    {
+        result.check(false, "backing file can't create a temporary file");
+        return result;
+    }
+    close(fd);
+
+    for (int lanes : { 1, 2 })
+    {
+        std::string name = "backing file lanes " + std::to_string(lanes);
+        std::vector<uint8_t> kept;
+        {
+            Simulation sim(width, height, 2, randomGrid(rng, width, height), lanes, path);
+            sim.advance(steps);
+            kept.assign(sim.getGrid().data(), sim.getGrid().data() + sim.getGrid().size());
+        }
+
+        Simulation continued(width, height, 2, nullptr, lanes, path);
+        result.check(continued.getReplicas() == lanes && continued.getGrid().isMapped(), name + " isn't continued");
+        result.check(continued.getGrid().size() == kept.size() && std::memcmp(continued.getGrid().data(), kept.data(), kept.size()) == 0, name + " doesn't give the lattice back");
+    }
+    unlink(path);
+    return result;
+}
+
+Verifier::Result Verifier::checkSeeding(int width, int height, int steps, uint32_t seed)
+{
+    Result result;
+    const int lanes = 3;
+    // everything random comes from the simulation's generator
+    auto ensemble = [&](uint32_t from)
+    {
+        std::unique_ptr<Simulation> made(new Simulation(width, height, 1, [&](Simulation* sim)
+        {
+            sim->getGrid()[0].assign(width, 0b10000000);
+            sim->spawnAtX(0.3f, 0, width);
+        }, lanes, "", from));
+        made->setCollisionMode(Simulation::CollisionMode::Random);
+        made->setInflow({{0.5f, 0, 4}});
+        return made;
+    };
+    auto same = [](Simulation& a, Simulation& b)
+    {
+        return std::memcmp(a.getGrid().data(), b.getGrid().data(), a.getGrid().size()) == 0;
+    };
+
+    std::unique_ptr<Simulation> first = ensemble(seed);
+    std::unique_ptr<Simulation> second = ensemble(seed);
+    std::unique_ptr<Simulation> other = ensemble(seed + 1);
+    result.check(same(*first, *second), "seeding gives different initial ensembles for the same seed");
+    result.check(!same(*first, *other), "seeding gives the same initial ensemble for different seeds");
+
+    bool lanesDiffer = false;
+    for (int y = 0; y < height && !lanesDiffer; y++)
+    {
+        for (int x = 0; x < width && !lanesDiffer; x++)
+        {
+            lanesDiffer = first->getGrid()[y][x * lanes] != first->getGrid()[y][x * lanes + 1];
+        }
+    }
+    result.check(lanesDiffer, "seeding gives every lane the same initial conditions");
+
+    first->advance(steps);
+    second->advance(steps);
+    result.check(same(*first, *second), "seeding gives different ensembles after stepping from the same seed");
+    return result;
+}
@@ -0,0 +1,69 @@
+#ifndef VERIFIER_H
+#define VERIFIER_H
+#include <functional>
+#include <string>
+#include <vector>
+#include "simulation.h"
+
+/* differential checks of the optimised kernels against a plain scalar reference
+the reference streams open edges with the moveRow of the first solver and the other edges site by site with an explicit neighbour table,
+it collides with the hand-written FHP-III table and the FHP-I/FHP-II rules written out one by one, not with the generated tables,
+it is slow and obviously correct, so any reworked kernel has to match it bit for bit in Alternating mode
+the random modes can't be compared site by site, they are checked for conservation of mass and momentum */
+class Verifier
+{
+public:
+    struct Result
+    {
+        bool passed = true;
+        int checks = 0;
+        std::vector<std::string> failures;
+
+        void check(bool ok, const std::string& what);
+        void add(const Result& other);
+    };
+
+    // every table of every variant: bijective, conserves mass and momentum, walls bounce back,
+    // FHP-III collides every state that has a partner with the same mass and momentum
+    static Result checkCollisionTables();
+
+    /* step(), moveStep() + colissionStep() and advance() against the reference for all boundary combinations,
+    single and ensemble grids, configure can change threads/tiles of the simulation under test */
+    static Result checkKernels(int width, int height, int steps, uint32_t seed, const std::function<void(Simulation&)>& configure = nullptr);
+
+    // mass every step in all closed domains and all collision modes, momentum on a torus with obstacles taking their share
+    static Result checkConservation(int width, int height, int steps, uint32_t seed);
+
+    // velocity/density/vorticity getters, region fields and the field pyramid against plain sums over the grid
+    static Result checkFields(int width, int height, uint32_t seed);
+
+    /* Recorder/Recording round trip in all collision modes with inflow, ensembles, keyframes and a gap between frames,
+    read back in shuffled order, the step coding relies on the kernels' Alternating chirality, so it has to match bit for bit */
+    static Result checkRecording(int width, int height, int steps, uint32_t seed);
+
+    // equilibrium() reproduces the density and velocity it was solved for, seedEquilibrium() draws lattices with them and keeps the walls
+    static Result checkEquilibrium(uint32_t seed);
+
+    // Autotune leaves the lattice as it was and gets back from its profile what it put there
+    static Result checkAutotune(uint32_t seed);
+
+    /* a shifted window steps like a lattice that was moved by hand, also across the seam of its ring of columns,
+    recycled columns get the walls and the equilibrium they are given, spawning and region fields count window columns */
+    static Result checkMovingWindow(int width, int height, int steps, uint32_t seed);
+
+    // a run kept in a backing file is continued from it with an empty generator, single lattices and ensembles
+    static Result checkBackingFile(int width, int height, int steps, uint32_t seed);
+
+    // ensembles built and stepped from the same seed are the same lattice, their lanes and other seeds are not
+    static Result checkSeeding(int width, int height, int steps, uint32_t seed);
+
+    static Result runAll();
+
+    // one streaming step of the reference, site x of lane r is at [y][x * lanes + r]
+    static void referenceStream(const Lattice& grid, Lattice& out, int width, int lanes, Simulation::Boundary xBoundary, Simulation::Boundary yBoundary);
+
+    // Alternating mode collision of the reference at the given time step
+    static void referenceCollide(Lattice& grid, int width, int lanes, const std::array<std::array<uint8_t, 256>, 2>& table, uint64_t time);
+};
+
+#endif // VERIFIER_H
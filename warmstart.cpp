@@ -0,0 +1,80 @@
+#include "warmstart.h"
+#include <algorithm>
+#include <chrono>
+
+WarmStart::Coarse WarmStart::develop(const Geometry& geometry, const std::vector<Simulation::Inflow>& inflow, float initialConcentration, Simulation::Variant variant, int factor, int steps, int numThreads)
+{
+    if (factor < 2) throw "WarmStart::develop factor has to be at least 2";
+    if (!geometry.isRasterised()) throw "WarmStart::develop geometry not rasterised";
+    auto t = std::chrono::steady_clock::now();
+
+    int w = (geometry.width() + factor - 1) / factor;
+    int h = (geometry.height() + factor - 1) / factor;
+    // coarse sites that have a wall among their fine sites
+    std::vector<uint8_t> walls(size_t(w) * h, 0);
+    for (int y = 0; y < geometry.height(); y++)
+    {
+        const uint64_t* words = geometry.row(y);
+        for (int word = 0; word < (geometry.width() + 63) / 64; word++)
+        {
+            uint64_t bits = words[word];
+            while (bits)
+            {
+                int x = word * 64 + __builtin_ctzll(bits);
+                walls[size_t(y / factor) * w + x / factor] = 1;
+                bits &= bits - 1;
+            }
+        }
+    }
+
+    std::vector<Simulation::Inflow> coarseInflow;
+    for (const Simulation::Inflow& columns : inflow)
+    {
+        coarseInflow.push_back({columns.concentration, columns.at / factor, std::max(1, columns.width / factor)});
+    }
+
+    Simulation sim(w, h, numThreads, [&](Simulation* sim)
+    {
+        sim->setVariant(variant);
+        for (int y = 0; y < h; y++)
+        {
+            for (int x = 0; x < w; x++)
+            {
+                if (walls[size_t(y) * w + x]) sim->getGrid()[y][x] = 0b10000000;
+            }
+        }
+        sim->spawnAtX(initialConcentration, 0, w);
+        for (const Simulation::Inflow& columns : coarseInflow)
+        {
+            sim->spawnAtX(columns.concentration, columns.at, columns.width);
+        }
+    });
+    sim.setInflow(coarseInflow);
+
+    if (steps <= 0) steps = 4 * w;
+    // the last quarter is averaged, a sample every 10 steps
+    const int coarseCell = 2;
+    const int sampleEvery = 10;
+    int averageFrom = steps - steps / 4;
+    sim.advance(averageFrom);
+    Coarse coarse;
+    int samples = 0;
+    for (int step = averageFrom; step < steps; step += sampleEvery)
+    {
+        sim.advance(std::min(sampleEvery, steps - step));
+        Field sample = sim.getRegionField(0, 0, w, h, coarseCell, coarseCell, Field::Velocity | Field::Density);
+        if (samples == 0) coarse.field = sample;
+        else coarse.field.accumulate(sample, samples);
+        samples++;
+    }
+
+    // slower by factor at the same densities, see the top of warmstart.h
+    for (size_t c = 0; c < coarse.field.size(); c++)
+    {
+        coarse.field.vx()[c] *= factor;
+        coarse.field.vy()[c] *= factor;
+    }
+    coarse.cellSize = coarseCell * factor;
+    coarse.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+    return coarse;
+}
@@ -0,0 +1,31 @@
+#ifndef WARMSTART_H
+#define WARMSTART_H
+#include <vector>
+#include "field.h"
+#include "geometry.h"
+#include "simulation.h"
+
+/* coarse-to-fine warm start: the flow develops on a lattice factor times smaller first, where it costs factor^3 less
+(factor^2 fewer sites, factor times fewer steps for the flow to cross the domain), the full lattice then starts
+from Simulation::seedEquilibrium of the coarse density and velocity instead of from rest
+a coarse site is a wall if any of its factor x factor sites is one, inflow keeps its concentrations
+at the same densities the pressure gradient is factor times steeper over a factor times narrower channel,
+which makes a viscous flow factor times slower, so the velocities are scaled back up by factor
+(the plate channel of 1200 x 300 with factor 4: drag within 10% of its developed value after 1000 steps, from rest after about 6000) */
+class WarmStart
+{
+public:
+    struct Coarse
+    {
+        // Velocity and Density, cells of cellSize x cellSize full lattice sites
+        Field field;
+        int cellSize = 0;
+        double seconds = 0;
+    };
+
+    /* runs steps coarse steps (0 takes 4 coarse widths), the field is averaged over the last quarter of them,
+    inflow columns and initialConcentration as for the full lattice */
+    static Coarse develop(const Geometry& geometry, const std::vector<Simulation::Inflow>& inflow, float initialConcentration, Simulation::Variant variant, int factor, int steps, int numThreads);
+};
+
+#endif // WARMSTART_H